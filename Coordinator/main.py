@@ -2,13 +2,15 @@ import asyncio
 import contextlib
 import json
 import logging
+import time
 import argparse
 import torch
 from torchvision import transforms
 import numpy as np
 from pathlib import Path
 from PIL import Image
-from src.coordniator import Coordinator
+from src.coordniator import Coordinator, KernelPolicy
+from src.planner import PartitionStrategy
 
 # logging.basicConfig(filename='./coordinator.log', 
 #                     filemode='w',
@@ -27,10 +29,10 @@ def setup_logging(log_level: str):
                     level=numeric_level, 
                     format='[%(asctime)s] %(name)s - %(levelname)s - [%(filename)s:%(lineno)d]: %(message)s')
 
-def prepocess_image(image_path: str) -> np.ndarray:
+def prepocess_image(image_path: str, resolution: int = 224) -> np.ndarray:
     prepocess = transforms.Compose([
-        transforms.Resize(256),
-        transforms.CenterCrop(224),
+        transforms.Resize(resolution * 256 // 224),
+        transforms.CenterCrop(resolution),
         transforms.ToTensor(),
         transforms.Normalize(mean=[0.485, 0.456, 0.406], std=[0.229, 0.224, 0.225]),
     ])
@@ -42,24 +44,55 @@ def load_imagenet_labels(path: str) -> list[str]:
     with open(path, 'r') as f:
         return json.load(f)
 
-async def wait_for_workers(coord: Coordinator, num_workers: int):
-    while len(coord.worker_manager.workers.values()) < num_workers:
-        await asyncio.sleep(1)
-    logger.info(f"All {len(coord.worker_manager.workers.values())} workers have connected.")
+async def wait_for_workers(coord: Coordinator, min_workers: int, settle_s: float):
+    """ until at least min_workers have registered and no other has for settle_s, later ones join between layers """
+    count, since = -1, time.monotonic()
+    while True:
+        if coord.registered_workers() != count:
+            count, since = coord.registered_workers(), time.monotonic()
+        if count >= min_workers and time.monotonic() - since >= settle_s:
+            break
+        await asyncio.sleep(0.1)
+    logger.info(f"Starting with {count} workers, more can join at any layer boundary.")
 
-async def main(workers: int):
-    coord = Coordinator(host='192.168.1.10', port=54321)
+async def main(workers: int, window: int, deterministic: bool, partition: str, fuse_blocks: bool,
+               worker_gap: bool = True, channels_last: bool = False, kernel_policy: KernelPolicy = KernelPolicy.PROFILE,
+               resolution: int = 224, pipeline_stages: int = 0, num_images: int = 1,
+               batched: bool = False, speculation: bool = True, join_wait: float = 2.0):
+    strategy = None if partition == 'auto' else PartitionStrategy[partition.upper()]
+    coord = Coordinator(host='192.168.1.10', port=54321, window_size=window, adaptive_partition=not deterministic,
+                        partition_strategy=strategy, fuse_blocks=fuse_blocks, worker_gap=worker_gap,
+                        channels_last=channels_last, kernel_policy=kernel_policy, speculation=speculation)
     print("Coordinator is starting...\n")
     logger.info("Coordinator is starting...")
     server_task = asyncio.create_task(coord.start()) # start will block until the server is closed so we run it in a separate task
-    await wait_for_workers(coord, workers) # block until all workes have connected
+    await wait_for_workers(coord, workers, join_wait)
     try:
         # Load and prepare input data (example)
         input_image_path = Path("./data/panda.jpg")
-        input_image = prepocess_image(str(input_image_path))
+        input_image = prepocess_image(str(input_image_path), resolution)
         labels = load_imagenet_labels("./data/imagenet_labels.json")
         # input_image = np.random.rand(3, 224, 224).astype(np.float32)
-        output = await coord.execute_inference(input_image)
+        if pipeline_stages:
+            # throughput mode: stream the image num_images times through layer stages on disjoint worker groups
+            outputs, stats = await coord.execute_pipelined([input_image] * num_images, pipeline_stages)
+            output = outputs[-1]
+            print(f"Pipelined {stats['images']} images through {len(stats['stages'])} stages: "
+                  f"{stats['throughput_ips']:.2f} images/s, latency p50={stats['latency_p50_ms']:.2f}ms "
+                  f"p90={stats['latency_p90_ms']:.2f}ms p99={stats['latency_p99_ms']:.2f}ms")
+        elif batched:
+            # the classifier and 1x1 convs run once per micro-batch of the num_images copies
+            start_time = time.time()
+            outputs = await coord.execute_batch([input_image] * num_images)
+            output = outputs[-1]
+            logger.info(f"Batched inference of {num_images} images took {(time.time() - start_time) * 1000:.2f}ms")
+        else:
+            for _ in range(num_images):
+                # one after another, the pool follows workers joining and leaving in between
+                start_time = time.time()
+                output = await coord.execute_inference(input_image)
+                logger.info(f"Inference at {resolution}x{resolution} on {len(coord.worker_manager.workers)} workers "
+                            f"took {(time.time() - start_time) * 1000:.2f}ms")
         logger.debug(f"Inference output: {output}")
         # Find the top 5 predictions
         top_5_indices = np.argsort(output)[::-1][:5]
@@ -78,14 +111,35 @@ async def main(workers: int):
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Coordinator for distributed DNN inference")
-    parser.add_argument('--workers', type=int, default=4, help='Number of workers')
+    parser.add_argument('--workers', type=int, default=4, help='Workers to wait for before the first inference, others join as they register')
+    parser.add_argument('--join-wait', type=float, default=2.0, help='Seconds without a new registration before starting')
+    parser.add_argument('--window', type=int, default=1, help='Max in-flight tasks per worker (each worker\'s rows are split into this many tasks)')
+    parser.add_argument('--deterministic', action='store_true', help='Split rows by reported clock only, ignoring measured speed (for benchmarking)')
+    parser.add_argument('--partition', type=str, default='auto', choices=['auto', 'rows', 'out_channels', 'hybrid', 'tiles'],
+                        help='How conv layers are split across workers (auto picks per layer from the cost model)')
+    parser.add_argument('--fuse-blocks', action='store_true', help='Run each inverted residual block (exp+dw+proj) as one task per worker')
+    parser.add_argument('--no-worker-gap', action='store_true', help='Send the last conv output back whole and pool it on the coordinator')
+    parser.add_argument('--layout', type=str, default='chw', choices=['chw', 'hwc'],
+                        help='Activation layout on the wire and in the worker kernels (hwc: channel-last)')
+    parser.add_argument('--kernel-policy', type=str, default='profile', choices=['fixed', 'profile', 'directed'],
+                        help='Who picks each layer\'s kernel variant: native only, the worker from its boot benchmark, or the coordinator')
+    parser.add_argument('--resolution', type=int, default=224, choices=[224, 320, 512],
+                        help='Input image size, the layers up to the global pool run on the larger maps with the same weights')
+    parser.add_argument('--pipeline-stages', type=int, default=0,
+                        help='Split the layers into up to this many stages on disjoint worker groups and stream images through them (0: off)')
+    parser.add_argument('--images', type=int, default=1, help='Images streamed through the pipeline stages, batched, or classified one after another')
+    parser.add_argument('--batched', action='store_true', help='Classify the images in micro-batches sharing each weight load')
+    parser.add_argument('--no-speculation', action='store_true', help='Never reissue a straggling task to an idle worker')
     parser.add_argument('--log-level', type=str, default='INFO', help='Logging level (DEBUG, INFO, WARNING, ERROR)')
     args = parser.parse_args()
 
     setup_logging(args.log_level)
     
     try:
-        asyncio.run(main(args.workers))
+        asyncio.run(main(args.workers, args.window, args.deterministic, args.partition, args.fuse_blocks,
+                         not args.no_worker_gap, args.layout == 'hwc', KernelPolicy[args.kernel_policy.upper()],
+                         args.resolution, args.pipeline_stages, args.images,
+                         args.batched, not args.no_speculation, args.join_wait))
     except KeyboardInterrupt:
         print("\nCoordinator is shutting down...\n")
         logger.info("Coordinator is shutting down...")
\ No newline at end of file
@@ -3,15 +3,46 @@ import logging
 import sys
 import time
 import json
+import itertools
+import copy
+import struct
 import numpy as np
-from dataclasses import dataclass
+from dataclasses import dataclass, replace
 from typing import Optional, Union
 from .protocol import *
 from .work_manager import *
-# from .task_queue import *
+from .task_queue import *
+from .partitioner import *
+from .planner import *
+from .plan import *
+from .pipeline import LayerPipeline
+from .straggler import LatencyTracker
 
 logger = logging.getLogger(__name__)
 
+# the straggler watchdog looks at the running tasks at least this often (s)
+STRAGGLER_POLL_S = 0.005
+# a worker not answering a task within this long (s) is taken for dead, see Coordinator._recover
+RESULT_TIMEOUT_S = 60.0
+# a slice whose workers failed this many times fails the inference
+MAX_SLICE_RETRIES = 3
+# outputs are received straight into their contiguous runs of the layer output when these are at least this long
+# (bytes), shorter runs would cost a socket read each and go through the staging buffer
+MIN_RECV_RUN = 32
+
+
+class WorkerLinkError(ConnectionError):
+    """ the connection to a worker broke or timed out, or its stream lost step, see Coordinator._link_failure """
+
+class WorkerErrorReply(RuntimeError):
+    """ the worker answered a task with a whole MessageType.ERROR, its stream is still at a message boundary """
+
+class KernelPolicy(IntEnum):
+    """ who picks the kernel variant of a single layer task, see TaskMessage.kernel_variant """
+    FIXED = 0, # always the native kernels
+    PROFILE = 1, # the worker, from its boot benchmark of the layer (native if it has none)
+    DIRECTED = 2, # the coordinator, from the boot benchmark each worker reported at registration
+
 @dataclass
 class LayerConfig:
     """layer config for inference execution"""
@@ -28,6 +59,7 @@ class LayerConfig:
     in_w: int = 0
     residual_add_to: Optional[str] = None
     residual_connect_from: Optional[str] = None
+    activation: Activation = Activation.NONE # fused into the requantization, see QuantParams.act_min/act_max
 
 @dataclass
 class QuantParams:
@@ -41,20 +73,88 @@ class QuantParams:
     m: Union[float, np.ndarray] #float # precomputing multiplier for requantization m = (s_in * s_w) / s_out
     s_residual_out: Optional[float] = None
     z_residual_out: Optional[int] = None        
+    # LayerConfig.activation as a clamp of the quantized output, [0, 255] when there is none
+    act_min: int = 0
+    act_max: int = 255
+
+@dataclass
+class ImageState:
+    """ what execute_batch keeps of an image of the micro-batch while the others run a layer """
+    feature_map: np.ndarray
+    residual_buffers: dict[str, tuple[np.ndarray, float, int]]
+    slot: int # its set of layer buffers, see Coordinator.buffer_slot
+
 
 class Coordinator:
-    def __init__(self, host: str = '192, 168, 1, 10', port: int = 54321):
+    def __init__(self, host: str = '192, 168, 1, 10', port: int = 54321,
+                 window_size: int = 1, slices_per_worker: Optional[int] = None,
+                 adaptive_partition: bool = True, partition_strategy: Optional[PartitionStrategy] = None,
+                 fuse_blocks: bool = False, worker_gap: bool = True, channels_last: bool = False,
+                 kernel_policy: KernelPolicy = KernelPolicy.PROFILE, speculation: bool = True):
         self.host: str = host
         self.port: int = port
         self.running = False
         self.worker_manager = WorkerManager()
+
+        # task pipelining: each worker's share of a layer is cut into `slices_per_worker` tasks,
+        # and at most `window_size` of them are outstanding on the worker at any time
+        self.window_size: int = max(1, window_size)
+        self.slices_per_worker: int = max(1, slices_per_worker or self.window_size)
+        self.task_queues: dict[int, TaskQueue] = {}
+        self.next_task_id: int = 1
+
+        # heterogeneity-aware row split; adaptive_partition=False keeps it deterministic for benchmarking
+        self.partitioner = RowPartitioner(adaptive=adaptive_partition)
+        # per-layer choice between row / channel / 2D splits, None lets the cost model decide
+        self.planner = PartitionPlanner()
+        self.partition_strategy: Optional[PartitionStrategy] = partition_strategy
+        # run each inverted residual block (exp -> dw -> proj) as one BLOCK task per row band,
+        # the expanded activation then never crosses the network
+        self.fuse_blocks: bool = fuse_blocks
+        # the conv layer feeding the classifier is global average pooled by the workers
+        self.worker_gap: bool = worker_gap
+        # activations cross the link as [H, W, C] (TASK_FLAG_HWC), which suits the worker's pointwise and
+        # depthwise kernels; layer outputs are then channel-last in memory too, indexed through (C, H, W) views
+        self.channels_last: bool = channels_last
+        self.kernel_policy: KernelPolicy = kernel_policy
+        # reissue a task running far past its worker's usual latency to an idle worker, see _watch_stragglers
+        self.speculation: bool = speculation
+        self.latency = LatencyTracker()
+        # (worker_id, task_id) -> task sent and not yet answered
+        self.in_flight: dict[tuple[int, int], Task] = {}
+        # worker_id -> the task reading its results in the current layer
+        self.drains: dict[int, asyncio.Task] = {}
+        # worker_id -> a drain of an earlier layer still reading results another worker delivered first
+        self.background_drains: dict[int, asyncio.Task] = {}
+        self.unlanded: int = 0 # slices of the current layer not in its output yet
+        self.layer_landed: Optional[asyncio.Event] = None
+        self.layer_failure: Optional[BaseException] = None # a slice of the current layer no worker is left to run
+        # workers that failed a task: no more tasks, their slices went to the others, see _recover
+        self.quarantined: dict[int, WorkerInfo] = {}
+        self.result_timeout_s: float = RESULT_TIMEOUT_S
+        # hot-plug: workers registered since the last layer boundary, and ones to let go of at the next, see _refresh_workers
+        self.joining: dict[int, WorkerInfo] = {}
+        self.leaving: set[int] = set()
+        # _drain_out of the workers that left the pool, awaited by shutdown_workers
+        self.retiring: set[asyncio.Task] = set()
         
         # inference managements
         self.feature_map: Optional[np.ndarray] = None
         self.residual_buffers: dict[str, tuple[np.ndarray, float, int]] = {}
+        # layer outputs, allocated on the first inference and received into in place on the next ones
+        self.layer_buffers: dict[tuple, np.ndarray] = {}
+        # layer outputs of the image in flight use this set of buffers, pipeline stages rotate through a few
+        self.buffer_slot: int = 0
+        # address of a layer output allocated inside its consumer's padding -> (output, padded map, padding, value)
+        self.padded_outputs: dict[int, tuple[np.ndarray, np.ndarray, int, int]] = {}
+        # worker_id -> staging for results that can't be read straight into the layer output
+        self.recv_buffers: dict[int, bytearray] = {}
         self.current_layer_idx: int = 0
         self.layer_config_list: list[LayerConfig] = [] # get the real vale by parsing the json file later
         self.quant_params_list: list[QuantParams] = [] # get the real value from calibration later
+        self.model_hash: Optional[int] = None # of the parsed config, workers flashed with another model get no tasks
+        self.plan: Optional[Plan] = None # compiled on the first inference, see _compile_plan
+        self.batch_plans: dict[int, Plan] = {} # micro-batch size -> its plan, see execute_batch
 
         # stats
         self.stats: list[dict] = []
@@ -63,7 +163,7 @@ class Coordinator:
     async def start(self):
         self.running = True
 
-        server = await asyncio.start_server(self.on_client_connected, self.host, self.port)
+        server = await start_worker_server(self.on_client_connected, self.host, self.port)
         logger.info(f"[Coordinator]: Coordinator started on {self.host}:{self.port}")
 
         tasks = [
@@ -81,7 +181,7 @@ class Coordinator:
             await server.wait_closed()
             logger.info("[Coordinator]: Coordinator stopped.")
 
-    async def on_client_connected(self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter):
+    async def on_client_connected(self, reader: WorkerConnection, writer: WorkerConnection):
         """ connected callback """
         logger.info(f"[Coordinator]: New worker connected from {writer.get_extra_info('peername')}")
         worker = self.worker_manager.add_worker(reader, writer) # worker needs contains some info
@@ -101,13 +201,25 @@ class Coordinator:
                 self.worker_manager.remove_worker(worker)   
                 return
             reg_msg = RegisterMessage.unpack(payload)
+            if reg_msg.protocol_version != PROTOCOL_VERSION:
+                logger.error(f"[Coordinator]: Worker {header.worker_id} speaks protocol version {reg_msg.protocol_version}, "
+                             f"expected {PROTOCOL_VERSION}")
+                ack_msg = RegisterAckMessage(status=ErrorCode.ERR_UNSUPPORTED_PROTOCOL, assigned_id=header.worker_id)
+                await self.worker_manager.send_message(worker, MessageType.REGISTER_ACK, ack_msg.pack())
+                self.worker_manager.remove_worker(worker)
+                return
             worker.worker_id = header.worker_id # notice here we change to the real hardware assigned worker id after registration
-            worker.clock_mhz = reg_msg.clock_mhz
-            logger.info(f"[Coordinator]: Worker {worker.worker_id} registered with clock {worker.clock_mhz} MHz")
+            self._apply_capabilities(worker, reg_msg)
+            logger.info(f"[Coordinator]: Worker {worker.worker_id} registered with clock {worker.clock_mhz} MHz, "
+                        f"buffers {worker.input_buffer_size}/{worker.output_buffer_size}/{worker.scratch_size} B, "
+                        f"model hash {worker.model_hash:#010x}, bench {worker.bench_score} MACs/ms, "
+                        f"weight shards {worker.weight_shards}, {len(worker.kernel_benches)} layers benchmarked")
 
             # send ACK
             ack_msg = RegisterAckMessage(status=0, assigned_id=worker.worker_id)
             await self.worker_manager.send_message(worker, MessageType.REGISTER_ACK, ack_msg.pack())
+            # tasks come once it is admitted, between two layers
+            self.joining[worker.worker_id] = worker
 
             # TODO we need 3 steps handshake for better synchronization, but currently we just assume everything goes fine after registration
 
@@ -126,23 +238,222 @@ class Coordinator:
         #     worker.state = WorkerState.DISCONNECTED
         #     self.worker_manager.remove_worker(worker)
     
+    def registered_workers(self) -> int:
+        """ workers in the pool or joining it at the next layer boundary """
+        return len(self.worker_manager.workers) + len(self.joining)
+
+    def retire_worker(self, worker_id: int):
+        """ take a worker out of the pool at the next layer boundary, after its outstanding results are read """
+        self.leaving.add(worker_id)
+
+    def _refresh_workers(self) -> bool:
+        """ at a layer boundary: let go of departed and retired workers and admit the newly registered ones,
+        whether the pool changed and the rest of the plan has to be recompiled """
+        changed = False
+        for worker in list(self.worker_manager.workers.values()):
+            if worker.worker_id in self.leaving:
+                self.leaving.discard(worker.worker_id)
+                logger.info(f"[Coordinator]: Worker {worker.worker_id} leaves the pool")
+                del self.worker_manager.workers[worker.worker_id]
+                drain = asyncio.create_task(self._drain_out(worker))
+                self.retiring.add(drain)
+                drain.add_done_callback(self.retiring.discard)
+                changed = True
+            elif self._departed(worker):
+                logger.warning(f"[Coordinator]: Worker {worker.worker_id} disconnected, dropping it from the pool")
+                self.worker_manager.remove_worker(worker)
+                changed = True
+        for worker in list(self.joining.values()):
+            del self.joining[worker.worker_id]
+            if not self._admissible(worker):
+                self.worker_manager.remove_worker(worker)
+                continue
+            previous = self.worker_manager.workers.get(worker.worker_id)
+            if previous is not None:
+                # the board reconnected before its old connection was found dead
+                self.worker_manager.remove_worker(previous)
+            self.quarantined.pop(worker.worker_id, None)
+            self.worker_manager.admit(worker)
+            logger.info(f"[Coordinator]: Worker {worker.worker_id} joins the pool of {len(self.worker_manager.workers)} workers")
+            changed = True
+        return changed
+
+    @staticmethod
+    def _departed(worker: WorkerInfo) -> bool:
+        """ the connection failed or the worker closed it; between layers nothing else is left to read """
+        if worker.state == WorkerState.DISCONNECTED:
+            return True
+        return isinstance(worker.reader, (WorkerConnection, asyncio.StreamReader)) and worker.reader.at_eof()
+
+    def _admissible(self, worker: WorkerInfo) -> bool:
+        """ the capability check of a joining worker: the parsed model's weights and a task type of it """
+        if self.model_hash is not None and worker.model_hash != self.model_hash:
+            logger.error(f"[Coordinator]: Worker {worker.worker_id} holds model {worker.model_hash:#010x}, "
+                         f"expected {self.model_hash:#010x}, turning it away")
+            return False
+        types = {layer.type for layer in self.layer_config_list} or {LayerType.CONV, LayerType.FC}
+        if not any(worker.can_run(t) for t in types):
+            logger.error(f"[Coordinator]: Worker {worker.worker_id} runs none of the model's layer types, turning it away")
+            return False
+        return True
+
+    async def _drain_out(self, worker: WorkerInfo):
+        """ read what a retired worker still owes, then shut it down and close its connection """
+        try:
+            await self._settle(worker)
+            await self.worker_manager.send_message(worker, MessageType.SHUTDOWN, b'')
+        finally:
+            self.worker_manager.remove_worker(worker)
+            worker.state = WorkerState.DISCONNECTED
+            logger.info(f"[Coordinator]: Worker {worker.worker_id} drained and disconnected")
+
+    @staticmethod
+    def _apply_capabilities(worker: WorkerInfo, reg_msg: RegisterMessage):
+        worker.clock_mhz = reg_msg.clock_mhz
+        worker.protocol_version = reg_msg.protocol_version
+        worker.input_buffer_size = reg_msg.input_buffer_size
+        worker.output_buffer_size = reg_msg.output_buffer_size
+        worker.scratch_size = reg_msg.scratch_size
+        worker.task_types = reg_msg.task_types
+        worker.task_flags = reg_msg.task_flags
+        worker.model_hash = reg_msg.model_hash
+        worker.bench_score = reg_msg.bench_score
+        worker.weight_shards = {s.layer_idx: (s.oc_start, s.oc_start + s.oc_count) for s in reg_msg.weight_shards}
+        worker.kernel_benches = {}
+        for bench in reg_msg.kernel_benches:
+            worker.kernel_benches.setdefault(bench.layer_idx, {})[bench.variant] = bench.macs_per_ms
+
+    def _capable_workers(self, task_type: LayerType, flags: int = 0) -> list[WorkerInfo]:
+        """ workers holding the parsed model that run task_type tasks with these flags """
+        return [w for w in self.worker_manager.workers.values()
+                if (self.model_hash is None or w.model_hash == self.model_hash) and w.can_run(task_type, flags)
+                and w.worker_id not in self.quarantined]
+
+    def _slices_to_fit(self, worker: WorkerInfo, rows: int, task_bytes) -> int:
+        """ slices_per_worker, or more if a slice of the worker's rows would overflow its buffers
+
+        task_bytes(rows) gives the (input, output) bytes of a task of that many output rows.
+        """
+        parts = self.slices_per_worker
+        while parts < rows:
+            in_bytes, out_bytes = task_bytes(-(-rows // parts))
+            if in_bytes <= worker.input_buffer_size and out_bytes <= worker.output_buffer_size:
+                break
+            parts += 1
+        return parts
+
+    def _tiles_to_fit(self, worker: WorkerInfo, rows: int, cols: int, task_bytes) -> tuple[int, int]:
+        """ (row parts, column parts) of a slice, columns are split too only when even one row overflows the buffers
+
+        task_bytes(rows, cols) gives the (input, output) bytes of a task of that many output rows and columns.
+        """
+        row_parts = self._slices_to_fit(worker, rows, lambda r: task_bytes(r, cols))
+        col_parts = 1
+        while col_parts < cols:
+            in_bytes, out_bytes = task_bytes(-(-rows // row_parts), -(-cols // col_parts))
+            if in_bytes <= worker.input_buffer_size and out_bytes <= worker.output_buffer_size:
+                break
+            col_parts += 1
+        return row_parts, col_parts
+
     async def execute_inference(self, input_data: np.ndarray) -> np.ndarray:
         logger.info(f"[Coordinator]: Starting inference execution for input shape {input_data.shape}")
 
-        self._parse_layer_configs() # parse the layer config and quant params from json file, and fill in the layer_config_list and quant_params_list
+        if self.model_hash is None:
+            self._parse_layer_configs() # once: parse the layer config and quant params from json file, and fill in the layer_config_list and quant_params_list
         self.feature_map = self._quantize_input(input_data, self.quant_params_list[0]) # quantize the input data to uint8, and fill in the feature_map
         self.residual_buffers.clear()
+        self._refresh_workers()
+        # shapes, splits and task messages only change with the input size, the workers or the measured speeds
+        if self.plan is None or self.plan.key != self._plan_key(self.feature_map.shape):
+            self.plan = self._compile_plan(self.feature_map.shape)
         
         start_time = time.time()
-        for layer_idx, (layer, quant_params) in enumerate(zip(self.layer_config_list, self.quant_params_list)):
+        await self._run_steps(self.plan.layers)
+
+        total_time = time.time() - start_time
+        logger.info(f"[Coordinator]: Inference execution completed in {total_time:.4f} seconds")
+        self.print_stats()
+
+        # the classifier output buffer is reused by the next inference
+        return self.feature_map.copy()
+
+    async def execute_pipelined(self, images: list[np.ndarray], num_stages: int) -> tuple[list[np.ndarray], dict]:
+        """ run a stream of images through num_stages layer stages on disjoint worker groups, see LayerPipeline """
+        if self.model_hash is None:
+            self._parse_layer_configs()
+        # the stages keep their workers for the whole stream, workers joining meanwhile come in with the next one
+        self._refresh_workers()
+        logger.info(f"[Coordinator]: Pipelining {len(images)} images through up to {num_stages} stages")
+        return await LayerPipeline(self, num_stages).run(images)
+
+    async def execute_batch(self, images: list[np.ndarray]) -> list[np.ndarray]:
+        """ classify same-sized images together, in micro-batches as large as the workers' buffers allow
+
+        The layers whose weights dominate their cost, the classifier and the 1x1 convs, run once per micro-batch
+        so every weight a worker loads serves all of its images; the others run image by image.
+        """
+        if self.model_hash is None:
+            self._parse_layer_configs()
+        batch = self._max_batch()
+        logger.info(f"[Coordinator]: Starting batched inference of {len(images)} images in micro-batches of {batch}")
+        start_time = time.time()
+        outputs = []
+        for first in range(0, len(images), batch):
+            outputs += await self._run_micro_batch(images[first:first + batch])
+        logger.info(f"[Coordinator]: Batched inference of {len(images)} images completed in {time.time() - start_time:.4f} seconds")
+        self.print_stats()
+        return outputs
+
+    def _max_batch(self) -> int:
+        """ largest micro-batch whose classifier inputs and outputs fit every worker that can run it """
+        batch = TASK_MAX_BATCH
+        for layer in self.layer_config_list:
+            if layer.type != LayerType.FC:
+                continue
+            for worker in self._capable_workers(LayerType.FC):
+                batch = min(batch, worker.input_buffer_size // max(layer.in_channels, 1),
+                            worker.output_buffer_size // max(layer.out_channels, 1))
+        return max(batch, 1)
+
+    async def _run_micro_batch(self, images: list[np.ndarray]) -> list[np.ndarray]:
+        states = []
+        for slot, image in enumerate(images):
+            self.buffer_slot = slot
+            states.append(ImageState(self._quantize_input(image, self.quant_params_list[0]), {}, slot))
+        shape = states[0].feature_map.shape
+        self._refresh_workers()
+        plan = self.batch_plans.get(len(images))
+        if plan is None or plan.key != self._plan_key(shape, batch=len(images)):
+            plan = self.batch_plans[len(images)] = self._compile_plan(shape, batch=len(images))
+        self.stats.clear()
+        await self._run_steps(plan.layers, states)
+        self.buffer_slot = 0
+        # the classifier outputs are views of the micro-batch's reused output buffer
+        return [state.feature_map.copy() for state in states]
+
+    async def _run_steps(self, steps: list[LayerPlan], images: Optional[list[ImageState]] = None):
+        """ run compiled layers on the current feature map, or on each of the images of a micro-batch,
+        recording per-layer stats """
+        for i, step in enumerate(steps):
+            if (i > 0 and self._refresh_workers()) or any(spec.worker.worker_id in self.quarantined for spec in step.tasks):
+                # workers joined, left or were quarantined since the plan was compiled, the rest of the model is
+                # split over the current ones
+                shape = (images[0].feature_map if images else self.feature_map).shape
+                end_layer = steps[-1].layer_idx + steps[-1].num_layers
+                rest = self._compile_plan(shape, step.layer_idx, end_layer, len(images) if images else 1)
+                await self._run_steps(rest.layers, images)
+                return
+            layer_idx, block_len = step.layer_idx, step.num_layers
+            layer, quant_params = self.layer_config_list[layer_idx], self.quant_params_list[layer_idx]
             self.current_layer_idx = layer_idx
             logger.debug(f"[Coordinator]: Executing layer {layer_idx} - {layer.name} ({LayerType(layer.type)})")
             
             # init current layer stats
             self.current_layer_stats = {
                 "layer_idx": layer_idx,
-                "layer_name": layer.name,
-                "layer_type": LayerType(layer.type).name,
+                "layer_name": layer.name if block_len == 1 else self._block_name(layer),
+                "layer_type": LayerType(layer.type).name if block_len == 1 else LayerType.BLOCK.name,
                 "total_time_ms": 0.0,
                 "avg_compute_ms": 0.0,
                 "avg_comm_ms": 0.0,
@@ -150,7 +461,16 @@ class Coordinator:
             }
 
             layer_start = time.perf_counter()
-            await self._run_layer(layer, quant_params)
+            if images is None:
+                await self._run_step(step)
+            elif step.batch > 1:
+                await self._run_batched(step, images)
+            else:
+                for image in images:
+                    self.feature_map, self.residual_buffers, self.buffer_slot = image.feature_map, image.residual_buffers, image.slot
+                    self.current_layer_idx = layer_idx
+                    await self._run_step(step)
+                    image.feature_map = self.feature_map
             layer_time = time.perf_counter() - layer_start
                         
             logger.debug(f"[Coordinator]: Layer {layer_idx} completed in {layer_time:.4f} seconds, output shape {self.feature_map.shape}")
@@ -173,119 +493,617 @@ class Coordinator:
                 # f"comm={self.current_layer_stats['avg_comm_ms']:.2f}ms"
             )
 
-        total_time = time.time() - start_time
-        logger.info(f"[Coordinator]: Inference execution completed in {total_time:.4f} seconds")
-        self.print_stats()
+    async def _run_step(self, step: LayerPlan):
+        if step.num_layers > 1:
+            await self._run_block(step.layer_idx, step.num_layers, step)
+        else:
+            await self._run_layer(self.layer_config_list[step.layer_idx], self.quant_params_list[step.layer_idx], step)
 
-        return self.feature_map
+    async def _run_batched(self, step: LayerPlan, images: list[ImageState]):
+        """ one set of tasks for a layer on all images of a micro-batch
 
-    async def _run_layer(self, layer: LayerConfig, quant_params: QuantParams):
-        if layer.residual_add_to:
-            self.residual_buffers[layer.residual_add_to] = (self.feature_map.copy(), quant_params.s_in, quant_params.z_in)
-            logger.debug(f"[Coordinator]: Stored residual buffer for {layer.residual_add_to} with shape {self.feature_map.shape}")
-        
-        # before fc, we needs a global average pooling and flatten
-        if layer.type == LayerType.FC and self.feature_map.ndim == 3:
+        Classifier inputs go one vector after another and come back class-major, conv maps are stacked along
+        their rows; a 1x1 stride 1 conv has no halo, so the stack computes exactly as the images one by one.
+        """
+        layer, quant_params = self.layer_config_list[step.layer_idx], self.quant_params_list[step.layer_idx]
+        inputs = []
+        for image in images:
+            self.feature_map, self.residual_buffers = image.feature_map, image.residual_buffers
+            self._store_residual(layer, quant_params)
+            if layer.type == LayerType.FC:
+                self._pool_for_classifier()
+            inputs.append(self.feature_map)
+
+        if layer.type == LayerType.FC:
+            self.feature_map = np.stack(inputs)
+        elif self.channels_last:
+            # stacked in the HWC storage the tiles are cut from
+            self.feature_map = np.concatenate([m.transpose(1, 2, 0) for m in inputs]).transpose(2, 0, 1)
+        else:
+            self.feature_map = np.concatenate(inputs, axis=1)
+        self.buffer_slot = -1 # the micro-batch's own, stacked, buffers
+        await self._run_tasks(step)
+
+        stacked, rows = self.feature_map, step.out_shape[1] // len(images)
+        for b, image in enumerate(images):
+            self.feature_map = stacked[:, b] if layer.type == LayerType.FC else stacked[:, b * rows:(b + 1) * rows]
+            self.residual_buffers, self.buffer_slot = image.residual_buffers, image.slot
+            if layer.residual_connect_from:
+                await self._apply_residual(layer.residual_connect_from)
+            image.feature_map = self.feature_map
+
+    def _pool_for_classifier(self):
+        """ global average pool a map reaching the classifier unpooled """
+        if self.feature_map.ndim == 3:
             gap_output = np.mean(self.feature_map, axis=(1, 2))
             self.feature_map = np.round(gap_output).astype(np.uint8)
             logger.debug(f"[Coordinator]: Applied GAP for FC layer, new shape {self.feature_map.shape}")
             with np.printoptions(threshold=sys.maxsize, linewidth=150):
                 logger.debug(f"[Coordinator]: Sample GAP output values:\n{self.feature_map}\n")
 
+    async def _run_layer(self, layer: LayerConfig, quant_params: QuantParams, plan: Optional[LayerPlan] = None):
+        self._store_residual(layer, quant_params)
+        
+        # before fc, we needs a global average pooling and flatten
         if layer.type == LayerType.FC:
-            await self._distribute_fc(layer, quant_params)
+            self._pool_for_classifier()
+
+        if layer.type == LayerType.FC:
+            await self._distribute_fc(layer, quant_params, plan)
         else:
             # deal with both conv2d and depthwise
-            await self._distribute_conv(layer, quant_params)
+            await self._distribute_conv(layer, quant_params, self._pooled_by_workers(layer), plan)
         
         # apply residual
         if layer.residual_connect_from:
             await self._apply_residual(layer.residual_connect_from)
+
+    def _pooled_by_workers(self, layer: LayerConfig) -> bool:
+        """ whether the workers global average pool this layer's output, true for the conv feeding the classifier """
+        next_idx = layer.layer_idx + 1
+        return (self.worker_gap and next_idx < len(self.layer_config_list)
+                and self.layer_config_list[next_idx].type == LayerType.FC)
+
+    def _plan_key(self, in_shape: tuple, first_layer: int = 0, end_layer: Optional[int] = None, batch: int = 1) -> tuple:
+        """ what a compiled Plan depends on besides the constructor options """
+        workers = tuple(sorted(w for w in self.worker_manager.workers if w not in self.quarantined))
+        return (self.model_hash, tuple(in_shape), workers, self.partitioner.version,
+                first_layer, end_layer, batch)
+
+    def _compile_plan(self, in_shape: tuple, first_layer: int = 0, end_layer: Optional[int] = None, batch: int = 1) -> Plan:
+        """ walk layers [first_layer, end_layer) of the model on shapes alone and work out their tasks, see Plan
+
+        in_shape is an image's, with batch > 1 the layers _batched runs once for the micro-batch get batched steps.
+        """
+        plan = Plan(self._plan_key(in_shape, first_layer, end_layer, batch))
+        shape = tuple(in_shape)
+        layer_idx = first_layer
+        end_layer = len(self.layer_config_list) if end_layer is None else end_layer
+        while layer_idx < end_layer:
+            step = self._plan_step(layer_idx, shape, end_layer, batch)
+            plan.layers.append(step)
+            shape = step.out_shape
+            if step.batch > 1:
+                # an image's part of the stacked output
+                shape = shape[:1] if len(shape) == 2 else (shape[0], shape[1] // step.batch, shape[2])
+            layer_idx += step.num_layers
+        logger.info(f"[Coordinator]: Compiled an execution plan of {len(plan.layers)} steps for input {tuple(in_shape)} "
+                    f"on workers {list(plan.key[2])}")
+        return plan
     
+    def _plan_step(self, layer_idx: int, in_shape: tuple, end_layer: int, batch: int = 1) -> LayerPlan:
+        """ the layer at layer_idx, or the fused block starting there if it ends by end_layer """
+        layer, quant_params = self.layer_config_list[layer_idx], self.quant_params_list[layer_idx]
+        block_len = self._block_len(layer_idx, in_shape[2]) if self.fuse_blocks and len(in_shape) == 3 else 1
+        if layer_idx + block_len > end_layer:
+            block_len = 1 # a pipeline stage boundary cuts the block
+        if batch > 1 and block_len == 1 and self._batched(layer, in_shape):
+            if layer.type == LayerType.FC:
+                step = self._plan_fc(layer, quant_params, in_shape[0], batch)
+            else:
+                C, H, W = in_shape
+                step = self._plan_conv(layer, quant_params, (C, batch * H, W))
+                step.out_border = (0, 0) # the consumer pads each image's part on its own
+            step.batch = batch
+        elif block_len > 1:
+            step = self._plan_block(self.layer_config_list[layer_idx:layer_idx + block_len], self._block_residual(layer_idx, block_len),
+                                    self.quant_params_list[layer_idx:layer_idx + block_len], in_shape)
+        elif layer.type == LayerType.FC:
+            # a map reaching the classifier unpooled is pooled by the coordinator first
+            step = self._plan_fc(layer, quant_params, in_shape[0])
+        else:
+            step = self._plan_conv(layer, quant_params, in_shape, self._pooled_by_workers(layer))
+        for spec in step.tasks:
+            spec.predicted_ms = self._predict_ms(step, spec)
+        return step
+
+    def _predict_ms(self, step: LayerPlan, spec: TaskSpec) -> float:
+        """ how long the task should take on its worker under the partitioner's rates, input transfer included """
+        msg, partitioner = spec.msg, self.partitioner
+        kind = step.kind if step.kind is not None else LayerType.FC
+        if step.num_layers > 1:
+            macs = (spec.end_idx - spec.start_idx) * step.cost.macs
+        elif step.flat_input:
+            macs = msg.in_features * msg.out_features * max(1, msg.batch)
+        else:
+            macs = msg.out_h * msg.out_w * msg.out_channels * step.macs_per_pixel
+        return (macs / partitioner.rate(spec.worker, kind, step.layer_idx) + partitioner.task_overhead_ms
+                + msg.input_size / partitioner.bytes_per_ms)
 
-    async def _distribute_conv(self, layer: LayerConfig, quant_params: QuantParams):
-        """Split the feature map by rows"""
-        C, H, W = self.feature_map.shape
+    def _batched(self, layer: LayerConfig, in_shape: tuple) -> bool:
+        """ whether a micro-batch runs the layer as one set of tasks: the classifier, and the 1x1 stride 1 convs
+        not pooled by the workers, whose images can be stacked along the rows """
+        if layer.type == LayerType.FC:
+            return True
+        return (layer.type == LayerType.CONV and layer.kernel_size == 1 and layer.stride == 1 and layer.padding == 0
+                and len(in_shape) == 3 and not self._pooled_by_workers(layer))
+
+    async def _run_tasks(self, step: LayerPlan):
+        """ send a compiled layer's tasks on the current feature map and collect its output """
+        if step.partition:
+            self.current_layer_stats["partition"] = step.partition
+        source = self._pad(self.feature_map, *step.in_border) if step.in_border[0] > 0 else self.feature_map
+        if step.flat_input:
+            source = source.reshape(-1)
+        tasks = []
+        self.task_queues.clear()
+        for spec in step.tasks:
+            task = self._new_task(spec.worker, spec.msg, source[spec.patch], spec.start_idx, spec.end_idx, spec.ch_start, spec.ch_end)
+            task.col_start, task.col_end, task.pooled = spec.col_start, spec.col_end, spec.pooled
+            # layers planned outside _plan_step, e.g. through _distribute_conv, have no prediction yet
+            task.predicted_ms = spec.predicted_ms or self._predict_ms(step, spec)
+            self.task_queues.setdefault(spec.worker.worker_id, TaskQueue(self.window_size)).add_task(task)
+            tasks.append((spec.worker, spec.start_idx, spec.end_idx, task))
+
+        # fill every worker's window, the rest is sent as results come back
+        await asyncio.gather(*[self._fill_window(queue) for queue in self.task_queues.values()])
+        output = await self._collect_results(tasks, step.out_shape, step.out_dtype, step.out_border)
+        if step.out_dtype == np.uint32:
+            # per-channel sums of tiles of the pooled map
+            output = np.round(output / step.pool_pixels).astype(np.uint8)
+        self.feature_map = output
+
+        if self.current_layer_stats.get("speculative") or self.current_layer_stats.get("retries"):
+            # some slices ran on other workers than planned, the per-worker times don't match the split
+            return
+        if step.cost is not None:
+            rows: dict[int, int] = {}
+            for worker, start_row, end_row, _ in tasks:
+                rows[worker.worker_id] = rows.get(worker.worker_id, 0) + end_row - start_row
+            for worker_id, ws in self.current_layer_stats.get("workers", {}).items():
+                worker = self.worker_manager.workers.get(worker_id)
+                if worker is not None:
+                    self.partitioner.observe(worker, step.kind, rows.get(worker_id, 0), step.cost, ws["mcu_compute_ms"])
+        elif step.kind is not None:
+            self._observe_layer(tasks, step.macs_per_pixel, step.kind)
+
+    def _pad(self, feature_map: np.ndarray, padding: int, value: int) -> np.ndarray:
+        """ pad H and W of a (C, H, W) map, keeping its channel-last memory layout in channels_last mode
+
+        Layer outputs received inside this border already (see _layer_buffer) come back as their padded map, uncopied.
+        """
+        cached = self.padded_outputs.get(feature_map.ctypes.data)
+        if cached is not None:
+            output, padded, cached_padding, cached_value = cached
+            if ((cached_padding, cached_value) == (padding, value) and output.shape == feature_map.shape
+                    and output.strides == feature_map.strides):
+                return padded
+        if self.channels_last:
+            hwc = np.pad(feature_map.transpose(1, 2, 0), ((padding, padding), (padding, padding), (0, 0)),
+                         mode='constant', constant_values=value)
+            return hwc.transpose(2, 0, 1)
+        return np.pad(feature_map, ((0, 0), (padding, padding), (padding, padding)),
+                      mode='constant', constant_values=value)
+
+    @staticmethod
+    def _activations(quant_params: list[QuantParams]) -> tuple[int, Optional[list[tuple[int, int]]]]:
+        """ TASK_FLAG_ACTIVATION and the clamp of each layer of a task, nothing if none narrows [0, 255] """
+        activations = [(qp.act_min, qp.act_max) for qp in quant_params]
+        if all(act == (0, 255) for act in activations):
+            return 0, None
+        return TASK_FLAG_ACTIVATION, activations
+
+    def _store_residual(self, layer: LayerConfig, quant_params: QuantParams):
+        if layer.residual_add_to:
+            # no copy: every layer writes its own output buffer, nothing overwrites this map before the add consumes it
+            self.residual_buffers[layer.residual_add_to] = (self.feature_map, quant_params.s_in, quant_params.z_in)
+            logger.debug(f"[Coordinator]: Stored residual buffer for {layer.residual_add_to} with shape {self.feature_map.shape}")
+
+    @staticmethod
+    def _block_name(layer: LayerConfig) -> str:
+        return layer.name.rsplit('_', 1)[0] # blk3_exp -> blk3
+
+    def _block_len(self, layer_idx: int, in_w: Optional[int] = None) -> int:
+        """ number of layers of the inverted residual block starting at layer_idx, 1 if it doesn't start one
+
+        A block is [1x1 expand] -> depthwise -> 1x1 project, all named after the same block. Only the
+        first layer may cache a residual input and only the last one may add it, everything in between
+        never leaves the worker.
+        """
+        layers = self.layer_config_list
+        def pointwise(i):
+            return i < len(layers) and layers[i].type == LayerType.CONV and layers[i].kernel_size == 1
+        def depthwise(i):
+            return i < len(layers) and layers[i].type == LayerType.DEPTHWISE
+
+        if pointwise(layer_idx) and depthwise(layer_idx + 1) and pointwise(layer_idx + 2):
+            count = 3
+        elif depthwise(layer_idx) and pointwise(layer_idx + 1):
+            count = 2
+        else:
+            return 1
+        block = layers[layer_idx:layer_idx + count]
+        if len({self._block_name(layer) for layer in block}) != 1:
+            return 1
+        # every worker of a block task needs all channels of each of its layers
+        if any(layer.layer_idx in worker.weight_shards
+               for worker in self.worker_manager.workers.values() for layer in block):
+            return 1
+        if any(layer.residual_add_to for layer in block[1:]) or any(layer.residual_connect_from for layer in block[:-1]):
+            return 1
+        # someone has to run it: any flag a block task may carry, and the scratch for its rolling window
+        if not self._block_workers(block, TASK_FLAG_RESIDUAL | TASK_FLAG_ACTIVATION | (TASK_FLAG_HWC if self.channels_last else 0), in_w):
+            return 1
+        return count
+
+    def _block_workers(self, layers: list[LayerConfig], flags: int, in_w: Optional[int] = None) -> list[WorkerInfo]:
+        """ workers that run block tasks with these flags and have the scratch for this block on an in_w wide
+        input, the current feature map by default """
+        need = self._block_scratch(layers, self.feature_map.shape[2] if in_w is None else in_w, self.channels_last)
+        return [w for w in self._capable_workers(LayerType.BLOCK, flags) if w.scratch_size >= need]
+
+    @staticmethod
+    def _block_scratch(layers: list[LayerConfig], in_w: int, hwc: bool) -> int:
+        """ bytes of worker scratch a fused block needs, mirrors block::scratch_size """
+        dw, proj = layers[-2], layers[-1]
+        win_w = in_w + 2 * dw.padding
+        out_w = (win_w - dw.kernel_size) // dw.stride + 1
+        mid = dw.in_channels
+        size = mid * dw.kernel_size * win_w # rolling window
+        if len(layers) == 3:
+            size += (0 if hwc else layers[0].in_channels * in_w) + mid * in_w # gathered input row + expanded row
+        size += mid * out_w + (0 if hwc else proj.out_channels * out_w) # depthwise row + projected row
+        return size
+
+    def _block_residual(self, first_idx: int, count: int) -> Optional[ResidualParams]:
+        """ the residual add of a block whose skip connection stays inside it, None otherwise """
+        layers = self.layer_config_list[first_idx:first_idx + count]
+        first_qp, last_qp = self.quant_params_list[first_idx], self.quant_params_list[first_idx + count - 1]
+        if layers[-1].residual_connect_from and layers[-1].residual_connect_from == layers[0].residual_add_to:
+            # every worker still holds its block input rows, so it adds them itself and the coordinator
+            # keeps no copy of the input
+            return ResidualParams.from_scales(last_qp.s_out, last_qp.z_out, first_qp.s_in, first_qp.z_in,
+                                              last_qp.s_residual_out, last_qp.z_residual_out)
+        return None
+
+    async def _run_block(self, first_idx: int, count: int, plan: Optional[LayerPlan] = None):
+        layers = self.layer_config_list[first_idx:first_idx + count]
+        residual = self._block_residual(first_idx, count)
+        if residual is None:
+            self._store_residual(layers[0], self.quant_params_list[first_idx])
+        await self._distribute_block(layers, residual, self.quant_params_list[first_idx:first_idx + count], plan)
+        # the block's output is the project layer's, its quant params apply to the residual add
+        self.current_layer_idx = first_idx + count - 1
+        if layers[-1].residual_connect_from and residual is None:
+            await self._apply_residual(layers[-1].residual_connect_from)
+
+    async def _distribute_block(self, layers: list[LayerConfig], residual: Optional[ResidualParams] = None,
+                                quant_params: Optional[list[QuantParams]] = None, plan: Optional[LayerPlan] = None):
+        """Split a fused block by output rows; workers get unpadded block input rows and pad the depthwise input themselves"""
+        await self._run_tasks(plan or self._plan_block(layers, residual, quant_params, self.feature_map.shape))
+
+    def _plan_block(self, layers: list[LayerConfig], residual: Optional[ResidualParams], quant_params: Optional[list[QuantParams]],
+                    in_shape: tuple) -> LayerPlan:
+        dw, proj = layers[-2], layers[-1]
+        C, H, W = in_shape
+        k, s, p = dw.kernel_size, dw.stride, dw.padding
+        H_out = (H + 2 * p - k) // s + 1
+        W_out = (W + 2 * p - k) // s + 1
+
+        act_flags, activations = self._activations(quant_params or [])
+        act_flags |= TASK_FLAG_HWC if self.channels_last else 0
+        flags = (TASK_FLAG_RESIDUAL if residual is not None else 0) | act_flags
+        available_workers = self._block_workers(layers, flags, W)
+        if not available_workers:
+            raise RuntimeError(f"No worker can run block {self._block_name(layers[0])}")
+        kind = LayerType.BLOCK
+        cost = self._block_row_cost(layers, W, W_out)
+        assignments = self.partitioner.split(available_workers, H_out, kind, cost)
+        specs = []
+
+        for worker, start_row, end_row in assignments:
+            parts = self._slices_to_fit(worker, end_row - start_row,
+                                        lambda rows: (C * min(H, (rows - 1) * s + k) * W, proj.out_channels * rows * W_out))
+            for sub_start, sub_end in self._split_range(start_row, end_row, parts):
+                # block input rows under the depthwise window, the padding rows are left to the worker
+                in_start_y = max(0, sub_start * s - p)
+                in_end_y = min(H, (sub_end - 1) * s - p + k)
+
+                task_msg = TaskMessage(
+                    layer_type=LayerType.BLOCK,
+                    layer_idx=layers[0].layer_idx,
+                    in_channels=C,
+                    in_h=in_end_y - in_start_y,
+                    in_w=W,
+                    out_channels=proj.out_channels,
+                    out_h=sub_end - sub_start,
+                    out_w=W_out,
+                    kernel_size=k,
+                    stride=s,
+                    padding=p,
+                    groups=dw.groups,
+                    in_features=0,
+                    out_features=0,
+                    input_size=C * (in_end_y - in_start_y) * W,
+                    out_row_start=sub_start,
+                    num_layers=len(layers),
+                    flags=flags,
+                    residual=residual,
+                    activations=activations,
+                )
+                task_msg.packed = task_msg.pack()
+                specs.append(TaskSpec(worker, task_msg, (slice(None), slice(in_start_y, in_end_y), slice(None)),
+                                      sub_start, sub_end, 0, proj.out_channels))
+                logger.debug(f"[Coordinator]: Assigned output rows {sub_start}-{sub_end} of block {self._block_name(layers[0])} "
+                             f"to worker {worker.worker_id}")
+
+        return LayerPlan(layers[0].layer_idx, len(layers), specs, (proj.out_channels, H_out, W_out), f"BLOCK {len(assignments)}x1x1",
+                         out_border=self._consumer_border(layers[-1].layer_idx + 1, W_out), kind=kind, cost=cost)
+
+    @staticmethod
+    def _block_row_cost(layers: list[LayerConfig], in_w: int, out_w: int) -> RowCost:
+        """ per output row cost of a fused block, in_w is the unpadded block input width """
+        dw, proj = layers[-2], layers[-1]
+        in_channels = layers[0].in_channels
+        macs = out_w * dw.out_channels * (dw.kernel_size ** 2 + proj.out_channels)
+        if len(layers) == 3:
+            # every output row needs `stride` new expanded input rows
+            macs += dw.stride * in_w * in_channels * dw.in_channels
+        in_row_bytes = in_channels * in_w
+        return RowCost(
+            macs=macs,
+            bytes=in_row_bytes * dw.stride + proj.out_channels * out_w,
+            fixed_bytes=in_row_bytes * max(dw.kernel_size - dw.stride, 0),
+        )
+
+    async def _distribute_conv(self, layer: LayerConfig, quant_params: QuantParams, pool: bool = False,
+                               plan: Optional[LayerPlan] = None):
+        """Split the layer by output rows, output channels or both, whichever the planner predicts is fastest
+
+        With `pool` the workers also global average pool their tiles and the layer output is the (C,)
+        pooled vector. Tiles covering the whole map return means, otherwise per-channel sums that are
+        added up here; either way the result equals np.round(np.mean(...)) over the full output.
+        """
+        await self._run_tasks(plan or self._plan_conv(layer, quant_params, self.feature_map.shape, pool))
+
+    def _plan_conv(self, layer: LayerConfig, quant_params: QuantParams, in_shape: tuple, pool: bool = False) -> LayerPlan:
+        C, H, W = in_shape
         H_out = (H + 2 * layer.padding - layer.kernel_size) // layer.stride + 1
         W_out = (W + 2 * layer.padding - layer.kernel_size) // layer.stride + 1
+        padded_shape = (C, H + 2 * layer.padding, W + 2 * layer.padding)
         
-        if layer.padding > 0:
-            padded = np.pad(
-                self.feature_map,
-                ((0, 0), (layer.padding, layer.padding), (layer.padding, layer.padding)),
-                mode='constant',
-                constant_values=quant_params.z_in
-            )
+        act_flags, activations = self._activations([quant_params])
+        act_flags |= TASK_FLAG_HWC if self.channels_last else 0
+        available_workers = self._capable_workers(layer.type, act_flags | (TASK_FLAG_GAP | TASK_FLAG_GAP_MEAN if pool else 0))
+        if not available_workers:
+            raise RuntimeError(f"No worker can run layer {layer.name}")
+        kind = RowPartitioner.layer_kind(layer.type, layer.kernel_size)
+        shards = self._shard_slices(layer.layer_idx, layer.out_channels, available_workers)
+        if shards:
+            # the weights only exist in pieces, each piece's channels go to the workers holding it
+            slices = [(worker, (0, H_out), channels, (0, W_out)) for worker, channels in shards]
+            partition = f"{PartitionStrategy.OUT_CHANNELS.name} 1x{len(slices)}x1 (sharded)"
         else:
-            padded = self.feature_map
+            plan = self.planner.choose(layer, padded_shape[2], H_out, W_out, len(available_workers), self.partition_strategy,
+                                       [w.clock_mhz for w in available_workers])
+            partition = f"{plan.strategy.name} {plan.row_groups}x{plan.channel_groups}x{plan.col_groups}"
+            slices = self._assign_slices(plan, available_workers, layer, kind, padded_shape, H_out, W_out)
+        specs = []
+        # workers compute tiles larger than their output buffer block by block (streamed, or pooled per channel
+        # block), except pooled channel-last depthwise ones whose channels can't be blocked
+        output_bounded = pool and self.channels_last and layer.type == LayerType.DEPTHWISE
+        def task_bytes(channels: tuple[int, int]):
+            in_channels = channels[1] - channels[0] if layer.type == LayerType.DEPTHWISE else C
+            return lambda rows, cols: (in_channels * ((rows - 1) * layer.stride + layer.kernel_size) * ((cols - 1) * layer.stride + layer.kernel_size),
+                                       (channels[1] - channels[0]) * rows * cols if output_bounded else 0)
+        # tasks per slice: slices_per_worker row tiles, more (and column tiles on wide maps) where one would overflow
+        # the worker's buffers
+        parts = [self._tiles_to_fit(worker, rows[1] - rows[0], cols[1] - cols[0], task_bytes(channels))
+                 for worker, rows, channels, cols in slices]
+        gap_flags = 0
+        if pool:
+            gap_flags = TASK_FLAG_GAP
+            if all(n == (1, 1) for n in parts) and all(rows == (0, H_out) and cols == (0, W_out) for _, rows, _, cols in slices):
+                gap_flags |= TASK_FLAG_GAP_MEAN
         
-        available_workers = list(self.worker_manager.workers.values())
-        num_workers = len(available_workers) # TODO maybe get idle workers
-        rows_per_worker = int(np.ceil(H_out / num_workers))
-        tasks = []
-        
-        for i, worker in enumerate(available_workers):
-            start_row = i * rows_per_worker
-            end_row = min(start_row + rows_per_worker, H_out)
+        for (worker, (start_row, end_row), (ch_start, ch_end), cols), (row_parts, col_parts) in zip(slices, parts):
+            for (sub_start, sub_end), (col_start, col_end) in itertools.product(self._split_range(start_row, end_row, row_parts),
+                                                                                self._split_range(*cols, col_parts)):
+                # a column tile also carries the kernel_size - stride halo columns
+                in_start_x = col_start * layer.stride
+                in_end_x = (col_end - 1) * layer.stride + layer.kernel_size
+                in_start_y = sub_start * layer.stride
+                in_end_y = (sub_end - 1) * layer.stride + layer.kernel_size
+                # depthwise channels are independent, only send the planes of our own channels
+                channels = slice(ch_start, ch_end) if layer.type == LayerType.DEPTHWISE else slice(None)
+                in_channels = ch_end - ch_start if layer.type == LayerType.DEPTHWISE else C
 
-            if start_row >= H_out:
-                continue
+                task_msg = TaskMessage(
+                    layer_type=layer.type,
+                    layer_idx=layer.layer_idx,
+                    in_channels=in_channels,
+                    in_h=in_end_y - in_start_y,
+                    in_w=in_end_x - in_start_x,
+                    out_channels=ch_end - ch_start,
+                    out_h=sub_end - sub_start,
+                    out_w=col_end - col_start,
+                    kernel_size=layer.kernel_size,
+                    stride=layer.stride,
+                    padding=layer.padding,
+                    groups=layer.groups,
+                    in_features=0,
+                    out_features=0,
+                    input_size=in_channels * (in_end_y - in_start_y) * (in_end_x - in_start_x),
+                    out_ch_start=ch_start,
+                    out_row_start=sub_start,
+                    out_col_start=col_start,
+                    flags=gap_flags | act_flags,
+                    kernel_variant=self._kernel_variant(worker, layer),
+                    activations=activations,
+                )
+                task_msg.packed = task_msg.pack()
+                spec = TaskSpec(worker, task_msg, (channels, slice(in_start_y, in_end_y), slice(in_start_x, in_end_x)),
+                                sub_start, sub_end, ch_start, ch_end, pooled=pool)
+                if col_end - col_start < W_out:
+                    spec.col_start, spec.col_end = col_start, col_end
+                specs.append(spec)
+                logger.debug(f"[Coordinator]: Assigned output rows {sub_start}-{sub_end}, cols {col_start}-{col_end}, channels {ch_start}-{ch_end} "
+                             f"to worker {worker.worker_id} for layer {layer.name}")
 
-            in_start_y = start_row * layer.stride
-            in_end_y = (end_row - 1) * layer.stride + layer.kernel_size
-            input_patch = padded[:, in_start_y:in_end_y, :]
+        macs_per_pixel = (layer.in_channels // max(layer.groups, 1)) * layer.kernel_size ** 2
+        step = LayerPlan(layer.layer_idx, 1, specs, (layer.out_channels, H_out, W_out), partition,
+                         in_border=(layer.padding, quant_params.z_in), kind=kind, macs_per_pixel=macs_per_pixel)
+        if not pool:
+            step.out_border = self._consumer_border(layer.layer_idx + 1, W_out)
+        else:
+            step.out_shape = (layer.out_channels,)
+            if not gap_flags & TASK_FLAG_GAP_MEAN:
+                step.out_dtype, step.pool_pixels = np.uint32, H_out * W_out
+        return step
 
-            task_msg = TaskMessage(
-                layer_type=layer.type,
-                layer_idx=self.current_layer_idx,
-                in_channels=layer.in_channels,
-                in_h=input_patch.shape[1],
-                in_w=input_patch.shape[2],
-                out_channels=layer.out_channels,
-                out_h=end_row - start_row,
-                out_w=W_out,
-                kernel_size=layer.kernel_size,
-                stride=layer.stride,
-                padding=layer.padding,
-                groups=layer.groups,
-                in_features=0,
-                out_features=0,
-                input_size=input_patch.size
-            )
+    def _assign_slices(self, plan: PartitionPlan, workers: list[WorkerInfo], layer: LayerConfig, kind: LayerType,
+                       padded_shape: tuple, H_out: int, W_out: int) -> list[tuple[WorkerInfo, tuple[int, int], tuple[int, int], tuple[int, int]]]:
+        """ (worker, output rows, output channels, output columns) for every worker that gets work """
+        all_rows, all_channels, all_cols = (0, H_out), (0, layer.out_channels), (0, W_out)
+        # when the plan uses fewer workers than we have, keep the fastest ones
+        used = plan.row_groups * plan.channel_groups * plan.col_groups
+        if used < len(workers):
+            fastest = sorted(workers, key=lambda w: self.partitioner.rate(w, kind, layer.layer_idx), reverse=True)[:used]
+            fastest_ids = {w.worker_id for w in fastest}
+            workers = [w for w in workers if w.worker_id in fastest_ids]
+        if plan.strategy == PartitionStrategy.ROWS:
+            cost = self._row_cost(layer, padded_shape[2], W_out)
+            return [(w, (s, e), all_channels, all_cols) for w, s, e in self.partitioner.split(workers, H_out, kind, cost, layer.layer_idx)]
+        if plan.strategy == PartitionStrategy.OUT_CHANNELS:
+            cost = self._channel_cost(layer, padded_shape, H_out, W_out)
+            return [(w, all_rows, (s, e), all_cols) for w, s, e in self.partitioner.split(workers, layer.out_channels, kind, cost, layer.layer_idx)]
+
+        # hybrid and tiles: a row_groups x channel_groups x col_groups grid, one cell per worker
+        bands = self._split_range(0, H_out, plan.row_groups)
+        groups = self._split_range(0, layer.out_channels, plan.channel_groups)
+        cols = self._split_range(0, W_out, plan.col_groups)
+        cells = [(band, group, col) for band in bands for group in groups for col in cols]
+        return [(worker, band, group, col) for worker, (band, group, col) in zip(workers, cells)]
+
+    def _kernel_variant(self, worker: WorkerInfo, layer: LayerConfig) -> int:
+        """ TaskMessage.kernel_variant of the worker's tasks of a single layer """
+        if self.kernel_policy == KernelPolicy.FIXED:
+            return KernelVariant.NATIVE
+        benches = worker.kernel_benches.get(layer.layer_idx, {})
+        if self.channels_last:
+            benches = {v: rate for v, rate in benches.items() if v != KernelVariant.IM2COL} # channel-first only
+        if self.kernel_policy == KernelPolicy.PROFILE or not benches:
+            return KERNEL_VARIANT_AUTO
+        # the worker still falls back to its own pick if the tile is too big for the variant
+        return max(benches, key=benches.get)
+
+    @staticmethod
+    def _shard_slices(layer_idx: int, out_channels: int, workers: list[WorkerInfo]) -> list[tuple[WorkerInfo, tuple[int, int]]]:
+        """ (worker, output channels) covering the layer from the weight shards the workers advertised
+
+        Empty if no worker holds only part of the layer. Channels held by several workers go to the first
+        of them, channels in no shard to the workers holding the whole layer, in turn.
+        """
+        sharded = sorted(((w, w.weight_shards[layer_idx]) for w in workers if layer_idx in w.weight_shards),
+                         key=lambda shard: shard[1])
+        if not sharded:
+            return []
+        whole = [w for w in workers if layer_idx not in w.weight_shards]
+        slices: list[tuple[WorkerInfo, tuple[int, int]]] = []
+        def fill(start: int, end: int):
+            if start >= end:
+                return
+            if not whole:
+                raise RuntimeError(f"No worker holds the weights of channels {start}-{end} of layer {layer_idx}")
+            slices.append((whole[len(slices) % len(whole)], (start, end)))
+
+        covered = 0
+        for worker, (start, end) in sharded:
+            fill(covered, min(start, out_channels))
+            if end > covered:
+                slices.append((worker, (max(start, covered), min(end, out_channels))))
+                covered = end
+        fill(covered, out_channels)
+        return [(worker, (start, end)) for worker, (start, end) in slices if start < end]
+
+    @staticmethod
+    def _row_cost(layer: LayerConfig, in_w: int, out_w: int) -> RowCost:
+        """ per output row cost of a conv layer, in_w is the padded input width """
+        macs = layer.out_channels * out_w * (layer.in_channels // max(layer.groups, 1)) * layer.kernel_size ** 2
+        in_row_bytes = layer.in_channels * in_w
+        return RowCost(
+            macs=macs,
+            bytes=in_row_bytes * layer.stride + layer.out_channels * out_w,
+            fixed_bytes=in_row_bytes * max(layer.kernel_size - layer.stride, 0),
+        )
 
-            task = asyncio.create_task(
-                self._send_task_to_worker(worker, task_msg, input_patch)
+    @staticmethod
+    def _channel_cost(layer: LayerConfig, padded_shape: tuple, out_h: int, out_w: int) -> RowCost:
+        """ per output channel cost of a conv layer, every channel group gets the whole padded input """
+        C, H_pad, W_pad = padded_shape
+        if layer.type == LayerType.DEPTHWISE:
+            # a depthwise channel only needs its own input plane
+            return RowCost(
+                macs=out_h * out_w * layer.kernel_size ** 2,
+                bytes=H_pad * W_pad + out_h * out_w,
             )
-            tasks.append((worker, start_row, end_row, task))
-            logger.debug(f"[Coordinator]: Assigned output rows {start_row}-{end_row} to worker {worker.worker_id} for layer {layer.name}")
-        
-        await asyncio.gather(*[t[3] for t in tasks])
-        output_shape = (layer.out_channels, H_out, W_out)
-        self.feature_map = await self._collect_results(tasks, output_shape)
+        return RowCost(
+            macs=out_h * out_w * (layer.in_channels // max(layer.groups, 1)) * layer.kernel_size ** 2,
+            bytes=out_h * out_w,
+            fixed_bytes=C * H_pad * W_pad,
+        )
+
+    def _observe_layer(self, tasks: list[tuple], macs_per_pixel: int, kind: LayerType):
+        """ feed the measured compute time of this layer back into the partitioner """
+        macs: dict[int, int] = {}
+        for worker, start_row, end_row, task in tasks:
+            pixels = (end_row - start_row) * task.msg.out_w * task.msg.out_channels
+            macs[worker.worker_id] = macs.get(worker.worker_id, 0) + pixels * macs_per_pixel
+        for worker_id, ws in self.current_layer_stats.get("workers", {}).items():
+            worker = self.worker_manager.workers.get(worker_id)
+            if worker is not None:
+                self.partitioner.observe_macs(worker, kind, macs.get(worker_id, 0), ws["mcu_compute_ms"])
 
-    async def _distribute_fc(self, layer: LayerConfig, quant_params: QuantParams):
+    async def _distribute_fc(self, layer: LayerConfig, quant_params: QuantParams, plan: Optional[LayerPlan] = None):
         """Split the feature map by output classes"""
-        input_vec = self.feature_map.flatten()
+        await self._run_tasks(plan or self._plan_fc(layer, quant_params, self.feature_map.size))
+
+    def _plan_fc(self, layer: LayerConfig, quant_params: QuantParams, in_features: int, batch: int = 1) -> LayerPlan:
+        """ the classifier split by output classes, with batch > 1 on that many input vectors at once; the
+        output is then (classes, batch), class-major as the workers return it """
         total_classes = layer.out_channels
-        available_workers = list(self.worker_manager.workers.values())
-        num_workers = len(available_workers) # TODO maybe get idle workers
+        available_workers = self._capable_workers(LayerType.FC)
+        num_workers = len(available_workers)
+        if not available_workers:
+            raise RuntimeError(f"No worker can run layer {layer.name}")
         classes_per_worker = int(np.ceil(total_classes / num_workers))
 
         logger.debug(f"[Coordinator]: Distributing FC layer {layer.name} with {total_classes} classes across {num_workers} workers")
         
-        tasks = []
-        for i, worker in enumerate(available_workers):
-            # start_cls = i * classes_per_worker
-            # end_cls = min(start_cls + classes_per_worker, total_classes)
-            start_cls = worker.worker_id * classes_per_worker
-            end_cls = min(start_cls + classes_per_worker, total_classes)
-            
+        specs = []
+        act_flags, activations = self._activations([quant_params])
+        # fc weights are sharded per worker: by the advertised shards, or else in equal parts in worker order
+        shards = self._shard_slices(layer.layer_idx, total_classes, available_workers)
+        if not shards:
+            shards = [(worker, (i * classes_per_worker, min((i + 1) * classes_per_worker, total_classes)))
+                      for i, worker in enumerate(available_workers)]
+        for worker, (start_cls, end_cls) in shards:
             if start_cls >= total_classes:
                 continue
             
             task_msg = TaskMessage(
                 layer_type=layer.type,
-                layer_idx=self.current_layer_idx,
+                layer_idx=layer.layer_idx,
                 in_channels=layer.in_channels,
                 in_h=1,
                 in_w=1,
@@ -296,19 +1114,20 @@ class Coordinator:
                 stride=0,
                 padding=0,
                 groups=0,
-                in_features=input_vec.size,
+                in_features=in_features,
                 out_features=end_cls - start_cls,
-                input_size=input_vec.size
-            )
-            task = asyncio.create_task(
-                self._send_task_to_worker(worker, task_msg, input_vec)
+                input_size=in_features * batch,
+                out_ch_start=start_cls,
+                flags=act_flags,
+                kernel_variant=self._kernel_variant(worker, layer),
+                batch=batch,
+                activations=activations,
             )
-            tasks.append((worker, start_cls, end_cls, task))
+            task_msg.packed = task_msg.pack()
+            # each worker holds the weights of its classes only, so it gets exactly one task
+            specs.append(TaskSpec(worker, task_msg, (slice(None),), start_cls, end_cls))
             logger.debug(f"[Coordinator]: Assigned classes {start_cls}-{end_cls} to worker {worker.worker_id} for FC layer {layer.name}")
-        await asyncio.gather(*[t[3] for t in tasks])
-        
-        output_shape = (total_classes,)
-        self.feature_map = await self._collect_results(tasks, output_shape)
+        return LayerPlan(layer.layer_idx, 1, specs, (total_classes, batch) if batch > 1 else (total_classes,), "", flat_input=True)
         
     # TODO need further check
     async def _apply_residual(self, residual_from: str):
@@ -316,119 +1135,465 @@ class Coordinator:
             logger.error(f"[Coordinator]: Residual buffer {residual_from} not found for residual connection")
             return
         
-        cached, res_s, res_zp = self.residual_buffers[residual_from]
+        cached, res_s, res_zp = self.residual_buffers.pop(residual_from) # only one add reads it
         if cached.shape != self.feature_map.shape:
             logger.error(f"[Coordinator]: Residual buffer shape {cached.shape} does not match current feature map shape {self.feature_map.shape}")
             return
         
-        res_f = (cached.astype(np.float32) - res_zp) * res_s
-
-        curr_scale = self.quant_params_list[self.current_layer_idx].s_out
-        curr_zero_point = self.quant_params_list[self.current_layer_idx].z_out
-        curr_f = (self.feature_map.astype(np.float32) - curr_zero_point) * curr_scale
-        
-        sum_f = curr_f + res_f
-        target_s = self.quant_params_list[self.current_layer_idx].s_residual_out
-        target_z = self.quant_params_list[self.current_layer_idx].z_residual_out
-        self.feature_map = np.clip(np.round(sum_f / target_s + target_z), 0, 255).astype(np.uint8)
+        # the worker's integer add (block::residual_add), so unfused blocks give the same bytes as fused ones
+        qp = self.quant_params_list[self.current_layer_idx]
+        params = ResidualParams.from_scales(qp.s_out, qp.z_out, res_s, res_zp, qp.s_residual_out, qp.z_residual_out)
+        acc = ((self.feature_map.astype(np.int64) - params.zp_out) * params.mult_out
+               + (cached.astype(np.int64) - params.zp_res) * params.mult_res)
+        rounding = 1 << (params.shift - 1) if params.shift > 0 else 0
+        self.feature_map[...] = np.clip(params.zp_sum + ((acc + rounding) >> params.shift), 0, 255)
 
         logger.debug(f"[Coordinator]: Applied residual connection from {residual_from} to current layer {self.current_layer_idx}, feature map updated")
 
-        if self.current_layer_idx == 51:
-            logger.debug(f"[Coordinator]: Completed layer {residual_from}, output feature map shape: {self.feature_map.shape}")
-            # hex_str = np.array2string(
-            #     self.feature_map[1, :, :], 
-            #     formatter={'int': lambda x: f'0x{x:02X}'}
-            # )
+    def _new_task(self, worker: WorkerInfo, task_msg: TaskMessage, payload: np.ndarray, start_idx: int, end_idx: int,
+                  ch_start: int = 0, ch_end: Optional[int] = None) -> Task:
+        task = Task(self.next_task_id, worker, task_msg, payload, start_idx, end_idx, ch_start, ch_end)
+        self.next_task_id = (self.next_task_id + 1) & 0xFFFFFFFF or 1 # 0 is reserved for "no task"
+        return task
 
-            # logger.debug(f"[Coordinator]: Input for this layer is:\n{padded[1, :1, :]}\n")
-            logger.debug(f"[Coordinator]: Sample output hex values:\n{self.feature_map[1, :2, :]}\n")
+    @staticmethod
+    def _split_range(start: int, end: int, parts: int) -> list[tuple[int, int]]:
+        """ split [start, end) into at most `parts` contiguous, near-equal ranges """
+        parts = max(1, min(parts, end - start))
+        bounds = np.linspace(start, end, parts + 1).round().astype(int)
+        return [(int(a), int(b)) for a, b in zip(bounds[:-1], bounds[1:]) if b > a]
 
-    async def _send_task_to_worker(self, worker: WorkerInfo, task_msg: TaskMessage, input_patch: np.ndarray):
+    async def _fill_window(self, queue: TaskQueue):
+        while queue.can_send():
+            task = queue.next_to_send()
+            if task is queue.head():
+                task.started_at = time.perf_counter()
+            self.in_flight[task.worker.worker_id, task.task_id] = task
+            try:
+                await self._send_task_to_worker(task.worker, task.msg, task.payload, task.task_id)
+            except Exception as e:
+                # the worker's drain hands its tasks to the others
+                self._quarantine(task.worker, e)
+                return
+
+    async def _send_task_to_worker(self, worker: WorkerInfo, task_msg: TaskMessage, input_patch: np.ndarray, task_id: int = 0):
         worker.state = WorkerState.BUSY
-        # Ensure C-contiguous layout before serializing: slicing along axis-1 (e.g. padded[:, a:b, :])
-        input_bytes = np.ascontiguousarray(input_patch).tobytes()
+        if task_msg.flags & TASK_FLAG_HWC:
+            input_patch = input_patch.transpose(1, 2, 0)
 
         send_start = time.perf_counter()
-        await self.worker_manager.send_message(worker, MessageType.TASK, task_msg.pack() + input_bytes)
+        packed = task_msg.packed if task_msg.packed is not None else task_msg.pack()
+        if not await self.worker_manager.send_message(worker, MessageType.TASK, [packed, *self._wire_buffers(input_patch)], task_id):
+            raise WorkerLinkError(f"Failed to send task {task_id} to worker {worker.worker_id}")
         send_time = time.perf_counter() - send_start
 
-        # init the worker's stats
-        self.current_layer_stats["workers"][worker.worker_id] = {
-            "send_time_ms": send_time * 1000,
+        # init the worker's stats, accumulated over all tasks the worker gets in this layer
+        ws = self.current_layer_stats.setdefault("workers", {}).setdefault(worker.worker_id, {
+            "send_time_ms": 0.0,
             "recv_time_ms": 0.0,
             "mcu_compute_ms": 0.0,
-        }
+            "tasks": 0,
+        })
+        ws["send_time_ms"] += send_time * 1000
+        ws["tasks"] += 1
 
-        logger.debug(f"[Coordinator]: Sent task for layer {self.current_layer_idx} to worker {worker.worker_id}, waiting for result...")
+        logger.debug(f"[Coordinator]: Sent task {task_id} for layer {self.current_layer_idx} to worker {worker.worker_id}, waiting for result...")
 
-    async def _collect_results(self, tasks: list[asyncio.Task], output_shape: tuple) -> np.ndarray:
-        output = np.zeros(output_shape, dtype=np.uint8)
-        num_workers = len(tasks)
-        logger.debug(f"[Coordinator]: Collecting results from {num_workers} workers for layer {self.current_layer_idx}")
-        
-        receive_tasks = []
-        for worker, start_idx, end_idx, _ in tasks:
-            task = asyncio.create_task(
-                self._receive_worker_result(worker, start_idx, end_idx, output)
-            )
-            receive_tasks.append(task)
-        await asyncio.gather(*receive_tasks)
+    @staticmethod
+    def _wire_buffers(patch: np.ndarray) -> list[memoryview]:
+        """ the patch as buffers sent back to back, views of the feature map wherever its runs are contiguous
+
+        Row bands are one run (HWC, or a single channel) or one run per channel plane (CHW); column tiles are
+        the only patches copied, and only the tile.
+        """
+        if patch.flags.c_contiguous:
+            return [memoryview(patch).cast('B')]
+        if patch.ndim == 3 and patch[0].flags.c_contiguous:
+            return [memoryview(plane).cast('B') for plane in patch]
+        return [memoryview(np.ascontiguousarray(patch)).cast('B')]
+
+    async def _collect_results(self, tasks: list[tuple], output_shape: tuple, dtype=np.uint8,
+                               border: tuple[int, int] = (0, 0)) -> np.ndarray:
+        output = self._layer_buffer(output_shape, dtype, border)
+        worker_ids = list(dict.fromkeys(t[0].worker_id for t in tasks))
+        logger.debug(f"[Coordinator]: Collecting {len(tasks)} results from {len(worker_ids)} workers for layer {self.current_layer_idx}")
         
+        self.unlanded = len(tasks)
+        self.layer_landed = asyncio.Event()
+        self.layer_failure = None
+        if not tasks:
+            self.layer_landed.set()
+        self.drains = {worker_id: asyncio.create_task(self._drain_worker(self.task_queues[worker_id], output))
+                       for worker_id in worker_ids}
+        watchdog = asyncio.create_task(self._watch_stragglers(output)) if self.speculation else None
+        try:
+            await self._wait_landed(watchdog)
+        finally:
+            if watchdog is not None:
+                watchdog.cancel()
+        # what is left to read are results of slices the other copy delivered first; the workers' next drains wait for them
+        for worker_id, drain in self.drains.items():
+            if not drain.done():
+                self.background_drains[worker_id] = drain
+        self.drains = {}
         return output
+
+    async def _wait_landed(self, watchdog: Optional[asyncio.Task] = None):
+        """ until every slice of the layer is in its output, raising the first error of a drain or the watchdog """
+        landed = asyncio.create_task(self.layer_landed.wait())
+        try:
+            while not landed.done():
+                pending = {landed, *[drain for drain in self.drains.values() if not drain.done()]}
+                if watchdog is not None and not watchdog.done():
+                    pending.add(watchdog)
+                done, _ = await asyncio.wait(pending, return_when=asyncio.FIRST_COMPLETED)
+                for drain in done:
+                    if drain is not landed and drain.exception() is not None:
+                        raise drain.exception()
+        finally:
+            landed.cancel()
+        if self.layer_failure is not None:
+            raise self.layer_failure
+
+    async def _watch_stragglers(self, output: np.ndarray):
+        """ reissue the task a worker is on to an idle worker once it runs past its deadline, see LatencyTracker
+
+        Only the task at the head of a queue is running, the ones behind it wait on the worker's socket; a
+        speculative copy is not reissued again.
+        """
+        while True:
+            now = time.perf_counter()
+            wake = now + STRAGGLER_POLL_S
+            for queue in list(self.task_queues.values()):
+                task = queue.head()
+                if task is None or task.started_at is None or task.original is not None or task.backup is not None:
+                    continue
+                limit_ms = self.latency.deadline_ms(task.worker.worker_id, task.predicted_ms)
+                if limit_ms is None:
+                    continue
+                deadline = task.started_at + limit_ms / 1000
+                if now < deadline:
+                    wake = min(wake, deadline)
+                    continue
+                backup = self._idle_worker(task)
+                if backup is not None:
+                    logger.info(f"[Coordinator]: Task {task.task_id} of layer {self.current_layer_idx} on worker {task.worker.worker_id} "
+                                f"is past its {limit_ms:.1f}ms deadline, reissuing it to worker {backup.worker_id}")
+                    await self._reissue(task, backup, output)
+            await asyncio.sleep(max(wake - time.perf_counter(), 0.001))
+
+    def _idle_worker(self, task: Task) -> Optional[WorkerInfo]:
+        """ the fastest worker done with its part of the layer that can run the task's slice, if any """
+        msg = task.msg
+        kind = RowPartitioner.layer_kind(msg.layer_type, msg.kernel_size)
+        candidates = []
+        for worker in self._capable_workers(msg.layer_type, msg.flags):
+            queue = self.task_queues.get(worker.worker_id)
+            background = self.background_drains.get(worker.worker_id)
+            if (worker is task.worker or (queue is not None and not queue.empty())
+                    or (background is not None and not background.done())):
+                continue
+            if self._can_take(worker, task):
+                candidates.append(worker)
+        return max(candidates, key=lambda w: self.partitioner.rate(w, kind, msg.layer_idx), default=None)
+
+    def _can_take(self, worker: WorkerInfo, task: Task) -> bool:
+        """ whether the task, planned for another worker, fits this one: its input, its weights and block scratch """
+        msg = task.msg
+        if msg.input_size > worker.input_buffer_size or not self._holds_slice(worker, msg):
+            return False
+        return msg.layer_type != LayerType.BLOCK or worker.scratch_size >= task.worker.scratch_size
+
+    @staticmethod
+    def _holds_slice(worker: WorkerInfo, msg: TaskMessage) -> bool:
+        """ whether the worker has the weights of the task's output channels (classes) """
+        shard = worker.weight_shards.get(msg.layer_idx)
+        # a worker holding part of a layer advertises it at registration, fc_final included
+        return shard is None or shard[0] <= msg.out_ch_start and msg.out_ch_start + msg.out_channels <= shard[1]
+
+    async def _reissue(self, task: Task, worker: WorkerInfo, output: np.ndarray):
+        """ send a copy of the task to another worker, whichever result comes first lands """
+        self.current_layer_stats["speculative"] = self.current_layer_stats.get("speculative", 0) + 1
+        await self._enqueue(self._copy_task(task, worker), output)
+
+    def _copy_task(self, task: Task, worker: WorkerInfo) -> Task:
+        """ the task's slice as a new task for another worker, claiming the slice together with the task """
+        msg = task.msg
+        if self.kernel_policy == KernelPolicy.DIRECTED and msg.layer_type != LayerType.BLOCK:
+            # the variant was picked from the original worker's benchmark
+            msg = replace(msg, kernel_variant=self._kernel_variant(worker, self.layer_config_list[msg.layer_idx]), packed=None)
+        copy_task = self._new_task(worker, msg, task.payload, task.start_idx, task.end_idx, task.ch_start, task.ch_end)
+        copy_task.col_start, copy_task.col_end, copy_task.pooled = task.col_start, task.col_end, task.pooled
+        copy_task.predicted_ms = task.predicted_ms
+        owner = task.slice_owner()
+        copy_task.original, owner.backup = owner, copy_task
+        return copy_task
+
+    async def _enqueue(self, task: Task, output: np.ndarray):
+        """ add a task to its worker's queue in the running layer, draining the worker if nothing does yet """
+        worker_id = task.worker.worker_id
+        queue = self.task_queues.get(worker_id)
+        if queue is None:
+            queue = self.task_queues[worker_id] = TaskQueue(self.window_size)
+        queue.add_task(task)
+        await self._fill_window(queue)
+        drain = self.drains.get(worker_id)
+        if drain is None or drain.done():
+            self.drains[worker_id] = asyncio.create_task(self._drain_worker(queue, output))
+
+    def _quarantine(self, worker: WorkerInfo, reason: BaseException):
+        """ stop giving the worker tasks and drop its connection, whatever it sends next can't be trusted """
+        if worker.worker_id in self.quarantined:
+            return
+        logger.error(f"[Coordinator]: Quarantining worker {worker.worker_id}: {reason!r}")
+        self.quarantined[worker.worker_id] = worker
+        self.worker_manager.remove_worker(worker)
+        worker.state = WorkerState.DISCONNECTED
+
+    async def _recover(self, queue: TaskQueue, output: np.ndarray, worker: WorkerInfo, reason: BaseException):
+        """ quarantine a worker whose connection failed and spread its unfinished slices over the others
+
+        A slice whose other copy is still running (a speculative one, see _reissue) is left to it.
+        """
+        self._quarantine(worker, reason)
+        orphans = [*queue.in_flight, *queue.pending]
+        queue.in_flight.clear()
+        queue.pending.clear()
+        for task in orphans:
+            self.in_flight.pop((worker.worker_id, task.task_id), None)
+        for task in orphans:
+            owner = task.slice_owner()
+            if owner.claimed_by is task and not owner.landed:
+                # its output was cut short, and the other copy was cancelled when it claimed the slice
+                owner.claimed_by = None
+            elif self._covered_elsewhere(task):
+                continue
+            await self._retry(task, output)
+
+    async def _retry(self, task: Task, output: np.ndarray, exclude: Optional[WorkerInfo] = None):
+        """ run a failed task's slice on the surviving worker predicted to finish it first """
+        owner = task.slice_owner()
+        owner.retries += 1
+        if owner.retries > MAX_SLICE_RETRIES:
+            raise RuntimeError(f"Slice [{task.start_idx}, {task.end_idx}) of layer {task.msg.layer_idx} failed on "
+                               f"{owner.retries} workers")
+        kind = RowPartitioner.layer_kind(task.msg.layer_type, task.msg.kernel_size)
+        def finish_ms(worker: WorkerInfo) -> float:
+            queue = self.task_queues.get(worker.worker_id)
+            queued = sum(t.predicted_ms for t in (*queue.in_flight, *queue.pending)) if queue is not None else 0.0
+            slowdown = self.partitioner.rate(task.worker, kind, task.msg.layer_idx) / self.partitioner.rate(worker, kind, task.msg.layer_idx)
+            return queued + task.predicted_ms * slowdown
+        candidates = [w for w in self._capable_workers(task.msg.layer_type, task.msg.flags)
+                      if w is not exclude and self._can_take(w, task)]
+        if not candidates:
+            raise RuntimeError(f"No surviving worker can run slice [{task.start_idx}, {task.end_idx}) of layer {task.msg.layer_idx}")
+        worker = min(candidates, key=finish_ms)
+        logger.warning(f"[Coordinator]: Retrying slice [{task.start_idx}, {task.end_idx}) of layer {task.msg.layer_idx} "
+                       f"on worker {worker.worker_id}")
+        self.current_layer_stats["retries"] = self.current_layer_stats.get("retries", 0) + 1
+        await self._enqueue(self._copy_task(task, worker), output)
+
+    async def _claim(self, task: Task) -> bool:
+        """ whether the task's result lands: the first of a slice's copies to answer claims it and cancels the other
+
+        A cancelled copy never claims, not even once the claimant failed and the slice is free again: its reply
+        may carry no output.
+        """
+        owner = task.slice_owner()
+        if task.cancelled:
+            return False
+        if owner.claimed_by is None:
+            owner.claimed_by = task
+            other = owner.backup if task is owner else owner
+            if other is not None and (other.worker.worker_id, other.task_id) in self.in_flight:
+                other.cancelled = True
+                await self.worker_manager.send_message(other.worker, MessageType.CANCEL, b'', other.task_id)
+            if task is not owner:
+                self.current_layer_stats["speculative_wins"] = self.current_layer_stats.get("speculative_wins", 0) + 1
+        return owner.claimed_by is task
+
+    def _land(self, task: Task):
+        owner = task.slice_owner()
+        if owner.claimed_by is task and not owner.landed:
+            owner.landed = True
+            self.unlanded -= 1
+            if self.unlanded == 0 and self.layer_landed is not None:
+                self.layer_landed.set()
+
+    def _consumer_border(self, layer_idx: int, in_w: Optional[int] = None) -> tuple[int, int]:
+        """ (padding, value) the layer at layer_idx pads its in_w wide input with, fused blocks take theirs unpadded """
+        if layer_idx >= len(self.quant_params_list) or (self.fuse_blocks and self._block_len(layer_idx, in_w) > 1):
+            return 0, 0
+        return self.layer_config_list[layer_idx].padding, self.quant_params_list[layer_idx].z_in
+
+    def _layer_buffer(self, output_shape: tuple, dtype, border: tuple[int, int] = (0, 0),
+                      layer_idx: Optional[int] = None) -> np.ndarray:
+        """ the current layer's output, reused across inferences; pooled sums start from zero
+
+        A (C, H, W) output is allocated inside the border its consumer pads with, so _pad returns the padded map
+        without copying it and the consumer's row bands are sent as views.
+        """
+        key = (self.buffer_slot, self.current_layer_idx if layer_idx is None else layer_idx, output_shape, np.dtype(dtype).str,
+               self.channels_last, border)
+        output = self.layer_buffers.get(key)
+        if output is None:
+            if len(output_shape) == 3:
+                C, H, W = output_shape
+                p, value = border
+                if self.channels_last:
+                    # HWC tiles land as contiguous runs and the next layer's patches need no reordering
+                    padded = np.full((H + 2 * p, W + 2 * p, C), value, dtype=dtype).transpose(2, 0, 1)
+                else:
+                    padded = np.full((C, H + 2 * p, W + 2 * p), value, dtype=dtype)
+                output = padded[:, p:p + H, p:p + W]
+                if p > 0:
+                    self.padded_outputs[output.ctypes.data] = (output, padded, p, value)
+            else:
+                output = np.zeros(output_shape, dtype=dtype)
+            self.layer_buffers[key] = output
+        elif output.dtype == np.uint32:
+            output.fill(0)
+        return output
+
+    async def _drain_worker(self, queue: TaskQueue, output: np.ndarray):
+        """ receive a worker's results in order, topping its window up after each one
+
+        A worker failing on the way is quarantined and its remaining slices go to the others, see _recover.
+        """
+        if queue.head() is None:
+            return
+        worker = queue.head().worker
+        try:
+            await self._settle(worker)
+            while queue.head() is not None:
+                if worker.worker_id in self.quarantined:
+                    raise WorkerLinkError(f"Worker {worker.worker_id} is quarantined")
+                task = queue.head()
+                try:
+                    await self._receive_worker_result(task.worker, task.start_idx, task.end_idx, task.output_view(output), task.task_id)
+                except WorkerErrorReply:
+                    # the worker answered, just not with the slice's output: its connection is fine
+                    queue.complete(task.task_id)
+                    self.in_flight.pop((task.worker.worker_id, task.task_id), None)
+                    await self._rerun_rejected(task, output)
+                else:
+                    queue.complete(task.task_id)
+                    self.in_flight.pop((task.worker.worker_id, task.task_id), None)
+                    # a result read without going through _claim (nothing else ran the slice) lands too
+                    await self._claim(task)
+                    self._land(task)
+                if queue.head() is not None:
+                    # the next task was waiting behind this one on the worker
+                    queue.head().started_at = time.perf_counter()
+                await self._fill_window(queue)
+        except Exception as e:
+            try:
+                await self._recover(queue, output, worker, e)
+            except Exception as fatal:
+                self._fail_layer(fatal)
+
+    @staticmethod
+    def _link_failure(error: BaseException) -> bool:
+        """ whether the error means the worker's connection is gone, rather than a reply we couldn't use """
+        return isinstance(error, (ConnectionError, OSError, EOFError, asyncio.TimeoutError))
+
+    def _fail_layer(self, fatal: BaseException):
+        logger.error(f"[Coordinator]: Layer {self.current_layer_idx} can't complete: {fatal}")
+        self.layer_failure = fatal
+        if self.layer_landed is not None:
+            self.layer_landed.set()
+
+    async def _rerun_rejected(self, task: Task, output: np.ndarray):
+        """ after a reply that carried no usable output (an ERROR, or one that broke the protocol), run the slice on
+        another worker unless a copy already covers it; the worker itself stays in the pool """
+        owner = task.slice_owner()
+        if owner.claimed_by is task:
+            owner.claimed_by = None
+        elif task.cancelled or self._covered_elsewhere(task):
+            return
+        try:
+            await self._retry(task, output, exclude=task.worker)
+        except Exception as fatal:
+            self._fail_layer(fatal)
+
+    def _covered_elsewhere(self, task: Task) -> bool:
+        """ whether the task's slice landed, or another copy of it claimed it or is still running """
+        owner = task.slice_owner()
+        if owner.landed or (owner.claimed_by is not None and owner.claimed_by is not task):
+            return True
+        other = owner.backup if task is owner else owner
+        return (other is not None and other is not task and not other.cancelled
+                and other.worker.worker_id not in self.quarantined)
+
+    async def _settle(self, worker: WorkerInfo):
+        """ wait until the worker's results of earlier layers, all of them beaten by a speculative copy, are read """
+        drain = self.background_drains.pop(worker.worker_id, None)
+        if drain is not None:
+            await drain
     
-    async def _receive_worker_result(self, worker: WorkerInfo, start_idx: int, end_idx: int, output: np.ndarray):
+    async def _receive_worker_result(self, worker: WorkerInfo, start_idx: int, end_idx: int, output: np.ndarray,
+                                     task_id: Optional[int] = None):
         try:
             #  wait for result message
-            header, payload = await self.worker_manager.receive_message(
+            result = await self.worker_manager.receive_message(
                 worker, 
-                timeout=60
+                timeout=self.result_timeout_s
             )
-            
-            if not (header and payload):
-                raise RuntimeError(f"Failed to receive result from worker {worker.worker_id}")
+            if not result:
+                # timed out, or the connection broke
+                raise WorkerLinkError(f"Failed to receive result from worker {worker.worker_id}")
+            header, payload = result
+            if not payload:
+                raise RuntimeError(f"Empty reply from worker {worker.worker_id}")
+
+            if task_id is not None and header.task_id != task_id:
+                raise RuntimeError(f"Expected result for task {task_id}, got task {header.task_id}")
             
             if header.type == MessageType.ERROR:
                 err_msg = ErrorMessage.unpack(payload)
                 logger.error(f"[Coordinator]: Received error from worker {worker.worker_id}: error code: {err_msg.error_code}, message: {err_msg.description}")
-                raise RuntimeError(f"error: {err_msg.description}")
+                raise WorkerErrorReply(f"error: {err_msg.description}")
             
             if header.type != MessageType.RESULT:
                 raise RuntimeError(f"Expected RESULT, got {LayerType(header.type)}")
             
             result_msg = ResultMessage.unpack(payload)
             logger.debug(f"[Coordinator]: result message: {result_msg}")
+
+            task = self.in_flight.get((worker.worker_id, header.task_id))
+            cancelled = bool(result_msg.flags & RESULT_FLAG_CANCELLED)
+            if task is not None and cancelled:
+                task.cancelled = True
+            if task is not None and task.started_at is not None and not cancelled:
+                self.latency.record(worker.worker_id, task.predicted_ms, (time.perf_counter() - task.started_at) * 1000)
+            if cancelled or (task is not None and not await self._claim(task)):
+                # the other copy of the slice came first: read past this one, it was cancelled or too late to be
+                await self._discard_output(worker, result_msg.output_size)
+                if result_msg.flags & RESULT_FLAG_STREAMED:
+                    await asyncio.wait_for(worker.reader.readexactly(struct.calcsize('<I')), timeout=10)
+                self.worker_manager.mark_worker_idle(worker)
+                logger.debug(f"[Coordinator]: Discarded the result of task {header.task_id} from worker {worker.worker_id}")
+                return
             
-            # read exact output data
-            # output_data = await worker.reader.readexactly(result_msg.output_size)
             recv_start = time.perf_counter()
-            output_data = await asyncio.wait_for(worker.reader.readexactly(result_msg.output_size), timeout=10)
+            await self._receive_output(worker, result_msg.output_size, output, start_idx, end_idx)
+            if result_msg.flags & RESULT_FLAG_STREAMED:
+                # computed and sent block by block, the compute time comes last
+                trailer = await asyncio.wait_for(worker.reader.readexactly(struct.calcsize('<I')), timeout=10)
+                result_msg.compute_time_us, = struct.unpack('<I', trailer)
             recv_time = time.perf_counter() - recv_start
 
-            logger.debug(f"[Coordinator]: Received result header from worker {worker.worker_id} with output size {result_msg.output_size} bytes")
-            
-            # parse output data and write to the correct position in the output feature map
-            if output.ndim == 3:
-                # Conv layer: (C, H_slice, W)
-                C, _, W = output.shape
-                H_slice = end_idx - start_idx
-                output_patch = np.frombuffer(output_data, dtype=np.uint8).reshape(
-                    (C, H_slice, W)
-                )
-                logger.debug(f"[Coordinator]: worker:{worker.worker_id}, output_data size: {len(output_data)} bytes, reshaped to {output_patch.shape}")
-                output[:, start_idx:end_idx, :] = output_patch
-            else:
-                # Linear layer: (num_classes,)
-                output_patch = np.frombuffer(output_data, dtype=np.uint8)
-                output[start_idx:end_idx] = output_patch
+            logger.debug(f"[Coordinator]: Received {result_msg.output_size} bytes of output from worker {worker.worker_id}")
             
             # update stats
             # self.stats.total_comm_volume += result_msg.output_size
             # self.stats.total_compute_time += result_msg.compute_time_us / 1e6
-            if worker.worker_id in self.current_layer_stats["workers"]:
-                ws = self.current_layer_stats["workers"][worker.worker_id]
-                ws["mcu_compute_ms"] = result_msg.compute_time_us / 1000
-                ws["recv_time_ms"] = recv_time * 1000
+            ws = self.current_layer_stats.get("workers", {}).get(worker.worker_id)
+            if ws is not None:
+                ws["mcu_compute_ms"] += result_msg.compute_time_us / 1000
+                ws["recv_time_ms"] += recv_time * 1000
+                if result_msg.kernel_variant != KERNEL_VARIANT_AUTO:
+                    ws["kernel"] = KernelVariant(result_msg.kernel_variant).name
             
             # mark worker idle again
             # worker.state = WorkerState.IDLE
@@ -440,14 +1605,113 @@ class Coordinator:
         
         except Exception as e:
             logger.error(f"[Coordinator]: Error receiving result from worker {worker.worker_id}: {e}")
-            await self.shutdown_workers() # if any error happens, we shutdown all workers to avoid hanging
+            if isinstance(e, WorkerErrorReply):
+                raise
+            # the caller quarantines the worker and hands its slices to the others
             worker.state = WorkerState.DISCONNECTED
+            if not self._link_failure(e):
+                # stopped short of the output and trailer the header announced, the next header would be output bytes
+                raise WorkerLinkError(f"Worker {worker.worker_id} is out of step: {e}") from e
             raise
     
+    async def _discard_output(self, worker: WorkerInfo, size: int):
+        staging = self.recv_buffers.setdefault(worker.worker_id, bytearray())
+        if len(staging) < size:
+            staging.extend(bytes(size - len(staging)))
+        if size:
+            await self.worker_manager.receive_into(worker, memoryview(staging)[:size], timeout=10)
+
+    async def _receive_output(self, worker: WorkerInfo, size: int, output: np.ndarray, start_idx: int, end_idx: int):
+        """ read a result's output straight into its place in the layer output
+
+        The bytes are received into the contiguous runs of the output they land in: the whole slice when it is one run
+        (whole channel slices, HWC row bands, FC outputs, pooled means), its channel planes or rows otherwise (CHW row
+        bands, outputs inside their consumer's padding). Runs shorter than MIN_RECV_RUN and pooled sums, which add up,
+        go through the worker's staging buffer.
+        """
+        if output.ndim == 3:
+            # Conv layer: (C, H_slice, W), in the order it crosses the link
+            wire = output[:, start_idx:end_idx, :]
+            if self.channels_last:
+                wire = wire.transpose(1, 2, 0)
+        elif output.dtype == np.uint32:
+            # pooled conv tile: per-channel sums, tiles of the same channels add up
+            wire = None
+        elif output.size == size:
+            # pooled conv tile covering the whole map: per-channel means of the task's channels
+            wire = output
+        else:
+            # Linear layer: (num_classes,)
+            wire = output[start_idx:end_idx]
+        if wire is not None and wire.nbytes != size:
+            raise RuntimeError(f"Output of {size} bytes doesn't match its {wire.shape} slice")
+
+        runs = self._contiguous_runs(wire) if wire is not None else None
+        if runs is not None:
+            await self.worker_manager.receive_into(worker, runs, timeout=10)
+        else:
+            staging = self.recv_buffers.setdefault(worker.worker_id, bytearray())
+            if len(staging) < size:
+                staging.extend(bytes(size - len(staging)))
+            data = memoryview(staging)[:size]
+            await self.worker_manager.receive_into(worker, data, timeout=10)
+            if wire is None:
+                output += np.frombuffer(data, dtype='<u4')
+            else:
+                wire[...] = np.frombuffer(data, dtype=np.uint8).reshape(wire.shape)
+
+    @staticmethod
+    def _contiguous_runs(wire: np.ndarray) -> Optional[list]:
+        """ the contiguous parts of wire in its C order, None if they are shorter than MIN_RECV_RUN bytes """
+        if wire.flags.c_contiguous:
+            return [wire]
+        if wire.ndim == 1 or wire[0].nbytes < MIN_RECV_RUN:
+            return None
+        runs = []
+        for part in wire:
+            part_runs = Coordinator._contiguous_runs(part)
+            if part_runs is None:
+                return None
+            runs += part_runs
+        return runs
+
+    def _stage_runner(self, workers: list[WorkerInfo]) -> 'Coordinator':
+        """ a coordinator running part of the model on these workers only, for the pipeline stages
+
+        It shares the model, the options and the partitioner with this one and has its own per-image state, so
+        stages run concurrently on different images.
+        """
+        runner = copy.copy(self)
+        runner.worker_manager = WorkerManager()
+        runner.worker_manager.workers = {w.worker_id: w for w in workers}
+        runner.worker_manager.next_worker_id = self.worker_manager.next_worker_id
+        runner.task_queues = {}
+        runner.in_flight = {}
+        runner.drains = {}
+        runner.background_drains = {}
+        # the pool changes between streams only, see execute_pipelined
+        runner.joining = {}
+        runner.leaving = set()
+        runner.retiring = set()
+        runner.feature_map = None
+        runner.residual_buffers = {}
+        runner.layer_buffers = {}
+        runner.padded_outputs = {}
+        runner.recv_buffers = {}
+        runner.plan = None
+        runner.batch_plans = {}
+        runner.stats = []
+        runner.current_layer_stats = {}
+        return runner
+
     async def shutdown_workers(self):
+        # retired workers are shut down by their drain once it has read what they owe
+        for result in await asyncio.gather(*self.retiring, return_exceptions=True):
+            if isinstance(result, Exception):
+                logger.error(f"[Coordinator]: Draining a retired worker failed: {result}")
         logger.info(f"[Coordinator]: Sending shutdown message to all workers")
         shutdown_msg = b'' # no payload needed for shutdown
-        for worker in self.worker_manager.workers.values():
+        for worker in [*self.worker_manager.workers.values(), *self.joining.values()]:
             await self.worker_manager.send_message(worker, MessageType.SHUTDOWN, shutdown_msg)
         #  await self.worker_manager.send_message(worker, MessageType.TASK, task_msg.pack() + input_patch.tobytes())
 
@@ -463,7 +1727,9 @@ class Coordinator:
             layer_config_dict = layer_data["layer_config"]
             quant_params_dict = layer_data["quant_params"]
 
-            layer_type = LayerType(layer_config_dict["type"])
+            layer_type = layer_config_dict["type"]
+            layer_type = LayerType[layer_type] if isinstance(layer_type, str) else LayerType(layer_type)
+            activation = Activation[layer_config_dict.get("activation", "NONE")]
 
             cfg = LayerConfig(
                 name=layer_config_dict["name"],
@@ -475,9 +1741,12 @@ class Coordinator:
                 stride=layer_config_dict["stride"],
                 padding=layer_config_dict["padding"],
                 groups=layer_config_dict["groups"],
-                residual_add_to=layer_config_dict["residual_add_to"],
-                residual_connect_from=layer_config_dict["residual_connect_from"]
+                residual_add_to=layer_config_dict.get("residual_add_to"),
+                residual_connect_from=layer_config_dict.get("residual_connect_from"),
+                activation=activation,
             )
+            # exported clamp if there is one, otherwise derived from the output scale
+            act_min, act_max = activation_range(activation, float(quant_params_dict["s_out"]), int(quant_params_dict["z_out"]))
 
             qp = QuantParams(
                 s_in=float(quant_params_dict["s_in"]),
@@ -487,8 +1756,10 @@ class Coordinator:
                 s_out=float(quant_params_dict["s_out"]),
                 z_out=int(quant_params_dict["z_out"]),
                 m=np.array(quant_params_dict["m"], dtype=np.float32),
-                s_residual_out=float(quant_params_dict["s_residual_out"]) if quant_params_dict["s_residual_out"] is not None else None,
-                z_residual_out=int(quant_params_dict["z_residual_out"]) if quant_params_dict["z_residual_out"] is not None else None
+                s_residual_out=float(quant_params_dict["s_residual_out"]) if quant_params_dict.get("s_residual_out") is not None else None,
+                z_residual_out=int(quant_params_dict["z_residual_out"]) if quant_params_dict.get("z_residual_out") is not None else None,
+                act_min=int(quant_params_dict.get("act_min", act_min)),
+                act_max=int(quant_params_dict.get("act_max", act_max)),
             )
 
             layer_configs.append(cfg)
@@ -496,14 +1767,30 @@ class Coordinator:
 
         self.layer_config_list = layer_configs
         self.quant_params_list = quant_params
+        self.model_hash = model_hash([(cfg.in_channels, cfg.out_channels, cfg.kernel_size, cfg.stride, cfg.padding, qp.z_in, qp.z_out)
+                                      for cfg, qp in zip(layer_configs, quant_params)])
+        for worker in self.worker_manager.workers.values():
+            if worker.model_hash != self.model_hash:
+                logger.warning(f"[Coordinator]: Worker {worker.worker_id} holds another model "
+                               f"(hash {worker.model_hash:#010x}, expected {self.model_hash:#010x}), it gets no tasks")
         logger.info(f"[Coordinator]: Parsed {len(self.layer_config_list)} layers and quantization parameters from config")
     
     def _quantize_input(self, input_data: np.ndarray, quant_params: QuantParams) -> np.ndarray:
         s_in = quant_params.s_in
         z_in = quant_params.z_in
-        quantized = np.clip(np.round(input_data / s_in + z_in), 0, 255).astype(np.uint8)
+        # into a reused buffer inside the first layer's padding, like any layer output
+        quantized = self._layer_buffer(input_data.shape, np.uint8, self._consumer_border(0, input_data.shape[2]), layer_idx=-1)
+        quantized[...] = np.clip(np.round(input_data / s_in + z_in), 0, 255)
         return quantized
     
+    @staticmethod
+    def _kernel_report(layer_stats: dict) -> str:
+        """ the kernel variant each worker ran the layer with, empty for block layers """
+        kernels = {worker_id: ws["kernel"] for worker_id, ws in layer_stats.get("workers", {}).items() if "kernel" in ws}
+        if not kernels:
+            return ""
+        return "kernels=" + ",".join(f"{worker_id}:{kernel}" for worker_id, kernel in sorted(kernels.items()))
+
     def print_stats(self):
         logger.info(f"[Coordinator]: Inference execution stats:")
         for s in self.stats:
@@ -511,5 +1798,8 @@ class Coordinator:
                 f"Layer {s['layer_idx']:>3} [{s['layer_type']:>8}] {s['layer_name']}: "
                 f"total={s['total_time_ms']:.2f}ms  "
                 f"compute={s.get('avg_compute_ms', 0):.2f}ms  "
+                + (f"speculative={s['speculative']} (won {s.get('speculative_wins', 0)})  " if s.get('speculative') else "")
+                + (f"retries={s['retries']}  " if s.get('retries') else "")
                 # f"comm={s.get('avg_comm_ms', 0):.2f}ms"
+                + self._kernel_report(s)
             )
\ No newline at end of file
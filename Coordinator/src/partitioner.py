@@ -0,0 +1,119 @@
+import logging
+from dataclasses import dataclass
+from typing import Optional
+import numpy as np
+from .protocol import *
+from .work_manager import *
+
+logger = logging.getLogger(__name__)
+
+# prior for a worker we haven't measured yet and that reported no boot benchmark: roughly one int8
+# MAC (+ requant) every 4 cycles on an M7 without SIMD, scaled by the clock reported at registration
+MACS_PER_MS_PER_MHZ = 250.0
+
+
+@dataclass
+class RowCost:
+    """ cost of producing one output row of a layer """
+    macs: int # multiply-accumulates per output row
+    bytes: int # bytes on the wire per output row (input rows sent + output row returned)
+    fixed_bytes: int = 0 # halo rows sent once per task, independent of the slice height
+
+
+class RowPartitioner:
+    """ split output rows so that every worker's predicted finish time is the same
+
+    Each worker has a smoothed throughput estimate (MACs per ms) per layer kind, seeded from
+    the boot benchmark of the layer (or of the whole model) or `clock_mhz` and updated from the `mcu_compute_ms` it reports. Throughput is kept in MACs
+    rather than rows so that one estimate covers all layers of a kind regardless of their shape;
+    `rows_per_ms` converts it back for a given layer.
+
+    With `adaptive=False` the estimates are never updated, so the split only depends on the
+    reported clocks and the layer shapes, which keeps benchmark runs reproducible.
+    """
+    def __init__(self, alpha: float = 0.3, link_mbps: float = 100.0, task_overhead_ms: float = 1.0,
+                 adaptive: bool = True, replan_tolerance: float = 0.1):
+        self.alpha = alpha
+        self.bytes_per_ms = link_mbps * 1e6 / 8 / 1000
+        self.task_overhead_ms = task_overhead_ms
+        self.adaptive = adaptive
+        self.rates: dict[tuple[int, LayerType], float] = {} # (worker_id, layer kind) -> MACs per ms
+        # bumped whenever a rate moves more than replan_tolerance away from the one splits were last made
+        # with, so compiled execution plans are rebuilt only when their splits would change
+        self.replan_tolerance = replan_tolerance
+        self.planned_rates: dict[tuple[int, LayerType], float] = {}
+        self.version = 0
+
+    @staticmethod
+    def layer_kind(layer_type: LayerType, kernel_size: int) -> LayerType:
+        # 1x1 convs are exported as CONV but run at a very different MAC rate than 3x3 ones
+        if layer_type == LayerType.CONV and kernel_size == 1:
+            return LayerType.POINTWISE
+        return LayerType(layer_type)
+
+    def rate(self, worker: WorkerInfo, kind: LayerType, layer_idx: Optional[int] = None) -> float:
+        key = (worker.worker_id, kind)
+        if self.adaptive and key in self.rates:
+            return self.rates[key]
+        # until the worker has run a layer of this kind, trust what its kernels did on this layer at boot
+        if layer_idx is not None and worker.layer_bench(layer_idx):
+            return float(worker.layer_bench(layer_idx))
+        if worker.bench_score:
+            return float(worker.bench_score)
+        return max(worker.clock_mhz, 1) * MACS_PER_MS_PER_MHZ
+
+    def rows_per_ms(self, worker: WorkerInfo, kind: LayerType, cost: RowCost, layer_idx: Optional[int] = None) -> float:
+        return self.rate(worker, kind, layer_idx) / max(cost.macs, 1)
+
+    def split(self, workers: list[WorkerInfo], total_rows: int, kind: LayerType, cost: RowCost,
+              layer_idx: Optional[int] = None) -> list[tuple[WorkerInfo, int, int]]:
+        """ returns contiguous (worker, start_row, end_row) ranges, workers given no rows are left out """
+        if not workers or total_rows <= 0:
+            return []
+
+        # predicted finish time of worker i with r rows: a_i + r * b_i
+        per_row = np.array([1.0 / self.rows_per_ms(w, kind, cost, layer_idx) + cost.bytes / self.bytes_per_ms for w in workers])
+        per_task = np.full(len(workers), self.task_overhead_ms + cost.fixed_bytes / self.bytes_per_ms)
+
+        active = np.ones(len(workers), dtype=bool)
+        while True:
+            # solve sum_i (T - a_i) / b_i = total_rows for the common finish time T
+            finish = (total_rows + np.sum(per_task[active] / per_row[active])) / np.sum(1.0 / per_row[active])
+            rows = np.where(active, (finish - per_task) / per_row, 0.0)
+            # a worker whose fixed cost alone exceeds the finish time only slows the layer down
+            too_slow = active & (rows <= 0)
+            if not too_slow.any():
+                break
+            active &= ~too_slow
+
+        # largest remainder rounding so the counts add up to total_rows
+        counts = np.floor(rows).astype(int)
+        remainder = total_rows - int(counts.sum())
+        if remainder > 0:
+            order = np.argsort(-(rows - counts), kind='stable')
+            counts[order[:remainder]] += 1
+
+        assignments = []
+        start = 0
+        for worker, count in zip(workers, counts):
+            if count <= 0:
+                continue
+            assignments.append((worker, start, start + int(count)))
+            start += int(count)
+        return assignments
+
+    def observe(self, worker: WorkerInfo, kind: LayerType, rows: int, cost: RowCost, compute_ms: float):
+        self.observe_macs(worker, kind, rows * cost.macs, compute_ms)
+
+    def observe_macs(self, worker: WorkerInfo, kind: LayerType, macs: int, compute_ms: float):
+        if not self.adaptive or macs <= 0 or compute_ms <= 0:
+            return
+        measured = macs / compute_ms
+        key = (worker.worker_id, kind)
+        prev = self.rates.get(key)
+        self.rates[key] = measured if prev is None else (1 - self.alpha) * prev + self.alpha * measured
+        planned = self.planned_rates.get(key)
+        if planned is None or abs(self.rates[key] - planned) > self.replan_tolerance * planned:
+            self.planned_rates[key] = self.rates[key]
+            self.version += 1
+        logger.debug(f"[RowPartitioner]: worker {worker.worker_id} {kind.name}: {self.rates[key]:.0f} MACs/ms")
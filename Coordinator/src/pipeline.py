@@ -0,0 +1,214 @@
+import asyncio
+import logging
+import time
+from dataclasses import dataclass, field
+from typing import TYPE_CHECKING
+import numpy as np
+from .protocol import *
+from .work_manager import *
+from .plan import *
+
+if TYPE_CHECKING:
+    from .coordniator import Coordinator
+
+logger = logging.getLogger(__name__)
+
+# a stage's output buffers rotate through this many sets: one being read by the next stage, one waiting in the
+# queue between them and one being written
+PIPELINE_SLOTS = 3
+
+
+@dataclass
+class Stage:
+    """ layers [first_layer, end_layer) of the model, run on these workers only """
+    first_layer: int
+    end_layer: int
+    workers: list[WorkerInfo]
+    predicted_ms: float = 0.0 # per image, from the partitioner's rates
+    busy_ms: list[float] = field(default_factory=list) # measured per image
+
+
+class LayerPipeline:
+    """ stream many images through the model with contiguous layer ranges on disjoint worker groups
+
+    Single image inference spreads every layer over all workers and pays a round trip per layer; here each stage
+    only waits for its own layers, and all stages work on different images at once. Throughput is set by the
+    slowest stage, so the stages are chosen to minimize it under the partitioner's per-layer cost model: workers
+    sorted by id are cut into contiguous groups and the compiled steps into contiguous ranges, never inside a
+    residual connection, since its stored input would live in another stage.
+    """
+    def __init__(self, coordinator: 'Coordinator', num_stages: int):
+        self.coordinator = coordinator
+        self.num_stages = num_stages
+
+    def plan_stages(self, in_shape: tuple) -> list[Stage]:
+        c = self.coordinator
+        steps = c._compile_plan(in_shape).layers
+        workers = sorted((w for w in c.worker_manager.workers.values() if w.worker_id not in c.quarantined), key=lambda w: w.worker_id)
+        n, N = len(steps), len(workers)
+        shapes = [tuple(in_shape)] + [step.out_shape for step in steps]
+        ends = [step.layer_idx for step in steps[1:]] + [len(c.layer_config_list)]
+
+        # steps a stage may start at: no residual is open across the boundary
+        starts = [0]
+        open_residuals: set[str] = set()
+        for j, step in enumerate(steps):
+            for layer in c.layer_config_list[step.layer_idx:ends[j]]:
+                if layer.residual_add_to:
+                    open_residuals.add(layer.residual_add_to)
+                if layer.residual_connect_from:
+                    open_residuals.discard(layer.residual_connect_from)
+            if not open_residuals and j + 1 < n:
+                starts.append(j + 1)
+        bounds = starts + [n]
+
+        # per worker group (q, m) = workers[q:m], the predicted time of every step and how many it can't run
+        cost: dict[tuple[int, int], np.ndarray] = {}
+        infeasible: dict[tuple[int, int], np.ndarray] = {}
+        for q in range(N):
+            for m in range(q + 1, N + 1):
+                runner = c._stage_runner(workers[q:m])
+                times = np.zeros(n + 1)
+                missing = np.zeros(n + 1, dtype=int)
+                for j, step in enumerate(steps):
+                    ms = self._predicted_ms(runner, step.layer_idx, ends[j], shapes[j])
+                    times[j + 1] = times[j] + (0.0 if ms is None else ms)
+                    missing[j + 1] = missing[j] + (ms is None)
+                cost[q, m], infeasible[q, m] = times, missing
+
+        def stage_ms(i: int, j: int, q: int, m: int) -> float:
+            if infeasible[q, m][j] - infeasible[q, m][i]:
+                return np.inf
+            return cost[q, m][j] - cost[q, m][i]
+
+        # best[k][b][m]: slowest stage when k stages cover steps[:bounds[b]] with workers[:m]
+        S = min(self.num_stages, N, len(bounds) - 1)
+        best = np.full((S + 1, len(bounds), N + 1), np.inf)
+        choice: dict[tuple[int, int, int], tuple[int, int]] = {}
+        best[0, 0, 0] = 0.0
+        for k in range(1, S + 1):
+            for b in range(1, len(bounds)):
+                for m in range(k, N + 1):
+                    for a in range(b):
+                        for q in range(k - 1, m):
+                            if not np.isfinite(best[k - 1, a, q]):
+                                continue
+                            value = max(best[k - 1, a, q], stage_ms(bounds[a], bounds[b], q, m))
+                            if value < best[k, b, m]:
+                                best[k, b, m] = value
+                                choice[k, b, m] = (a, q)
+        k = min(range(1, S + 1), key=lambda k: best[k, -1, N])
+        if not np.isfinite(best[k, -1, N]):
+            raise RuntimeError("No split of the workers into pipeline stages can run the model")
+
+        stages = []
+        b, m = len(bounds) - 1, N
+        while k:
+            a, q = choice[k, b, m]
+            first, end = steps[bounds[a]].layer_idx, ends[bounds[b] - 1]
+            stages.append(Stage(first, end, workers[q:m], stage_ms(bounds[a], bounds[b], q, m)))
+            k, b, m = k - 1, a, q
+        stages.reverse()
+        for stage in stages:
+            logger.info(f"[LayerPipeline]: Stage layers {stage.first_layer}-{stage.end_layer - 1} on workers "
+                        f"{[w.worker_id for w in stage.workers]}, predicted {stage.predicted_ms:.2f}ms per image")
+        return stages
+
+    @staticmethod
+    def _predicted_ms(runner: 'Coordinator', first_layer: int, end_layer: int, in_shape: tuple):
+        """ time of layers [first_layer, end_layer) on the runner's workers, None if they can't run them """
+        total = 0.0
+        layer_idx, shape = first_layer, in_shape
+        while layer_idx < end_layer:
+            try:
+                step = runner._plan_step(layer_idx, shape, end_layer)
+            except RuntimeError:
+                return None
+            busy: dict[int, float] = {}
+            for spec in step.tasks:
+                busy[spec.worker.worker_id] = busy.get(spec.worker.worker_id, 0.0) + spec.predicted_ms
+            # the layer ends with its slowest worker
+            total += max(busy.values(), default=0.0)
+            layer_idx += step.num_layers
+            shape = step.out_shape
+        return total
+
+    async def run(self, images: list[np.ndarray]) -> tuple[list[np.ndarray], dict]:
+        """ classifier outputs of the images in order, and the steady state throughput and latency """
+        c = self.coordinator
+        stages = self.plan_stages(images[0].shape)
+        runners = [c._stage_runner(stage.workers) for stage in stages]
+        queues = [asyncio.Queue(maxsize=1) for _ in range(len(stages) + 1)]
+        outputs: list[np.ndarray] = [None] * len(images)
+        started, finished = {}, {}
+
+        async def feed():
+            for idx, image in enumerate(images):
+                await queues[0].put((idx, image))
+            await queues[0].put(None)
+
+        async def run_stage(k: int, stage: Stage, runner: 'Coordinator'):
+            while (item := await queues[k].get()) is not None:
+                idx, data = item
+                stage_start = time.perf_counter()
+                runner.buffer_slot = idx % PIPELINE_SLOTS
+                if k == 0:
+                    started[idx] = stage_start
+                    data = runner._quantize_input(data, runner.quant_params_list[0])
+                runner.feature_map = data
+                runner.residual_buffers.clear()
+                runner.stats.clear()
+                key = runner._plan_key(data.shape, stage.first_layer, stage.end_layer)
+                if runner.plan is None or runner.plan.key != key:
+                    runner.plan = runner._compile_plan(data.shape, stage.first_layer, stage.end_layer)
+                await runner._run_steps(runner.plan.layers)
+                stage.busy_ms.append((time.perf_counter() - stage_start) * 1000)
+                await queues[k + 1].put((idx, runner.feature_map))
+            await queues[k + 1].put(None)
+
+        async def collect():
+            while (item := await queues[-1].get()) is not None:
+                idx, output = item
+                # the last stage reuses its output buffer PIPELINE_SLOTS images later
+                outputs[idx] = output.copy()
+                finished[idx] = time.perf_counter()
+
+        tasks = [asyncio.create_task(feed())]
+        tasks += [asyncio.create_task(run_stage(k, stage, runner)) for k, (stage, runner) in enumerate(zip(stages, runners))]
+        tasks.append(asyncio.create_task(collect()))
+        try:
+            await asyncio.gather(*tasks)
+        except BaseException:
+            # a failed stage would leave the others waiting on its queues forever
+            for task in tasks:
+                task.cancel()
+            await asyncio.gather(*tasks, return_exceptions=True)
+            raise
+
+        latencies = np.array([(finished[i] - started[i]) * 1000 for i in range(len(images))])
+        done = sorted(finished.values())
+        # images per second once the pipeline is full: the first result only marks the fill
+        if len(done) > 1:
+            throughput = (len(done) - 1) / (done[-1] - done[0])
+        else:
+            throughput = 1000 / latencies[0]
+        stats = {
+            "images": len(images),
+            "throughput_ips": float(throughput),
+            "latency_p50_ms": float(np.percentile(latencies, 50)),
+            "latency_p90_ms": float(np.percentile(latencies, 90)),
+            "latency_p99_ms": float(np.percentile(latencies, 99)),
+            "stages": [{
+                "layers": (stage.first_layer, stage.end_layer),
+                "workers": [w.worker_id for w in stage.workers],
+                "predicted_ms": stage.predicted_ms,
+                "mean_ms": float(np.mean(stage.busy_ms)),
+            } for stage in stages],
+        }
+        logger.info(f"[LayerPipeline]: {len(images)} images through {len(stages)} stages: "
+                    f"{stats['throughput_ips']:.2f} images/s, latency p50={stats['latency_p50_ms']:.2f}ms "
+                    f"p90={stats['latency_p90_ms']:.2f}ms p99={stats['latency_p99_ms']:.2f}ms")
+        for s in stats["stages"]:
+            logger.info(f"[LayerPipeline]: Stage layers {s['layers'][0]}-{s['layers'][1] - 1} on workers {s['workers']}: "
+                        f"{s['mean_ms']:.2f}ms per image (predicted {s['predicted_ms']:.2f}ms)")
+        return outputs, stats
@@ -0,0 +1,58 @@
+import logging
+from dataclasses import dataclass, field
+from typing import Optional
+import numpy as np
+from .protocol import *
+from .work_manager import *
+from .partitioner import RowCost
+
+logger = logging.getLogger(__name__)
+
+
+@dataclass
+class TaskSpec:
+    """ one task of a compiled layer, everything but its id and the input bytes """
+    worker: WorkerInfo
+    msg: TaskMessage # packed once, see TaskMessage.packed
+    patch: tuple # index of the task's input in the layer input (the padded map of a conv layer)
+    start_idx: int # output slice [start_idx, end_idx), rows for conv and classes for fc
+    end_idx: int
+    ch_start: int = 0
+    ch_end: Optional[int] = None
+    col_start: int = 0
+    col_end: Optional[int] = None
+    pooled: bool = False
+    predicted_ms: float = 0.0 # see Coordinator._predict_ms
+
+
+@dataclass
+class LayerPlan:
+    """ how one layer (or fused block) runs on the current workers and input size """
+    layer_idx: int # first layer
+    num_layers: int # > 1 for a fused block
+    tasks: list[TaskSpec]
+    out_shape: tuple # (C, H, W), or (C,) for fc and pooled layers
+    partition: str # for the layer stats
+    out_dtype: type = np.uint8 # uint32 when the workers return per-channel sums to add up
+    in_border: tuple[int, int] = (0, 0) # (padding, value) the input is padded with before slicing
+    out_border: tuple[int, int] = (0, 0) # (padding, value) of the consumer, the output is allocated inside it
+    pool_pixels: int = 1 # the summed pooled output is divided by this
+    flat_input: bool = False # fc: the tasks index the flattened input
+    # measured compute time is fed back to the partitioner as this kind, per output row cost for fused blocks
+    # and per output pixel and channel MACs otherwise
+    kind: Optional[LayerType] = None
+    cost: Optional[RowCost] = None
+    macs_per_pixel: int = 0
+    # > 1: runs once on the images of a micro-batch, stacked along the rows (conv) or as vectors (fc)
+    batch: int = 1
+
+
+@dataclass
+class Plan:
+    """ the whole model compiled for one (model, input shape, worker set, partitioner state)
+
+    Inference walks the layer plans and only slices the inputs and numbers the tasks; shapes, splits, task
+    messages and buffer borders are worked out once in Coordinator._compile_plan.
+    """
+    key: tuple
+    layers: list[LayerPlan] = field(default_factory=list)
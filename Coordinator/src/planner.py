@@ -0,0 +1,115 @@
+import logging
+from dataclasses import dataclass
+from enum import IntEnum
+from typing import Optional
+import numpy as np
+from .protocol import *
+from .partitioner import MACS_PER_MS_PER_MHZ
+
+logger = logging.getLogger(__name__)
+
+
+class PartitionStrategy(IntEnum):
+    ROWS = 0, # split output rows, every worker computes all channels
+    OUT_CHANNELS = 1, # split output channels, every worker gets the full input
+    HYBRID = 2, # row bands x channel groups
+    TILES = 3, # row bands x column groups, every worker computes all channels of a 2D tile
+
+
+@dataclass
+class PartitionPlan:
+    strategy: PartitionStrategy
+    row_groups: int
+    channel_groups: int
+    cost_ms: float # predicted layer time
+    col_groups: int = 1
+
+
+class PartitionPlanner:
+    """ picks how a conv-family layer is cut across the workers
+
+    For every grid of `row_groups x channel_groups <= num_workers` the layer time is predicted as
+    the slowest task's compute plus the bytes that cross the coordinator link (the link is shared,
+    so transfers add up) plus a fixed cost per task. Row bands duplicate the `kernel_size - stride`
+    halo rows, channel groups duplicate the whole input band, the returned bytes are the same for
+    every grid but still counted so the estimate is an absolute time. Column groups duplicate the
+    halo columns the same way, they let late layers with fewer output rows than workers still use
+    the whole fleet.
+
+    Depthwise channels only read their own input channel, so a depthwise channel group is sent just
+    its channels' planes and channel splits cost no extra bytes at all.
+
+    Compute runs at the registered clocks of the workers the grid uses, its fastest ones. Row and channel
+    splits are sized to each worker's speed so they finish together at the workers' combined rate, the
+    equal cells of hybrid and tile grids wait for the slowest of them. `clock_mhz` only stands in for
+    workers that reported no clock.
+    """
+    def __init__(self, link_mbps: float = 100.0, task_overhead_ms: float = 1.0, clock_mhz: int = 600):
+        self.bytes_per_ms = link_mbps * 1e6 / 8 / 1000
+        self.task_overhead_ms = task_overhead_ms
+        self.macs_per_ms = clock_mhz * MACS_PER_MS_PER_MHZ
+
+    def cost(self, layer, in_w: int, out_h: int, out_w: int, row_groups: int, channel_groups: int,
+             col_groups: int = 1, clocks_mhz: Optional[list[int]] = None) -> float:
+        rows = int(np.ceil(out_h / row_groups))
+        cols = int(np.ceil(out_w / col_groups))
+        channels = int(np.ceil(layer.out_channels / channel_groups))
+        cin_per_group = layer.in_channels // max(layer.groups, 1)
+        tasks = row_groups * channel_groups * col_groups
+        task_macs = rows * cols * channels * cin_per_group * layer.kernel_size ** 2
+        rates = self._rates(clocks_mhz, tasks)
+        if col_groups == 1 and (row_groups == 1 or channel_groups == 1):
+            compute_ms = task_macs * tasks / sum(rates)
+        else:
+            compute_ms = task_macs / min(rates)
+
+        in_rows = (rows - 1) * layer.stride + layer.kernel_size
+        # a single column group gets the whole padded width
+        in_cols = in_w if col_groups == 1 else (cols - 1) * layer.stride + layer.kernel_size
+        input_copies = 1 if layer.type == LayerType.DEPTHWISE else channel_groups
+        bytes_sent = input_copies * row_groups * col_groups * layer.in_channels * in_rows * in_cols
+        bytes_returned = layer.out_channels * out_h * out_w
+        return compute_ms + (bytes_sent + bytes_returned) / self.bytes_per_ms + tasks * self.task_overhead_ms
+
+    def _rates(self, clocks_mhz: Optional[list[int]], tasks: int) -> list[float]:
+        """ MACs per ms of the `tasks` fastest workers """
+        if not clocks_mhz:
+            return [self.macs_per_ms] * tasks
+        rates = sorted((clock * MACS_PER_MS_PER_MHZ if clock > 0 else self.macs_per_ms for clock in clocks_mhz), reverse=True)
+        return rates[:tasks] + [rates[-1]] * (tasks - len(rates))
+
+    def choose(self, layer, in_w: int, out_h: int, out_w: int, num_workers: int,
+               strategy: Optional[PartitionStrategy] = None, clocks_mhz: Optional[list[int]] = None) -> PartitionPlan:
+        """ clocks_mhz are the registered clocks of the num_workers workers, the constructor's for all if None """
+        candidates = []
+        for row_groups in range(1, min(num_workers, out_h) + 1):
+            channel_groups = min(num_workers // row_groups, layer.out_channels)
+            if row_groups > 1 and channel_groups > 1:
+                kind = PartitionStrategy.HYBRID
+            elif channel_groups > 1:
+                kind = PartitionStrategy.OUT_CHANNELS
+            else:
+                kind = PartitionStrategy.ROWS
+            if strategy is not None and kind != strategy:
+                continue
+            cost = self.cost(layer, in_w, out_h, out_w, row_groups, channel_groups, clocks_mhz=clocks_mhz)
+            candidates.append(PartitionPlan(kind, row_groups, channel_groups, cost))
+
+        if strategy is None or strategy == PartitionStrategy.TILES:
+            for row_groups in range(1, min(num_workers, out_h) + 1):
+                col_groups = min(num_workers // row_groups, out_w)
+                if col_groups < 2:
+                    continue
+                cost = self.cost(layer, in_w, out_h, out_w, row_groups, 1, col_groups, clocks_mhz)
+                candidates.append(PartitionPlan(PartitionStrategy.TILES, row_groups, 1, cost, col_groups))
+
+        if not candidates:
+            # the forced strategy doesn't fit this layer, fall back to rows
+            rows = min(num_workers, out_h)
+            return PartitionPlan(PartitionStrategy.ROWS, rows, 1, self.cost(layer, in_w, out_h, out_w, rows, 1, clocks_mhz=clocks_mhz))
+
+        # prefer using more workers when the estimates tie
+        best = min(candidates, key=lambda p: (round(p.cost_ms, 6), -p.row_groups * p.channel_groups * p.col_groups))
+        logger.debug(f"[PartitionPlanner]: layer {layer.name}: {best.strategy.name} "
+                     f"{best.row_groups}x{best.channel_groups}x{best.col_groups}, predicted {best.cost_ms:.2f}ms")
+        return best
@@ -1,13 +1,30 @@
+import math
 import struct
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 from enum import IntEnum
+from typing import Optional
 
 PROTOCOL_MAGIC = 0xDEADBEEF
+PROTOCOL_VERSION = 7 # bumped whenever a message layout changes, workers speaking another version are turned away
+
+# bits of TaskMessage.flags
+TASK_FLAG_RESIDUAL = 0x01 # a ResidualParams follows the TaskMessage, add the block input to the block output
+TASK_FLAG_GAP = 0x02 # global average pool the output: one uint32 sum per channel comes back instead of the map
+TASK_FLAG_GAP_MEAN = 0x04 # with TASK_FLAG_GAP, the task covers the whole map: one uint8 mean per channel comes back
+TASK_FLAG_ACTIVATION = 0x08 # num_layers (act_min, act_max) byte pairs follow (after the ResidualParams), one per layer
+TASK_FLAG_HWC = 0x10 # input patch and output tile are channel-last [H, W, C] instead of [C, H, W]
+
+TASK_MAX_BATCH = 0xFF # TaskMessage.batch is one byte
+
+# bits of ResultMessage.flags
+RESULT_FLAG_STREAMED = 0x01 # the output was sent block by block as computed, a uint32 compute_time_us follows it
+RESULT_FLAG_CANCELLED = 0x02 # a CANCEL for the task arrived before it finished, no output follows
 
 class ErrorCode(IntEnum):
     ERR_NONE = 0x00,
     ERR_OUT_OF_MEMORY = 0x01,
     ERR_INVALID_TASK = 0x02,
+    ERR_UNSUPPORTED_PROTOCOL = 0x03, # REGISTER_ACK status for a worker of another PROTOCOL_VERSION
 
 class MessageType(IntEnum):
     REGISTER = 0x01, # worker -> server
@@ -17,17 +34,47 @@ class MessageType(IntEnum):
     ERROR = 0x05, # worker -> server
     HEARTBEAT = 0x06, # worker -> server
     SHUTDOWN = 0x07, # server -> worker
+    CANCEL = 0x08, # server -> worker, the task of header.task_id is no longer needed
 
 class LayerType(IntEnum):
     CONV = 0x01,
     DEPTHWISE = 0x02,
     POINTWISE = 0x03,
     FC = 0x04,
+    BLOCK = 0x05, # fused [expand] -> depthwise -> project, see TaskMessage.num_layers
+
+class Activation(IntEnum):
+    """ activation fused into a layer's requantization """
+    NONE = 0x00,
+    RELU = 0x01,
+    RELU6 = 0x02,
+
+def model_hash(layers: list[tuple[int, ...]]) -> int:
+    """ FNV-1a over the int32 fields of every layer: (in_channels, out_channels, kernel_size, stride, padding, z_in, z_out)
+
+    The worker hashes the same fields of its layer_config.h and quant_params.h, so a worker flashed
+    with another model or export is told apart at registration.
+    """
+    h = 0x811C9DC5
+    for fields in layers:
+        for byte in struct.pack(f'<{len(fields)}i', *fields):
+            h = ((h ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+def activation_range(activation: Activation, s_out: float, z_out: int) -> tuple[int, int]:
+    """ the activation as a clamp [act_min, act_max] of the quantized output """
+    def q(x: float) -> int:
+        return int(min(255, max(0, round(x / s_out) + z_out)))
+    if activation == Activation.RELU:
+        return q(0.0), 255
+    if activation == Activation.RELU6:
+        return q(0.0), q(6.0)
+    return 0, 255
 
 
 @dataclass
 class MessageHeader:
-    FORMAT = '<IBBI6s'
+    FORMAT = '<IBBII2s'
     SIZE = struct.calcsize(FORMAT)
 
 
@@ -35,34 +82,90 @@ class MessageHeader:
     type: MessageType = MessageType.REGISTER    
     worker_id: int = 0
     payload_len: int = 0
-    reserved: bytes = bytes(6) # for future use
+    task_id: int = 0 # set on TASK, echoed back by the worker on RESULT/ERROR
+    reserved: bytes = bytes(2) # for future use
 
     def pack(self) -> bytes:
         # little-endian
-        return struct.pack(self.FORMAT, self.magic, self.type, self.worker_id, self.payload_len, self.reserved)
+        return struct.pack(self.FORMAT, self.magic, self.type, self.worker_id, self.payload_len, self.task_id, self.reserved)
 
     @staticmethod
     def unpack(data: bytes) -> 'MessageHeader':
-        if len(data) < 16:
+        if len(data) < MessageHeader.SIZE:
             raise ValueError("Insufficient data for MessageHeader")
-        magic, type, worker_id, payload_len, reserved = struct.unpack(MessageHeader.FORMAT, data[:16])
+        magic, type, worker_id, payload_len, task_id, reserved = struct.unpack(MessageHeader.FORMAT, data[:MessageHeader.SIZE])
         if magic != PROTOCOL_MAGIC:
             raise ValueError("Invalid magic number")
-        return MessageHeader(magic, MessageType(type), worker_id, payload_len, reserved)
+        return MessageHeader(magic, MessageType(type), worker_id, payload_len, task_id, reserved)
     
+@dataclass
+class WeightShard:
+    """ output channels [oc_start, oc_start + oc_count) of a layer, the only ones a worker holds weights for """
+    FORMAT = '<HII'
+    SIZE = struct.calcsize(FORMAT)
+
+    layer_idx: int
+    oc_start: int
+    oc_count: int
+
+class KernelVariant(IntEnum):
+    """ implementations of a layer on the worker """
+    NATIVE = 0x00 # direct loops, specialized on kernel size and stride where there is one
+    IM2COL = 0x01 # im2col + GEMM, conv only
+    DSP = 0x02 # CMSIS-DSP dot products, fc only
+
+# TaskMessage.kernel_variant leaving the choice to the worker, also what block tasks report back
+KERNEL_VARIANT_AUTO = 0xFF
+
+@dataclass
+class KernelBench:
+    """ speed of one kernel variant on one layer, timed by the worker on a synthetic tile at boot """
+    FORMAT = '<HBI'
+    SIZE = struct.calcsize(FORMAT)
+
+    layer_idx: int
+    variant: KernelVariant
+    macs_per_ms: int
+
 @dataclass
 class RegisterMessage:
-    FORMAT = '<I'
+    """ what a worker can do, the coordinator only sends it tasks that fit """
+    FORMAT = '<IHIIIBBIIHH'
     SIZE = struct.calcsize(FORMAT)
 
     clock_mhz: int
+    protocol_version: int = PROTOCOL_VERSION
+    input_buffer_size: int = 0 # largest task input, in bytes
+    output_buffer_size: int = 0 # largest task output, in bytes
+    scratch_size: int = 0 # arena of the fused block tasks, in bytes
+    task_types: int = 0 # bit (1 << LayerType) for every task type the worker runs
+    task_flags: int = 0 # TASK_FLAG_* the worker understands
+    model_hash: int = 0 # model_hash() of the layers the worker's weights were exported for
+    bench_score: int = 0 # MACs per ms measured at boot, 0 if not measured
+    # followed by num_weight_shards WeightShard, layers not listed are held whole
+    weight_shards: list[WeightShard] = field(default_factory=list)
+    # then num_kernel_benches KernelBench, empty if the worker wasn't built with BOOT_BENCH
+    kernel_benches: list[KernelBench] = field(default_factory=list)
     
     @staticmethod
     def unpack(data: bytes) -> 'RegisterMessage':
-        if len(data) < RegisterMessage.SIZE:
+        if len(data) < struct.calcsize('<I'):
             raise ValueError("Insufficient data for RegisterMessage")
-        clock_mhz, = struct.unpack(RegisterMessage.FORMAT, data[:RegisterMessage.SIZE])
-        return RegisterMessage(clock_mhz)
+        if len(data) < RegisterMessage.SIZE:
+            # firmware from before the registration was versioned, it's turned away
+            clock_mhz, = struct.unpack_from('<I', data)
+            return RegisterMessage(clock_mhz, protocol_version=0)
+        *fields, num_weight_shards, num_kernel_benches = struct.unpack(RegisterMessage.FORMAT, data[:RegisterMessage.SIZE])
+        benches_offset = RegisterMessage.SIZE + num_weight_shards * WeightShard.SIZE
+        if len(data) < benches_offset + num_kernel_benches * KernelBench.SIZE:
+            raise ValueError("Insufficient data for the weight shards and kernel benches of RegisterMessage")
+        weight_shards = [WeightShard(*struct.unpack_from(WeightShard.FORMAT, data, RegisterMessage.SIZE + i * WeightShard.SIZE))
+                         for i in range(num_weight_shards)]
+        kernel_benches = []
+        for i in range(num_kernel_benches):
+            layer_idx, variant, macs_per_ms = struct.unpack_from(KernelBench.FORMAT, data, benches_offset + i * KernelBench.SIZE)
+            kernel_benches.append(KernelBench(layer_idx, KernelVariant(variant), macs_per_ms))
+        return RegisterMessage(*fields, weight_shards=weight_shards, kernel_benches=kernel_benches)
     
 @dataclass
 class RegisterAckMessage:
@@ -76,9 +179,39 @@ class RegisterAckMessage:
         return struct.pack(RegisterAckMessage.FORMAT, self.status, self.assigned_id)
 
 # TODO optimize the payload structure, e.g. conv params and linear params don't need to be transmitted in the task message
+@dataclass
+class ResidualParams:
+    """ integer residual add done by the worker:
+    out = zp_sum + round(((out - zp_out) * mult_out + (res - zp_res) * mult_res) / 2^shift)
+    """
+    FORMAT = '<iiiiiB'
+    SIZE = struct.calcsize(FORMAT)
+
+    mult_out: int
+    mult_res: int
+    zp_out: int
+    zp_res: int
+    zp_sum: int
+    shift: int
+
+    @staticmethod
+    def from_scales(s_out: float, zp_out: int, s_res: float, zp_res: int, s_sum: float, zp_sum: int) -> 'ResidualParams':
+        m_out, m_res = s_out / s_sum, s_res / s_sum
+        # as many fractional bits as keep the larger multiplier below 2^31
+        shift = int(min(30, max(0, 30 - math.floor(math.log2(max(m_out, m_res))))))
+        return ResidualParams(
+            mult_out=int(round(m_out * (1 << shift))),
+            mult_res=int(round(m_res * (1 << shift))),
+            zp_out=zp_out, zp_res=zp_res, zp_sum=zp_sum, shift=shift,
+        )
+
+    def pack(self) -> bytes:
+        return struct.pack(self.FORMAT, self.mult_out, self.mult_res, self.zp_out, self.zp_res, self.zp_sum, self.shift)
+
+
 @dataclass
 class TaskMessage:
-    FORMAT = '<BIIIIIIIBBBHIII'
+    FORMAT = '<BIIIIIIIBBBHIIIIIIBBBB'
     SIZE = struct.calcsize(FORMAT)
     
     layer_type: LayerType
@@ -107,28 +240,53 @@ class TaskMessage:
     # But really???
     input_size: int 
 
+    # slice of the layer: out_channels channels starting at out_ch_start
+    out_ch_start: int = 0
+    # origin of the out_h x out_w tile in the layer output
+    out_row_start: int = 0
+    out_col_start: int = 0
+    # BLOCK tasks run num_layers layers starting at layer_idx
+    num_layers: int = 1
+    flags: int = 0 # TASK_FLAG_*
+    kernel_variant: int = KERNEL_VARIANT_AUTO # KernelVariant of single layer tasks, the worker's pick when AUTO
+    # fc tasks of a micro-batch: batch input vectors one after another, class-major output [oc][batch]
+    batch: int = 1
+    # appended after the message when flags has TASK_FLAG_RESIDUAL
+    residual: Optional[ResidualParams] = None
+    # appended after that when flags has TASK_FLAG_ACTIVATION: (act_min, act_max) of each of the num_layers layers
+    activations: Optional[list[tuple[int, int]]] = None
+    # pack() of a message compiled into an execution plan, sent as is on every inference
+    packed: Optional[bytes] = field(default=None, repr=False, compare=False)
+
     def pack(self) -> bytes:
         data = struct.pack('<BI', self.layer_type, self.layer_idx)
         data += struct.pack('<IIIIII', self.in_channels, self.in_h, self.in_w, self.out_channels, self.out_h, self.out_w)
         data += struct.pack('<BBBH', self.kernel_size, self.stride, self.padding, self.groups)
         data += struct.pack('<III', self.in_features, self.out_features, self.input_size)
+        data += struct.pack('<III', self.out_ch_start, self.out_row_start, self.out_col_start)
+        data += struct.pack('<BBBB', self.num_layers, self.flags, self.kernel_variant, self.batch)
+        if self.flags & TASK_FLAG_RESIDUAL:
+            data += self.residual.pack()
+        if self.flags & TASK_FLAG_ACTIVATION:
+            data += bytes(v for act in self.activations for v in act)
         return data
 
 
 @dataclass
 class ResultMessage:
-    FORMAT = '<II'
+    FORMAT = '<IIBB'
     SIZE = struct.calcsize(FORMAT)
     
-    compute_time_us: int
+    compute_time_us: int # 0 with RESULT_FLAG_STREAMED, sent after the output instead
     output_size: int # in bytes
+    kernel_variant: int = KERNEL_VARIANT_AUTO # KernelVariant the worker ran, AUTO for block tasks
+    flags: int = 0 # RESULT_FLAG_*
 
     @staticmethod
     def unpack(data: bytes) -> 'ResultMessage':
         if len(data) < ResultMessage.SIZE:
             raise ValueError("Insufficient data for ResultMessage")
-        compute_time_us, output_size = struct.unpack(ResultMessage.FORMAT, data[:ResultMessage.SIZE])
-        return ResultMessage(compute_time_us, output_size)
+        return ResultMessage(*struct.unpack(ResultMessage.FORMAT, data[:ResultMessage.SIZE]))
 
 
 
@@ -0,0 +1,44 @@
+import logging
+from collections import deque
+from typing import Optional
+import numpy as np
+
+logger = logging.getLogger(__name__)
+
+
+class LatencyTracker:
+    """ per-worker distribution of task latencies, relative to what the partitioner predicted for them
+
+    A task's latency is the time from when its worker could start on it to when its result header arrived.
+    Dividing it by the prediction makes one distribution cover tasks of every size: a worker on a flaky
+    link or throttled by heat shows up as a long tail of ratios. A task still running past the `quantile`
+    of its worker's ratios times its prediction, by more than `margin` (relative) and `slack_ms` (absolute),
+    is a straggler worth reissuing. A worker with fewer than `min_samples` tasks behind it has no deadline yet:
+    the first predictions of a fresh partitioner can be off by more than any fixed ratio.
+    """
+    def __init__(self, window: int = 128, quantile: float = 95, margin: float = 1.5, slack_ms: float = 20.0,
+                 min_samples: int = 8):
+        self.window = window
+        self.quantile = quantile
+        self.margin = margin
+        self.slack_ms = slack_ms
+        self.min_samples = min_samples
+        self.ratios: dict[int, deque[float]] = {} # worker_id -> latency / predicted of its last tasks
+
+    def record(self, worker_id: int, predicted_ms: float, latency_ms: float):
+        if predicted_ms <= 0:
+            return
+        self.ratios.setdefault(worker_id, deque(maxlen=self.window)).append(latency_ms / predicted_ms)
+
+    def expected_ratio(self, worker_id: int) -> Optional[float]:
+        ratios = self.ratios.get(worker_id)
+        if ratios is None or len(ratios) < self.min_samples:
+            return None
+        return float(np.percentile(ratios, self.quantile))
+
+    def deadline_ms(self, worker_id: int, predicted_ms: float) -> Optional[float]:
+        """ how long a task of this prediction may run on the worker before it counts as a straggler, None if unknown """
+        ratio = self.expected_ratio(worker_id)
+        if ratio is None or predicted_ms <= 0:
+            return None
+        return predicted_ms * ratio * self.margin + self.slack_ms
@@ -1,26 +1,84 @@
-# import asyncio
-# import logging
-# from typing import Optional
-# from dataclasses import dataclass
-# from .protocol import *
-# from .work_manager import *
+import logging
+from collections import deque
+from dataclasses import dataclass
+from typing import Optional
+import numpy as np
+from .protocol import *
+from .work_manager import *
 
-# logger = logging.getLogger(__name__)
+logger = logging.getLogger(__name__)
 
 
-# @dataclass
-# class Task:
-#     pass
+@dataclass
+class Task:
+    """ one slice of a layer assigned to a single worker """
+    task_id: int
+    worker: WorkerInfo
+    msg: TaskMessage
+    payload: np.ndarray
+    start_idx: int # output slice [start_idx, end_idx), rows for conv and classes for fc
+    end_idx: int
+    ch_start: int = 0 # output channel slice [ch_start, ch_end) for conv, None means all channels
+    ch_end: Optional[int] = None
+    col_start: int = 0 # output column slice [col_start, col_end) of a 2D tile, None means all columns
+    col_end: Optional[int] = None
+    pooled: bool = False # the worker pools its tile, the layer output is one value per channel
+    predicted_ms: float = 0.0 # by the partitioner, see Coordinator._predict_ms
+    started_at: Optional[float] = None # perf_counter when the worker could start on it: sent, or its predecessor done
+    # a straggling task is reissued to an idle worker as a speculative copy of the same slice; the first of
+    # the two results to arrive claims the slice and lands in the layer output, the other is cancelled
+    original: Optional['Task'] = None # on the copy
+    backup: Optional['Task'] = None # on the original
+    claimed_by: Optional['Task'] = None # on the original, the copy whose result landed
+    landed: bool = False # on the original, its slice of the layer output is complete
+    cancelled: bool = False # sent a CANCEL, the other copy claimed the slice
+    retries: int = 0 # on the original, how often the slice went to another worker after one failed
 
+    def slice_owner(self) -> 'Task':
+        """ the task holding the claim of this task's slice """
+        return self.original or self
 
-# class TaskQueue:
-#     def __init__(self):
-#         self.queue = []
+    def output_view(self, output: np.ndarray) -> np.ndarray:
+        """ the part of the layer output this task's channels (and columns) land in """
+        if self.ch_end is None:
+            return output
+        view = output[self.ch_start:self.ch_end]
+        if self.pooled:
+            return view
+        return view[:, :, self.col_start:self.col_end] if self.col_end is not None else view
 
-#     async def get_task(self) -> Optional[Task]:
-#         pass
 
-#     async def add_task(self, task: Task):
-#         pass 
+class TaskQueue:
+    """ per-worker FIFO keeping at most `window` tasks in flight
 
-    
\ No newline at end of file
+    The worker processes tasks in the order they arrive on its socket, so the
+    results come back in the same order and the head of `in_flight` is always
+    the next result we expect.
+    """
+    def __init__(self, window: int = 1):
+        self.window = max(1, window)
+        self.pending: deque[Task] = deque()
+        self.in_flight: deque[Task] = deque()
+
+    def add_task(self, task: Task):
+        self.pending.append(task)
+
+    def can_send(self) -> bool:
+        return bool(self.pending) and len(self.in_flight) < self.window
+
+    def next_to_send(self) -> Task:
+        task = self.pending.popleft()
+        self.in_flight.append(task)
+        return task
+
+    def head(self) -> Optional[Task]:
+        return self.in_flight[0] if self.in_flight else None
+
+    def complete(self, task_id: int) -> Task:
+        task = self.in_flight.popleft()
+        if task.task_id != task_id:
+            raise RuntimeError(f"Out of order result: expected task {task.task_id}, got {task_id}")
+        return task
+
+    def empty(self) -> bool:
+        return not self.pending and not self.in_flight
@@ -1,7 +1,9 @@
 import asyncio
 import logging
+from collections import deque
 from enum import Enum
-from dataclasses import dataclass
+from typing import Optional, Union
+from dataclasses import dataclass, field
 from .protocol import *
 # from .task_queue import *
 
@@ -19,9 +21,157 @@ class WorkerState(IntEnum):
 class WorkerInfo:
     worker_id: int
     clock_mhz: int
-    reader: asyncio.StreamReader
-    writer: asyncio.StreamWriter
+    reader: Union['WorkerConnection', asyncio.StreamReader]
+    writer: Union['WorkerConnection', asyncio.StreamWriter]
     state: WorkerState = WorkerState.DISCONNECTED
+    # capabilities advertised at registration, see RegisterMessage; the defaults are a Teensy 4.1 worker's
+    protocol_version: int = PROTOCOL_VERSION
+    input_buffer_size: int = 350 * 1024
+    output_buffer_size: int = 350 * 1024
+    scratch_size: int = 64 * 1024
+    task_types: int = sum(1 << t for t in (LayerType.CONV, LayerType.DEPTHWISE, LayerType.FC, LayerType.BLOCK))
+    task_flags: int = TASK_FLAG_RESIDUAL | TASK_FLAG_GAP | TASK_FLAG_GAP_MEAN | TASK_FLAG_ACTIVATION | TASK_FLAG_HWC
+    model_hash: int = 0
+    bench_score: int = 0
+    # layer_idx -> output channels [start, end) of the layers the worker holds only part of, the rest are held whole
+    weight_shards: dict[int, tuple[int, int]] = field(default_factory=dict)
+    # layer_idx -> kernel variant -> MACs per ms timed at boot, empty if the worker wasn't built with BOOT_BENCH
+    kernel_benches: dict[int, dict[KernelVariant, int]] = field(default_factory=dict)
+
+    def can_run(self, task_type: LayerType, flags: int = 0) -> bool:
+        return bool(self.task_types & (1 << task_type)) and (self.task_flags & flags) == flags
+
+    def layer_bench(self, layer_idx: int) -> int:
+        """ MACs per ms of the layer's fastest kernel variant at boot, 0 if it wasn't timed """
+        return max(self.kernel_benches.get(layer_idx, {}).values(), default=0)
+
+class WorkerConnection(asyncio.BufferedProtocol):
+    """ a worker's TCP connection, both the reader and the writer of its WorkerInfo
+
+    Reads hand the socket the caller's buffers: receive_into has an output received straight into its place in the
+    layer buffer, without a bytes object in between. Bytes arriving while nothing is being read wait in a small
+    buffer of the connection's own; reading pauses when it is full.
+    """
+    def __init__(self, on_connected=None, limit: int = 64 * 1024):
+        self.on_connected = on_connected # coroutine function (reader, writer), like asyncio.start_server's callback
+        self.transport: Optional[asyncio.Transport] = None
+        self.handler: Optional[asyncio.Task] = None
+        self._pending = bytearray(limit)
+        self._head = 0 # unread bytes are _pending[_head:_tail]
+        self._tail = 0
+        self._paused = False
+        self._eof = False
+        self._views: deque = deque() # being filled by the socket
+        self._filled: Optional[asyncio.Future] = None
+        self._closed = asyncio.get_running_loop().create_future()
+
+    # asyncio.BufferedProtocol
+
+    def connection_made(self, transport: asyncio.Transport):
+        self.transport = transport
+        if self.on_connected is not None:
+            self.handler = asyncio.get_running_loop().create_task(self.on_connected(self, self))
+
+    def get_buffer(self, sizehint: int) -> memoryview:
+        if self._views:
+            return self._views[0]
+        if self._tail == len(self._pending):
+            self._compact()
+        return memoryview(self._pending)[self._tail:]
+
+    def buffer_updated(self, nbytes: int):
+        if not self._views:
+            self._tail += nbytes
+            if self._tail == len(self._pending) and self._head == 0:
+                self.transport.pause_reading()
+                self._paused = True
+            return
+        view = self._views.popleft()
+        if nbytes < len(view):
+            self._views.appendleft(view[nbytes:])
+        elif not self._views and not self._filled.done():
+            self._filled.set_result(None)
+
+    def eof_received(self):
+        self._eof = True
+        self._fail(asyncio.IncompleteReadError(b'', None))
+        return False
+
+    def connection_lost(self, exc):
+        self._eof = True
+        self._fail(exc or asyncio.IncompleteReadError(b'', None))
+        if not self._closed.done():
+            self._closed.set_result(None)
+
+    # reader
+
+    async def receive_into(self, views: deque, timeout=None):
+        """ fill `views` in order: first from the bytes already here, then straight from the socket """
+        while views and self._head < self._tail:
+            view = views[0]
+            n = min(len(view), self._tail - self._head)
+            view[:n] = memoryview(self._pending)[self._head:self._head + n]
+            self._head += n
+            if n < len(view):
+                views[0] = view[n:]
+            else:
+                views.popleft()
+        if self._head == self._tail:
+            self._head = self._tail = 0
+        if self._paused and self._tail - self._head < len(self._pending):
+            self._paused = False
+            self.transport.resume_reading()
+        if not views:
+            return
+        if self._eof:
+            raise asyncio.IncompleteReadError(b'', None)
+        if self._filled is not None and not self._filled.done():
+            raise RuntimeError("receive_into while another read is running on the connection")
+
+        self._views = views
+        self._filled = asyncio.get_running_loop().create_future()
+        try:
+            await asyncio.wait_for(self._filled, timeout=timeout)
+        finally:
+            self._views = deque()
+
+    async def readexactly(self, n: int) -> bytes:
+        data = bytearray(n)
+        await self.receive_into(deque([memoryview(data)]))
+        return bytes(data)
+
+    def at_eof(self) -> bool:
+        return self._eof and self._head == self._tail
+
+    # writer
+
+    def writelines(self, buffers: list):
+        self.transport.writelines(buffers)
+
+    def get_extra_info(self, name: str, default=None):
+        return self.transport.get_extra_info(name, default)
+
+    def close(self):
+        self.transport.close()
+
+    async def wait_closed(self):
+        await asyncio.shield(self._closed)
+
+    def _compact(self):
+        unread = self._tail - self._head
+        self._pending[:unread] = self._pending[self._head:self._tail]
+        self._head, self._tail = 0, unread
+
+    def _fail(self, exc: BaseException):
+        if self._filled is not None and not self._filled.done():
+            self._filled.set_exception(exc)
+
+
+async def start_worker_server(client_connected_cb, host: str, port: int) -> asyncio.AbstractServer:
+    """ asyncio.start_server for workers: client_connected_cb gets the WorkerConnection as reader and writer """
+    loop = asyncio.get_running_loop()
+    return await loop.create_server(lambda: WorkerConnection(client_connected_cb), host, port)
+
 
 class WorkerManager:
     def __init__(self):
@@ -31,30 +181,33 @@ class WorkerManager:
         # idle worker queue
         self.idle_queue: asyncio.Queue[WorkerInfo] = asyncio.Queue()
 
-    def add_worker(self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter) -> WorkerInfo:
+    def add_worker(self, reader: WorkerConnection, writer: WorkerConnection) -> WorkerInfo:
+        """ a new connection, under a provisional id until it registers; it gets tasks once admitted """
         logger.info(f"[WorkerManager]: Adding new worker from {writer.get_extra_info('peername')}")
         worker_id = self.next_worker_id
         self.next_worker_id += 1
-        worker = WorkerInfo(worker_id=worker_id, clock_mhz=0, reader=reader, writer=writer, state=WorkerState.CONNECTED)
-        self.workers[worker_id] = worker
-        return worker
+        return WorkerInfo(worker_id=worker_id, clock_mhz=0, reader=reader, writer=writer, state=WorkerState.CONNECTED)
+
+    def admit(self, worker: WorkerInfo):
+        self.workers[worker.worker_id] = worker
 
     def remove_worker(self, worker: WorkerInfo):
-        if worker.worker_id in self.workers:
-            try:
-                worker.writer.close()
-                asyncio.create_task(worker.writer.wait_closed())
-            except Exception as e:
-                logger.error(f"[WorkerManager]: Error closing connection for worker {worker.worker_id}: {e}")
-            
+        """ close the worker's connection and drop it from the pool, unless another connection took its id """
+        try:
+            worker.writer.close()
+            asyncio.create_task(worker.writer.wait_closed())
+        except Exception as e:
+            logger.error(f"[WorkerManager]: Error closing connection for worker {worker.worker_id}: {e}")
+        if self.workers.get(worker.worker_id) is worker:
             del self.workers[worker.worker_id]
 
-    async def send_message(self, worker: WorkerInfo, msg_type: MessageType, payload: bytes):
+    async def send_message(self, worker: WorkerInfo, msg_type: MessageType, payload: Union[bytes, list], task_id: int = 0):
+        """ payload is one buffer or a list of buffers sent back to back, e.g. the message and views of a tensor """
         try:
-            header = MessageHeader(type=msg_type, worker_id=worker.worker_id, payload_len=len(payload))
-            worker.writer.write(header.pack())
-            if payload:
-                worker.writer.write(payload)
+            buffers = payload if isinstance(payload, list) else [payload]
+            payload_len = sum(memoryview(buffer).nbytes for buffer in buffers)
+            header = MessageHeader(type=msg_type, worker_id=worker.worker_id, payload_len=payload_len, task_id=task_id)
+            worker.writer.writelines([header.pack(), *buffers])
             # await worker.writer.drain() #TODO further check if we really need to await drain here, i dont think so right now cuz we have error message back from MCU
             
             return True
@@ -86,6 +239,24 @@ class WorkerManager:
             worker.state = WorkerState.DISCONNECTED
             return None
         
+    async def receive_into(self, worker: WorkerInfo, buffers: Union[memoryview, list], timeout=None):
+        """ read exactly the size of buffers (one view or a list of views filled in order) from the worker
+
+        Over a WorkerConnection the socket receives into the views. Any other reader, e.g. a StreamReader fed by a
+        test, is read with readexactly and copied.
+        """
+        views = deque(view for view in (memoryview(b).cast('B') for b in (buffers if isinstance(buffers, list) else [buffers]))
+                      if view.nbytes)
+        reader = worker.reader
+        if isinstance(reader, WorkerConnection):
+            await reader.receive_into(views, timeout=timeout)
+            return
+
+        async def fill():
+            for view in views:
+                view[:] = await reader.readexactly(len(view))
+        await asyncio.wait_for(fill(), timeout=timeout)
+
     def mark_worker_idle(self, worker: WorkerInfo):
         if worker.state != WorkerState.IDLE:
             worker.state = WorkerState.IDLE
@@ -1,5 +1,6 @@
 import asyncio
 import json
+import socket
 import struct
 import tempfile
 import unittest
@@ -9,15 +10,21 @@ from unittest.mock import AsyncMock, MagicMock
 
 import numpy as np
 
-from src.coordniator import Coordinator, LayerConfig, QuantParams
-from src.protocol import LayerType, MessageType, MessageHeader, ResultMessage
-from src.work_manager import WorkerState
+from src.coordniator import Coordinator, KernelPolicy, LayerConfig, QuantParams, WorkerErrorReply, WorkerLinkError
+from src.pipeline import LayerPipeline
+from src.planner import PartitionStrategy
+from src.straggler import LatencyTracker
+from src.task_queue import TaskQueue
+from src.protocol import (Activation, ErrorCode, ErrorMessage, KernelVariant, LayerType, MessageType, MessageHeader, RegisterMessage, ResidualParams, ResultMessage, TaskMessage,
+                          KERNEL_VARIANT_AUTO, PROTOCOL_VERSION, RESULT_FLAG_CANCELLED, RESULT_FLAG_STREAMED, TASK_FLAG_ACTIVATION, TASK_FLAG_GAP, TASK_FLAG_GAP_MEAN, TASK_FLAG_HWC,
+                          TASK_FLAG_RESIDUAL)
+from src.work_manager import WorkerConnection, WorkerInfo, WorkerState
 
 
 def _make_worker(worker_id: int):
     reader = AsyncMock()
     writer = MagicMock()
-    return SimpleNamespace(
+    return WorkerInfo(
         worker_id=worker_id,
         clock_mhz=600,
         reader=reader,
@@ -26,13 +33,20 @@ def _make_worker(worker_id: int):
     )
 
 
+def _make_qp(s_in=0.1, z_in=128, s_out=0.2, z_out=120, **kw):
+    return QuantParams(s_in=s_in, z_in=z_in, s_w=np.array([0.1], dtype=np.float32), z_w=np.array([0], dtype=np.int32),
+                       s_out=s_out, z_out=z_out, m=np.array([0.05], dtype=np.float32), **kw)
+
+
+def _make_coordinator(num_workers: int = 2, **kw):
+    c = Coordinator(host="127.0.0.1", port=54321, **kw)
+    c.worker_manager.workers = {i: _make_worker(i) for i in range(num_workers)}
+    return c
+
+
 class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
     async def asyncSetUp(self):
-        self.coordinator = Coordinator(host="127.0.0.1", port=54321)
-        self.coordinator.worker_manager.workers = {
-            0: _make_worker(0),
-            1: _make_worker(1),
-        }
+        self.coordinator = _make_coordinator()
 
     async def test_run_layer_fc_applies_gap_and_routes_fc(self):
         c = self.coordinator
@@ -45,13 +59,7 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
             in_channels=4,
             out_channels=10,
         )
-        qp = QuantParams(
-            s_in=0.1, z_in=128,
-            s_w=np.array([0.1], dtype=np.float32),
-            z_w=np.array([0], dtype=np.int32),
-            s_out=0.2, z_out=120,
-            m=np.array([0.05], dtype=np.float32),
-        )
+        qp = _make_qp()
 
         c._distribute_fc = AsyncMock(return_value=None)
         c._distribute_conv = AsyncMock(return_value=None)
@@ -63,6 +71,205 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
         c._distribute_fc.assert_awaited_once()
         c._distribute_conv.assert_not_called()
 
+    async def test_execute_inference_compiles_the_plan_once(self):
+        c = self.coordinator
+        c.model_hash = 0 # already parsed
+        c.layer_config_list = [
+            LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=4, kernel_size=3, stride=2, padding=1),
+            LayerConfig(name="dw", type=LayerType.DEPTHWISE, layer_idx=1, in_channels=4, out_channels=4, kernel_size=3, padding=1, groups=4),
+            LayerConfig(name="fc", type=LayerType.FC, layer_idx=2, in_channels=4, out_channels=6),
+        ]
+        c.quant_params_list = [_make_qp(z_in=10), _make_qp(z_in=120), _make_qp(z_in=120)]
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((msg, patch.copy())))
+        async def fake_receive(worker, start, end, output, task_id):
+            if output.ndim == 3:
+                output[:, start:end, :] = 120
+            elif output.dtype == np.uint32:
+                output += 120 * 16
+            else:
+                output[start:end] = 7
+        c._receive_worker_result = fake_receive
+        compile_plan = c._compile_plan
+        c._compile_plan = MagicMock(side_effect=compile_plan)
+
+        image = np.zeros((3, 8, 8), dtype=np.float32)
+        first = await c.execute_inference(image)
+        first_msgs = [msg for msg, _ in sent]
+        sent.clear()
+        second = await c.execute_inference(image)
+
+        c._compile_plan.assert_called_once()
+        np.testing.assert_array_equal(first, [7] * 6)
+        np.testing.assert_array_equal(second, first)
+        # the same compiled messages go out, on the new input
+        self.assertEqual([id(msg) for msg, _ in sent], [id(msg) for msg in first_msgs])
+        self.assertTrue(all(msg.packed == msg.pack() for msg in first_msgs))
+        conv_patch = next(patch for msg, patch in sent if msg.layer_idx == 0)
+        self.assertEqual(conv_patch[0, 0, 0], 10, "the first layer's padding is its zero point")
+        self.assertEqual(conv_patch[0, 1, 1], 10, "a zero image quantizes to the zero point too")
+
+        # a worker leaving changes the plan
+        del c.worker_manager.workers[1]
+        sent.clear()
+        await c.execute_inference(image)
+        self.assertEqual(c._compile_plan.call_count, 2)
+        self.assertFalse({id(msg) for msg, _ in sent} & {id(msg) for msg in first_msgs})
+
+    async def test_workers_join_and_leave_at_layer_boundaries(self):
+        c = self.coordinator
+        c.model_hash = 0xCAFE
+        for worker in c.worker_manager.workers.values():
+            worker.model_hash = 0xCAFE
+        c.layer_config_list = [
+            LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=4, kernel_size=3, stride=2, padding=1),
+            LayerConfig(name="dw", type=LayerType.DEPTHWISE, layer_idx=1, in_channels=4, out_channels=4, kernel_size=3, padding=1, groups=4),
+            LayerConfig(name="fc", type=LayerType.FC, layer_idx=2, in_channels=4, out_channels=6),
+        ]
+        c.quant_params_list = [_make_qp(z_in=10), _make_qp(z_in=120), _make_qp(z_in=120)]
+        c.worker_manager.send_message = AsyncMock(return_value=True)
+
+        async def register(worker_id: int, model_hash: int):
+            payload = struct.pack(RegisterMessage.FORMAT, 600, PROTOCOL_VERSION, 350 * 1024, 350 * 1024, 64 * 1024,
+                                  0x36, 0x1F, model_hash, 0, 0, 0)
+            header = MessageHeader(type=MessageType.REGISTER, worker_id=worker_id, payload_len=len(payload))
+            c.worker_manager.receive_message = AsyncMock(return_value=(header, payload))
+            writer = MagicMock()
+            writer.wait_closed = AsyncMock()
+            await c.on_client_connected(AsyncMock(), writer)
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((msg.layer_idx, w.worker_id)))
+        async def fake_receive(worker, start, end, output, task_id):
+            if output.ndim == 3:
+                output[:, start:end, :] = 120
+            elif output.dtype == np.uint32:
+                output += 120 * 16
+            else:
+                output[start:end] = 7
+            if c.current_layer_idx == 0 and worker.worker_id == 0:
+                # mid-stream: two boards register, one of them flashed with another model, and worker 1 is retired
+                await register(2, 0xCAFE)
+                await register(3, 0xBEEF)
+                c.retire_worker(1)
+        c._receive_worker_result = fake_receive
+
+        # registered, but not given tasks before the next layer boundary
+        output = await c.execute_inference(np.zeros((3, 8, 8), dtype=np.float32))
+        np.testing.assert_array_equal(output, [7] * 6)
+        workers_of = lambda layer_idx: {worker_id for idx, worker_id in sent if idx == layer_idx}
+        self.assertEqual(workers_of(0), {0, 1})
+        self.assertEqual(workers_of(1), {0, 2})
+        self.assertEqual(workers_of(2), {0, 2})
+        self.assertEqual(sorted(c.worker_manager.workers), [0, 2])
+        self.assertEqual(c.joining, {})
+
+        # the retired worker is shut down once drained, shutdown_workers waits for that before the others
+        await c.shutdown_workers()
+        shutdowns = [call.args[0].worker_id for call in c.worker_manager.send_message.await_args_list
+                     if call.args[1] == MessageType.SHUTDOWN]
+        self.assertEqual(shutdowns, [1, 0, 2])
+        self.assertEqual(c.retiring, set())
+
+    async def test_pipeline_streams_images_through_balanced_stages(self):
+        c = _make_coordinator(4)
+        c.model_hash = 0
+        c.worker_gap = False
+        c.layer_config_list = [
+            LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=8, kernel_size=3, padding=1),
+            LayerConfig(name="pw1", type=LayerType.CONV, layer_idx=1, in_channels=8, out_channels=8, kernel_size=1),
+            LayerConfig(name="dw", type=LayerType.DEPTHWISE, layer_idx=2, in_channels=8, out_channels=8, kernel_size=3, padding=1, groups=8),
+            LayerConfig(name="pw3", type=LayerType.CONV, layer_idx=3, in_channels=8, out_channels=8, kernel_size=1),
+            LayerConfig(name="fc", type=LayerType.FC, layer_idx=4, in_channels=8, out_channels=6),
+        ]
+        c.quant_params_list = [_make_qp(z_in=0, s_out=0.1, z_out=0) for _ in c.layer_config_list]
+
+        # every layer passes the (constant) value of its input on, so each output tells which image it came from
+        inputs = {}
+        def fake_send(worker, msg, patch, task_id):
+            inputs[worker.worker_id, task_id] = int(patch.max())
+        async def fake_receive(worker, start, end, output, task_id):
+            await asyncio.sleep(0) # let the other stages run meanwhile
+            output[...] = inputs.pop((worker.worker_id, task_id))
+        c._send_task_to_worker = AsyncMock(side_effect=fake_send)
+        c._receive_worker_result = fake_receive
+
+        images = [np.full((3, 8, 8), 0.5 * i, dtype=np.float32) for i in range(7)]
+        outputs, stats = await c.execute_pipelined(images, num_stages=2)
+
+        for i, output in enumerate(outputs):
+            np.testing.assert_array_equal(output, [5 * i] * 6, err_msg=f"image {i}")
+        self.assertEqual(stats["images"], 7)
+        # the stages' padded layer buffers live and die with their runners
+        self.assertEqual(c.padded_outputs, {})
+        self.assertGreater(stats["throughput_ips"], 0)
+        self.assertLessEqual(stats["latency_p50_ms"], stats["latency_p99_ms"])
+        stages = stats["stages"]
+        self.assertEqual(len(stages), 2)
+        self.assertEqual([s["layers"] for s in stages], [(0, stages[1]["layers"][0]), (stages[0]["layers"][1], 5)])
+        self.assertEqual(sorted(w for s in stages for w in s["workers"]), [0, 1, 2, 3])
+        # two groups each waiting on their own layers beat all workers waiting on every layer
+        whole = LayerPipeline(c, 1).plan_stages(images[0].shape)[0]
+        self.assertLess(max(s["predicted_ms"] for s in stages), whole.predicted_ms)
+
+        # a stage never starts inside a residual connection
+        c.layer_config_list[1].residual_add_to = "r"
+        c.layer_config_list[3].residual_connect_from = "r"
+        firsts = [s.first_layer for s in LayerPipeline(c, 4).plan_stages(images[0].shape)]
+        self.assertFalse({2, 3} & set(firsts))
+
+    async def test_execute_batch_matches_images_one_by_one(self):
+        c = self.coordinator
+        c.model_hash = 0
+        c.worker_gap = False
+        for worker in c.worker_manager.workers.values():
+            worker.output_buffer_size = 13 # two images of classifier output
+        c.layer_config_list = [
+            LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=3, kernel_size=3, padding=1),
+            LayerConfig(name="pw1", type=LayerType.CONV, layer_idx=1, in_channels=3, out_channels=3, kernel_size=1, residual_add_to="r"),
+            LayerConfig(name="pw2", type=LayerType.CONV, layer_idx=2, in_channels=3, out_channels=3, kernel_size=1, residual_connect_from="r"),
+            LayerConfig(name="fc", type=LayerType.FC, layer_idx=3, in_channels=3, out_channels=6),
+        ]
+        c.quant_params_list = [_make_qp(z_in=3, s_out=0.1, z_out=3, s_residual_out=0.2, z_residual_out=5) for _ in c.layer_config_list]
+
+        # fake kernels: convs add one to the window centre, the classifier mixes each vector with the class index
+        sent, inputs = [], {}
+        def fake_send(worker, msg, patch, task_id):
+            sent.append(msg)
+            inputs[worker.worker_id, task_id] = (msg, patch.copy())
+        async def fake_receive(worker, start, end, output, task_id):
+            msg, patch = inputs.pop((worker.worker_id, task_id))
+            if msg.layer_type == LayerType.FC:
+                vectors = patch.reshape(msg.batch, msg.in_features).astype(np.int32)
+                classes = np.arange(start, end)[:, None]
+                out = (vectors[:, 0] * 7 + vectors[:, 2] + classes) % 256
+                output[start:end] = out if output.ndim == 2 else out[:, 0]
+            else:
+                p = msg.kernel_size // 2
+                centre = patch[msg.out_ch_start:msg.out_ch_start + msg.out_channels, p:patch.shape[1] - p, p:patch.shape[2] - p]
+                output[:, start:end, :] = centre + 1
+        c._send_task_to_worker = AsyncMock(side_effect=fake_send)
+        c._receive_worker_result = fake_receive
+
+        rng = np.random.default_rng(0)
+        images = [rng.uniform(0, 20, size=(3, 6, 6)).astype(np.float32) for _ in range(5)]
+        one_by_one = [await c.execute_inference(image) for image in images]
+        sent.clear()
+        batched = await c.execute_batch(images)
+
+        for i in range(5):
+            np.testing.assert_array_equal(batched[i], one_by_one[i], err_msg=f"image {i}")
+        self.assertGreater(len({tuple(o) for o in one_by_one}), 1, "the images must tell apart")
+        # micro-batches of two as the output buffers allow; the classifier and the 1x1 convs run once per micro-batch
+        fc_msgs = [msg for msg in sent if msg.layer_type == LayerType.FC]
+        self.assertEqual(sorted({msg.batch for msg in fc_msgs}), [1, 2])
+        self.assertEqual(len(fc_msgs), 3 * 2, "one task per worker per micro-batch")
+        self.assertTrue(all(msg.input_size == msg.batch * 3 for msg in fc_msgs))
+        pw_rows = sum(msg.out_h for msg in sent if msg.layer_idx == 1)
+        self.assertEqual(pw_rows, 5 * 6)
+        self.assertEqual(len([msg for msg in sent if msg.layer_idx == 1]), 3 * 2, "stacked rows, one task per worker")
+
     async def test_distribute_conv_dispatches_rows_when_padding_positive(self):
         c = self.coordinator
         c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
@@ -78,13 +285,7 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
             padding=1,
             groups=1,
         )
-        qp = QuantParams(
-            s_in=0.1, z_in=128,
-            s_w=np.array([0.1], dtype=np.float32),
-            z_w=np.array([0], dtype=np.int32),
-            s_out=0.2, z_out=120,
-            m=np.array([0.05], dtype=np.float32),
-        )
+        qp = _make_qp()
 
         c._send_task_to_worker = AsyncMock(return_value=True)
         c._collect_results = AsyncMock(
@@ -108,6 +309,653 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
         # H_out = 4
         self.assertEqual(covered_rows, {0, 1, 2, 3}, "分片应覆盖全部输出行")
 
+    async def test_distribute_conv_keeps_window_of_tasks_per_worker(self):
+        c = _make_coordinator(window_size=2, slices_per_worker=3)
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 12, 4), dtype=np.uint8)
+
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append(task_id))
+        received = []
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # at most `window_size` tasks may be outstanding on this worker
+            self.assertLessEqual(len(c.task_queues[worker.worker_id].in_flight), 2)
+            received.append(task_id)
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        # 12 rows over 2 workers, 3 tasks each; every task sent and received exactly once
+        self.assertEqual(len(sent), 6)
+        self.assertEqual(sorted(sent), sorted(received))
+        self.assertTrue(all(q.empty() for q in c.task_queues.values()))
+
+    async def test_straggling_slice_is_reissued_and_the_late_copy_cancelled(self):
+        c = _make_coordinator(adaptive_partition=False)
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+        # both workers so far answered exactly as predicted
+        c.latency = LatencyTracker(slack_ms=0.0)
+        for worker_id in (0, 1):
+            for _ in range(c.latency.min_samples):
+                c.latency.record(worker_id, 1.0, 1.0)
+
+        layer = LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=8, kernel_size=1)
+        qp = _make_qp()
+
+        sent = {0: asyncio.Queue(), 1: asyncio.Queue()}
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent[w.worker_id].put_nowait(task_id))
+        cancels = []
+        cancelled = asyncio.Event()
+
+        async def send_message(worker, msg_type, payload, task_id=0):
+            self.assertEqual(msg_type, MessageType.CANCEL)
+            cancels.append((worker.worker_id, task_id))
+            cancelled.set()
+
+        async def receive_message(worker, timeout=None):
+            task_id = await sent[worker.worker_id].get()
+            if worker.worker_id == 1:
+                # worker 1 straggles until its task is cancelled
+                await cancelled.wait()
+                payload = struct.pack(ResultMessage.FORMAT, 0, 0, KernelVariant.NATIVE, RESULT_FLAG_CANCELLED)
+            else:
+                task = c.in_flight[worker.worker_id, task_id]
+                rows = np.arange(task.start_idx, task.end_idx, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2)
+                worker.reader.feed_data(rows.tobytes())
+                payload = struct.pack(ResultMessage.FORMAT, 100, rows.size, KernelVariant.NATIVE, 0)
+            return MessageHeader(type=MessageType.RESULT, worker_id=worker.worker_id, payload_len=len(payload), task_id=task_id), payload
+
+        c.worker_manager.send_message = send_message
+        c.worker_manager.receive_message = receive_message
+        for worker in c.worker_manager.workers.values():
+            worker.reader = asyncio.StreamReader()
+
+        await c._distribute_conv(layer, qp)
+
+        # worker 0 computed its rows and then worker 1's, every row landed once
+        np.testing.assert_array_equal(c.feature_map, np.arange(4, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2))
+        self.assertEqual(c.current_layer_stats["speculative"], 1)
+        self.assertEqual(c.current_layer_stats["speculative_wins"], 1)
+        self.assertEqual(len(cancels), 1)
+        self.assertEqual(cancels[0][0], 1)
+        # the cancelled reply is read past, in the background if it is still on its way
+        await asyncio.gather(*c.background_drains.values())
+        self.assertEqual(c.in_flight, {})
+
+    async def test_rejected_task_reruns_without_quarantine(self):
+        c = _make_coordinator(3, window_size=2, slices_per_worker=2, adaptive_partition=False)
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 12, 4), dtype=np.uint8)
+
+        layer = LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=8, kernel_size=1)
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append(w.worker_id))
+        rejected = []
+
+        async def fake_receive(worker, start, end, output, task_id):
+            if worker.worker_id == 1 and not rejected:
+                # an ERROR reply: the worker is reachable, it only couldn't run this task
+                rejected.append(start)
+                raise WorkerErrorReply("error: out of memory")
+            output[:, start:end, :] = start + np.arange(end - start, dtype=np.uint8)[:, None]
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        np.testing.assert_array_equal(c.feature_map, np.arange(12, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2))
+        self.assertEqual(c.quarantined, {})
+        self.assertIn(1, c.worker_manager.workers)
+        self.assertEqual(c.current_layer_stats["retries"], 1)
+        # worker 1 still ran its other slice, the rejected one went elsewhere
+        self.assertEqual(sent.count(1), 2)
+
+    async def test_cancels_reach_a_worker_with_a_queued_task(self):
+        # window 2: the straggler has its next task queued behind the one it is on
+        c = _make_coordinator(window_size=2, slices_per_worker=2, adaptive_partition=False)
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 8, 4), dtype=np.uint8)
+        c.latency = LatencyTracker(slack_ms=0.0)
+        for worker_id in (0, 1):
+            for _ in range(c.latency.min_samples):
+                c.latency.record(worker_id, 1.0, 1.0)
+
+        layer = LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=8, kernel_size=1)
+        qp = _make_qp()
+
+        sent = {0: asyncio.Queue(), 1: asyncio.Queue()}
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent[w.worker_id].put_nowait(task_id))
+        cancels = set()
+        cancel_arrived = asyncio.Event()
+
+        async def send_message(worker, msg_type, payload, task_id=0):
+            self.assertEqual(msg_type, MessageType.CANCEL)
+            cancels.add((worker.worker_id, task_id))
+            cancel_arrived.set()
+
+        async def receive_message(worker, timeout=None):
+            task_id = await sent[worker.worker_id].get()
+            if worker.worker_id == 1:
+                # worker 1 never finishes: like the firmware it sees a cancel behind its queued task and
+                # answers each of its tasks with an empty cancelled result, in order
+                while (1, task_id) not in cancels:
+                    cancel_arrived.clear()
+                    await cancel_arrived.wait()
+                payload = struct.pack(ResultMessage.FORMAT, 0, 0, KernelVariant.NATIVE, RESULT_FLAG_CANCELLED)
+            else:
+                task = c.in_flight[worker.worker_id, task_id]
+                rows = np.arange(task.start_idx, task.end_idx, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2)
+                worker.reader.feed_data(rows.tobytes())
+                payload = struct.pack(ResultMessage.FORMAT, 100, rows.size, KernelVariant.NATIVE, 0)
+            return MessageHeader(type=MessageType.RESULT, worker_id=worker.worker_id, payload_len=len(payload), task_id=task_id), payload
+
+        c.worker_manager.send_message = send_message
+        c.worker_manager.receive_message = receive_message
+        for worker in c.worker_manager.workers.values():
+            worker.reader = asyncio.StreamReader()
+
+        await asyncio.wait_for(c._distribute_conv(layer, qp), timeout=5)
+
+        np.testing.assert_array_equal(c.feature_map, np.arange(8, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2))
+        # both of worker 1's slices were rerun on worker 0 and both of its copies cancelled
+        self.assertEqual(c.current_layer_stats["speculative"], 2)
+        self.assertEqual(c.current_layer_stats["speculative_wins"], 2)
+        self.assertEqual({worker_id for worker_id, _ in cancels}, {1})
+        self.assertEqual(len(cancels), 2)
+        await asyncio.gather(*c.background_drains.values())
+        self.assertEqual(c.in_flight, {})
+        self.assertEqual(c.quarantined, {})
+
+    async def test_cancelled_copy_never_claims_a_reissued_slice(self):
+        c = _make_coordinator(3)
+        for worker in c.worker_manager.workers.values():
+            worker.writer.wait_closed = AsyncMock()
+        c.current_layer_stats = {"workers": {}}
+        c.worker_manager.send_message = AsyncMock(return_value=True)
+        c._enqueue = AsyncMock()
+        w0, w1 = c.worker_manager.workers[0], c.worker_manager.workers[1]
+
+        msg = TaskMessage(layer_type=LayerType.CONV, layer_idx=0, in_channels=3, in_h=4, in_w=3, out_channels=2, out_h=4, out_w=3,
+                          kernel_size=1, stride=1, padding=0, groups=1, in_features=0, out_features=0, input_size=36)
+        output = np.zeros((2, 4, 3), dtype=np.uint8)
+        original = c._new_task(w0, msg, np.zeros((3, 4, 3), dtype=np.uint8), 0, 4)
+        backup = c._copy_task(original, w1)
+        for task in (original, backup):
+            queue = c.task_queues[task.worker.worker_id] = TaskQueue(1)
+            queue.add_task(task)
+            queue.next_to_send()
+            c.in_flight[task.worker.worker_id, task.task_id] = task
+
+        # worker 0 answers first and the copy on worker 1 is cancelled
+        self.assertTrue(await c._claim(original))
+        self.assertTrue(backup.cancelled)
+        # then worker 0's link drops halfway through the output, and the slice is reissued
+        await c._recover(c.task_queues[0], output, w0, ConnectionResetError("link down"))
+        self.assertIsNone(original.claimed_by)
+        c._enqueue.assert_awaited_once()
+
+        # the cancelled reply arrives last, without output: read past, not claimed, worker 1 stays
+        payload = struct.pack(ResultMessage.FORMAT, 0, 0, KernelVariant.NATIVE, RESULT_FLAG_CANCELLED)
+        header = MessageHeader(type=MessageType.RESULT, worker_id=1, payload_len=len(payload), task_id=backup.task_id)
+        c.worker_manager.receive_message = AsyncMock(return_value=(header, payload))
+        w1.reader = asyncio.StreamReader()
+        await c._receive_worker_result(w1, 0, 4, output, backup.task_id)
+        self.assertFalse(await c._claim(backup))
+        self.assertIsNone(original.claimed_by)
+        self.assertEqual(list(c.quarantined), [0])
+
+    async def test_failed_worker_is_quarantined_and_its_slices_rerun(self):
+        c = _make_coordinator(3, window_size=2, slices_per_worker=2, adaptive_partition=False)
+        for worker in c.worker_manager.workers.values():
+            worker.writer.wait_closed = AsyncMock()
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 12, 4), dtype=np.uint8)
+
+        layer = LayerConfig(name="conv", type=LayerType.CONV, layer_idx=0, in_channels=3, out_channels=8, kernel_size=1)
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append(w.worker_id))
+        c.shutdown_workers = AsyncMock()
+
+        async def fake_receive(worker, start, end, output, task_id):
+            if worker.worker_id == 1:
+                raise ConnectionResetError("link down")
+            output[:, start:end, :] = start + np.arange(end - start, dtype=np.uint8)[:, None]
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        # every row landed, worker 1's two slices on the other workers
+        np.testing.assert_array_equal(c.feature_map, np.arange(12, dtype=np.uint8)[None, :, None].repeat(8, 0).repeat(4, 2))
+        self.assertEqual(list(c.quarantined), [1])
+        self.assertNotIn(1, c.worker_manager.workers)
+        self.assertEqual(c.current_layer_stats["retries"], 2)
+        self.assertEqual(sent.count(1), 2)
+        c.shutdown_workers.assert_not_awaited()
+        # the next plan leaves it out
+        self.assertEqual(c._plan_key((3, 12, 4))[2], (0, 2))
+
+    async def test_distribute_conv_channel_split_assembles_output(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.OUT_CHANNELS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+
+        layer = LayerConfig(
+            name="pw", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # every worker computes all rows of its own channels
+            self.assertEqual(output.shape, (4, 4, 4))
+            output[:, start:end, :] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        self.assertEqual(sorted((wid, msg.out_ch_start, msg.out_channels) for wid, msg, _ in sent), [(0, 0, 4), (1, 4, 4)])
+        for _, _, patch in sent:
+            self.assertEqual(patch.shape, (3, 4, 4), "channel split sends the whole input")
+        self.assertTrue((c.feature_map[:4] == 1).all())
+        self.assertTrue((c.feature_map[4:] == 2).all())
+
+    async def test_distribute_conv_follows_weight_shards(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.ROWS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+        workers = c.worker_manager.workers
+        workers[0].weight_shards = {5: (4, 8)}
+        workers[1].weight_shards = {5: (0, 4)}
+
+        layer = LayerConfig(
+            name="pw", type=LayerType.CONV, layer_idx=5,
+            in_channels=3, out_channels=8, kernel_size=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            output[:, start:end, :] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        # rows were asked for, but the sharded weights pin the layer to a channel split
+        self.assertEqual(sorted((wid, msg.out_ch_start, msg.out_channels) for wid, msg, _ in sent), [(0, 4, 4), (1, 0, 4)])
+        self.assertTrue((c.feature_map[:4] == 2).all())
+        self.assertTrue((c.feature_map[4:] == 1).all())
+
+    def test_shard_slices_cover_gaps_with_whole_layer_workers(self):
+        workers = [_make_worker(i) for i in range(3)]
+        workers[0].weight_shards = {7: (0, 10)}
+        workers[1].weight_shards = {7: (5, 20)}
+
+        slices = Coordinator._shard_slices(7, 32, workers)
+        self.assertEqual([(w.worker_id, channels) for w, channels in slices], [(0, (0, 10)), (1, (10, 20)), (2, (20, 32))])
+        self.assertEqual(Coordinator._shard_slices(6, 32, workers), [])
+
+        workers.pop()
+        with self.assertRaises(RuntimeError):
+            Coordinator._shard_slices(7, 32, workers)
+
+    async def test_scheduler_respects_advertised_capabilities(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.ROWS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(8, 16, 16), dtype=np.uint8)
+        workers = c.worker_manager.workers
+        workers[2] = _make_worker(2)
+        c.model_hash = 0x1234
+        workers[0].model_hash = workers[1].model_hash = 0x1234
+        workers[2].model_hash = 0x5678 # flashed with another model
+        workers[1].input_buffer_size = 8 * 3 * 18 # three padded input rows: one output row per task
+        workers[0].output_buffer_size = 8 * 16 # one output row, the worker streams larger tiles in blocks
+
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=8, out_channels=8, kernel_size=3, padding=1,
+        )
+        qp = _make_qp(z_in=0)
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            pass
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        self.assertNotIn(2, {wid for wid, _ in sent})
+        small = [msg for wid, msg in sent if wid == 1]
+        self.assertGreater(len(small), 1)
+        self.assertTrue(all(msg.input_size <= workers[1].input_buffer_size for msg in small))
+        self.assertEqual(sum(msg.out_h for _, msg in sent), 16)
+        self.assertEqual(len([msg for wid, msg in sent if wid == 0]), 1)
+
+        # no room for the block's rolling window: the block runs layer by layer
+        c.layer_config_list = [
+            LayerConfig(name="blk1_exp", type=LayerType.CONV, layer_idx=0, in_channels=8, out_channels=48),
+            LayerConfig(name="blk1_dw", type=LayerType.DEPTHWISE, layer_idx=1, in_channels=48, out_channels=48,
+                        kernel_size=3, padding=1, groups=48),
+            LayerConfig(name="blk1_proj", type=LayerType.CONV, layer_idx=2, in_channels=48, out_channels=8),
+        ]
+        self.assertEqual(c._block_len(0), 3)
+        for worker in workers.values():
+            worker.scratch_size = 1024
+        self.assertEqual(c._block_len(0), 1)
+
+    async def test_registration_turns_away_other_protocol_versions(self):
+        c = self.coordinator
+        c.worker_manager.workers = {}
+        writer = MagicMock()
+        header = MessageHeader(type=MessageType.REGISTER, worker_id=3, payload_len=4)
+        c.worker_manager.receive_message = AsyncMock(return_value=(header, struct.pack('<I', 600))) # unversioned firmware
+        c.worker_manager.send_message = AsyncMock(return_value=True)
+
+        await c.on_client_connected(AsyncMock(), writer)
+
+        _, msg_type, payload = c.worker_manager.send_message.await_args.args
+        self.assertEqual(msg_type, MessageType.REGISTER_ACK)
+        self.assertEqual(payload[0], ErrorCode.ERR_UNSUPPORTED_PROTOCOL)
+        self.assertEqual(c.worker_manager.workers, {})
+
+    def test_register_message_carries_weight_shards(self):
+        payload = (struct.pack(RegisterMessage.FORMAT, 600, PROTOCOL_VERSION, 1024, 2048, 512, 0x36, 0x1F, 0xCAFE, 0, 2, 0)
+                   + struct.pack('<HII', 52, 250, 250) + struct.pack('<HII', 3, 0, 48))
+        reg = RegisterMessage.unpack(payload)
+        self.assertEqual((reg.clock_mhz, reg.input_buffer_size, reg.output_buffer_size, reg.scratch_size), (600, 1024, 2048, 512))
+        self.assertEqual((reg.task_types, reg.task_flags, reg.model_hash), (0x36, 0x1F, 0xCAFE))
+        self.assertEqual([(s.layer_idx, s.oc_start, s.oc_count) for s in reg.weight_shards], [(52, 250, 250), (3, 0, 48)])
+        with self.assertRaises(ValueError):
+            RegisterMessage.unpack(payload[:-1])
+
+    def test_register_message_carries_kernel_benches(self):
+        payload = (struct.pack(RegisterMessage.FORMAT, 600, PROTOCOL_VERSION, 1024, 2048, 512, 0x36, 0x1F, 0xCAFE, 90000, 1, 3)
+                   + struct.pack('<HII', 52, 250, 250)
+                   + struct.pack('<HBI', 0, KernelVariant.NATIVE, 80000) + struct.pack('<HBI', 0, KernelVariant.IM2COL, 120000)
+                   + struct.pack('<HBI', 52, KernelVariant.DSP, 150000))
+        reg = RegisterMessage.unpack(payload)
+        self.assertEqual(len(reg.weight_shards), 1)
+        self.assertEqual([(b.layer_idx, b.variant, b.macs_per_ms) for b in reg.kernel_benches],
+                         [(0, KernelVariant.NATIVE, 80000), (0, KernelVariant.IM2COL, 120000), (52, KernelVariant.DSP, 150000)])
+
+        worker = _make_worker(0)
+        Coordinator._apply_capabilities(worker, reg)
+        self.assertEqual(worker.bench_score, 90000)
+        self.assertEqual(worker.layer_bench(0), 120000)
+        self.assertEqual(worker.layer_bench(1), 0)
+        with self.assertRaises(ValueError):
+            RegisterMessage.unpack(payload[:-1])
+
+    async def test_distribute_depthwise_channel_split_sends_own_channels(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.OUT_CHANNELS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(6, 4, 4), dtype=np.uint8)
+        padded = np.pad(c.feature_map, ((0, 0), (1, 1), (1, 1)), constant_values=128)
+
+        layer = LayerConfig(
+            name="dw", type=LayerType.DEPTHWISE, layer_idx=0,
+            in_channels=6, out_channels=6, kernel_size=3, padding=1, groups=6,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            output[:, start:end, :] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        self.assertEqual(sorted((wid, msg.out_ch_start, msg.out_channels) for wid, msg, _ in sent), [(0, 0, 3), (1, 3, 3)])
+        for _, msg, patch in sent:
+            # only the padded planes of the task's own channels cross the link
+            self.assertEqual(patch.shape, (3, 6, 6))
+            self.assertEqual(msg.in_channels, 3)
+            np.testing.assert_array_equal(patch, padded[msg.out_ch_start:msg.out_ch_start + 3])
+        self.assertTrue((c.feature_map[:3] == 1).all())
+        self.assertTrue((c.feature_map[3:] == 2).all())
+
+    async def test_distribute_conv_tiles_send_column_halo(self):
+        c = _make_coordinator(4)
+        c.partition_strategy = PartitionStrategy.TILES
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(2, 4, 4), dtype=np.uint8)
+        padded = np.pad(c.feature_map, ((0, 0), (1, 1), (1, 1)), constant_values=128)
+
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=2, out_channels=3, kernel_size=3, padding=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # the view only covers the tile's columns
+            self.assertEqual(output.shape, (3, 4, 2))
+            output[:, start:end, :] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        # 2x2 tiles of a 4x4 output, each gets its 2x2 outputs plus one halo row/column on each side
+        self.assertEqual(len(sent), 4)
+        for _, msg, patch in sent:
+            self.assertEqual((msg.out_h, msg.out_w), (2, 2))
+            self.assertEqual(patch.shape, (2, 4, 4))
+            self.assertEqual(msg.in_w, 4)
+            np.testing.assert_array_equal(
+                patch, padded[:, msg.out_row_start:msg.out_row_start + 4, msg.out_col_start:msg.out_col_start + 4])
+        tiles = {(msg.out_row_start, msg.out_col_start): wid + 1 for wid, msg, _ in sent}
+        self.assertEqual(set(tiles), {(0, 0), (0, 2), (2, 0), (2, 2)})
+        for (y, x), value in tiles.items():
+            self.assertTrue((c.feature_map[:, y:y + 2, x:x + 2] == value).all())
+
+    async def test_distribute_conv_tiles_wide_rows_by_column(self):
+        c = _make_coordinator(1)
+        c.partition_strategy = PartitionStrategy.ROWS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(8, 4, 32), dtype=np.uint8)
+        padded = np.pad(c.feature_map, ((0, 0), (1, 1), (1, 1)), constant_values=128)
+        worker = c.worker_manager.workers[0]
+        worker.input_buffer_size = 8 * 3 * 18 # three padded input rows of 16 output columns: one row doesn't fit
+
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=8, out_channels=3, kernel_size=3, padding=1,
+        )
+        qp = _make_qp()
+
+        sent = {}
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.update({task_id: (msg, patch)}))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # the view only covers the tile's columns
+            self.assertEqual(output.shape, (3, 4, 16))
+            output[:, start:end, :] = sent[task_id][0].out_col_start
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp)
+
+        # every row is split in two 16 column tiles with their halo
+        self.assertEqual(len(sent), 8)
+        for msg, patch in sent.values():
+            self.assertEqual((msg.out_h, msg.out_w, msg.in_w), (1, 16, 18))
+            self.assertLessEqual(msg.input_size, worker.input_buffer_size)
+            np.testing.assert_array_equal(
+                patch, padded[:, msg.out_row_start:msg.out_row_start + 3, msg.out_col_start:msg.out_col_start + 18])
+        self.assertEqual({(msg.out_row_start, msg.out_col_start) for msg, _ in sent.values()}, {(y, x) for y in range(4) for x in (0, 16)})
+        self.assertTrue((c.feature_map[:, :, :16] == 0).all())
+        self.assertTrue((c.feature_map[:, :, 16:] == 16).all())
+
+    async def test_distribute_conv_pooled_row_split_adds_channel_sums(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.ROWS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+        full = np.random.randint(0, 255, size=(8, 4, 4), dtype=np.uint8) # what the workers would compute
+
+        layer = LayerConfig(
+            name="final_conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # a row band cannot be averaged on its own, the worker sends uint32 sums per channel
+            self.assertEqual((output.shape, output.dtype), ((8,), np.uint32))
+            output += full[:, start:end].sum(axis=(1, 2), dtype=np.uint32)
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp, pool=True)
+
+        self.assertEqual(len(sent), 2)
+        for _, msg, _ in sent:
+            self.assertEqual(msg.flags, TASK_FLAG_GAP)
+        np.testing.assert_array_equal(c.feature_map, np.round(np.mean(full, axis=(1, 2))).astype(np.uint8))
+
+    async def test_distribute_conv_pooled_channel_split_returns_means(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.OUT_CHANNELS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+
+        layer = LayerConfig(
+            name="final_conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=1,
+        )
+        qp = _make_qp()
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            # whole map of its own channels: one mean per channel
+            self.assertEqual((output.shape, output.dtype), ((4,), np.uint8))
+            output[:] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_conv(layer, qp, pool=True)
+
+        for _, msg, _ in sent:
+            self.assertEqual(msg.flags, TASK_FLAG_GAP | TASK_FLAG_GAP_MEAN)
+        np.testing.assert_array_equal(c.feature_map, [1, 1, 1, 1, 2, 2, 2, 2])
+
+    async def test_distribute_block_sends_unpadded_block_input_rows(self):
+        c = self.coordinator
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(4, 6, 5), dtype=np.uint8)
+        block_input = c.feature_map
+        c.layer_config_list = [
+            LayerConfig(name="blk1_exp", type=LayerType.CONV, layer_idx=0, in_channels=4, out_channels=8),
+            LayerConfig(name="blk1_dw", type=LayerType.DEPTHWISE, layer_idx=1, in_channels=8, out_channels=8,
+                        kernel_size=3, padding=1, groups=8),
+            LayerConfig(name="blk1_proj", type=LayerType.CONV, layer_idx=2, in_channels=8, out_channels=3),
+            LayerConfig(name="final_conv", type=LayerType.CONV, layer_idx=3, in_channels=3, out_channels=8),
+        ]
+        self.assertEqual([c._block_len(i) for i in range(4)], [3, 2, 1, 1])
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append((w.worker_id, msg, patch)))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            output[:, start:end, :] = worker.worker_id + 1
+
+        c._receive_worker_result = fake_receive
+        await c._distribute_block(c.layer_config_list[:3])
+
+        # rows 0-3 and 3-6; each worker gets the block input rows under its depthwise window, unpadded
+        self.assertEqual(sorted((wid, msg.out_row_start, msg.out_h) for wid, msg, _ in sent), [(0, 0, 3), (1, 3, 3)])
+        patches = {wid: patch for wid, _, patch in sent}
+        np.testing.assert_array_equal(patches[0], block_input[:, 0:4])
+        np.testing.assert_array_equal(patches[1], block_input[:, 2:6])
+        for _, msg, _ in sent:
+            self.assertEqual(msg.layer_type, LayerType.BLOCK)
+            self.assertEqual((msg.layer_idx, msg.num_layers, msg.in_h, msg.out_channels, msg.out_w), (0, 3, 4, 3, 5))
+        self.assertEqual(c.feature_map.shape, (3, 6, 5))
+        self.assertTrue((c.feature_map[:, :3] == 1).all())
+        self.assertTrue((c.feature_map[:, 3:] == 2).all())
+
+    async def test_run_block_leaves_residual_add_to_workers(self):
+        c = self.coordinator
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(4, 4, 4), dtype=np.uint8)
+        c.layer_config_list = [
+            LayerConfig(name="blk2_exp", type=LayerType.CONV, layer_idx=0, in_channels=4, out_channels=8,
+                        residual_add_to="blk2_cache"),
+            LayerConfig(name="blk2_dw", type=LayerType.DEPTHWISE, layer_idx=1, in_channels=8, out_channels=8,
+                        kernel_size=3, padding=1, groups=8),
+            LayerConfig(name="blk2_proj", type=LayerType.CONV, layer_idx=2, in_channels=8, out_channels=4,
+                        residual_connect_from="blk2_cache"),
+        ]
+        c.quant_params_list = [
+            _make_qp(0.05, 60, 0.02, 0), _make_qp(0.02, 0, 0.03, 0),
+            _make_qp(0.03, 0, 0.04, 61, s_residual_out=0.08, z_residual_out=59),
+        ]
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append(msg))
+        c._apply_residual = AsyncMock()
+
+        async def fake_receive(worker, start, end, output, task_id):
+            pass
+
+        c._receive_worker_result = fake_receive
+        await c._run_block(0, 3)
+
+        c._apply_residual.assert_not_called()
+        self.assertEqual(c.residual_buffers, {}, "no copy of the block input is kept")
+        self.assertEqual(c.current_layer_idx, 2)
+        for msg in sent:
+            self.assertEqual(msg.flags, TASK_FLAG_RESIDUAL)
+            self.assertEqual((msg.residual.zp_out, msg.residual.zp_res, msg.residual.zp_sum), (61, 60, 59))
+            # 0.04 / 0.08 and 0.05 / 0.08 in Q(shift)
+            self.assertAlmostEqual(msg.residual.mult_out / 2 ** msg.residual.shift, 0.5, places=6)
+            self.assertAlmostEqual(msg.residual.mult_res / 2 ** msg.residual.shift, 0.625, places=6)
+            self.assertEqual(len(msg.pack()), TaskMessage.SIZE + ResidualParams.SIZE)
+
+    async def test_unfused_residual_matches_the_workers_integer_add(self):
+        c = self.coordinator
+        c.current_layer_idx = 0
+        c.quant_params_list = [_make_qp(s_in=0.03, z_in=0, s_out=0.04, z_out=61, s_residual_out=0.08, z_residual_out=59)]
+        # out - 61 weighs 0.5, res - 60 weighs 0.625 in the sum's scale
+        out = np.array([64, 62, 60, 66, 255], dtype=np.uint8)
+        res = np.array([61, 60, 60, 60, 255], dtype=np.uint8)
+        c.feature_map = out.reshape(1, 1, 5).copy()
+        c.residual_buffers["r"] = (res.reshape(1, 1, 5), 0.05, 60)
+
+        await c._apply_residual("r")
+
+        # halves round up like block::residual_add (2.5 -> 3, not numpy's 2), the sum saturates
+        np.testing.assert_array_equal(c.feature_map.ravel(), [61, 60, 59, 62, 255])
+        self.assertEqual(c.residual_buffers, {})
+
     async def test_receive_worker_result_writes_conv_slice(self):
         c = self.coordinator
         worker = self.coordinator.worker_manager.workers[0]
@@ -116,15 +964,17 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
         start_idx, end_idx = 1, 3  # H_slice=2
         patch = np.arange(2 * 2 * 3, dtype=np.uint8).reshape(2, 2, 3)
 
-        payload = struct.pack(ResultMessage.FORMAT, 1234, patch.size)
+        payload = struct.pack(ResultMessage.FORMAT, 1234, patch.size, KernelVariant.IM2COL, 0)
         header = MessageHeader(
             type=MessageType.RESULT,
             worker_id=worker.worker_id,
             payload_len=len(payload),
         )
+        c.current_layer_stats = {"workers": {worker.worker_id: {"mcu_compute_ms": 0.0, "recv_time_ms": 0.0}}}
 
         c.worker_manager.receive_message = AsyncMock(return_value=(header, payload))
-        worker.reader.readexactly = AsyncMock(return_value=patch.tobytes())
+        worker.reader = asyncio.StreamReader()
+        worker.reader.feed_data(patch.tobytes())
         c.worker_manager.mark_worker_idle = MagicMock()
 
         await c._receive_worker_result(
@@ -136,6 +986,256 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
 
         np.testing.assert_array_equal(output[:, 1:3, :], patch)
         c.worker_manager.mark_worker_idle.assert_called_once()
+        self.assertEqual(c._kernel_report(c.current_layer_stats), f"kernels={worker.worker_id}:IM2COL")
+
+    async def test_only_a_whole_error_reply_keeps_the_worker(self):
+        c = self.coordinator
+        worker = c.worker_manager.workers[0]
+        c.current_layer_stats = {"workers": {}}
+        output = np.zeros((2, 4, 3), dtype=np.uint8)
+        patch = np.arange(2 * 4 * 3, dtype=np.uint8).reshape(2, 4, 3)
+
+        def message(msg_type, task_id, payload):
+            return MessageHeader(type=msg_type, worker_id=worker.worker_id, payload_len=len(payload), task_id=task_id).pack() + payload
+        def result(task_id):
+            return message(MessageType.RESULT, task_id, struct.pack(ResultMessage.FORMAT, 1000, patch.size, KERNEL_VARIANT_AUTO, 0)) + patch.tobytes()
+
+        worker.reader = asyncio.StreamReader()
+        worker.reader.feed_data(message(MessageType.ERROR, 5, struct.pack(ErrorMessage.FORMAT, ErrorCode.ERR_OUT_OF_MEMORY, b"oom"))
+                                + result(6) + result(8) + result(7))
+
+        # a whole ERROR: the stream is at the next message
+        with self.assertRaises(WorkerErrorReply):
+            await c._receive_worker_result(worker, 0, 4, output, task_id=5)
+        self.assertNotEqual(worker.state, WorkerState.DISCONNECTED)
+        await c._receive_worker_result(worker, 0, 4, output, task_id=6)
+        np.testing.assert_array_equal(output, patch)
+
+        # a result for another task stops before its output, reading on would take the output for a header
+        with self.assertRaises(WorkerLinkError):
+            await c._receive_worker_result(worker, 0, 4, output, task_id=7)
+        self.assertEqual(worker.state, WorkerState.DISCONNECTED)
+
+    async def test_receive_worker_result_reads_streamed_compute_time(self):
+        c = self.coordinator
+        worker = self.coordinator.worker_manager.workers[0]
+        output = np.zeros((2, 4, 3), dtype=np.uint8)
+        patch = np.arange(2 * 4 * 3, dtype=np.uint8).reshape(2, 4, 3)
+
+        payload = struct.pack(ResultMessage.FORMAT, 0, patch.size, KernelVariant.NATIVE, RESULT_FLAG_STREAMED)
+        header = MessageHeader(type=MessageType.RESULT, worker_id=worker.worker_id, payload_len=len(payload))
+        c.current_layer_stats = {"workers": {worker.worker_id: {"mcu_compute_ms": 0.0, "recv_time_ms": 0.0}}}
+
+        c.worker_manager.receive_message = AsyncMock(return_value=(header, payload))
+        # the blocks, then the compute time
+        worker.reader = asyncio.StreamReader()
+        worker.reader.feed_data(patch.tobytes() + struct.pack('<I', 2500))
+
+        await c._receive_worker_result(worker=worker, start_idx=0, end_idx=4, output=output)
+
+        np.testing.assert_array_equal(output, patch)
+        self.assertEqual(c.current_layer_stats["workers"][worker.worker_id]["mcu_compute_ms"], 2.5)
+
+    async def test_results_land_in_the_reused_layer_buffer(self):
+        c = self.coordinator
+        worker = c.worker_manager.workers[0]
+        c.current_layer_idx = 3
+        output = c._layer_buffer((4, 2, 6), np.uint8)
+        self.assertIs(c._layer_buffer((4, 2, 6), np.uint8), output)
+
+        # channels 0-1, whole planes: read straight into the output
+        channels = np.arange(2 * 2 * 6, dtype=np.uint8).reshape(2, 2, 6)
+        # channels 2-3, columns 3-6: through the staging buffer
+        tile = np.full((2, 2, 3), 200, dtype=np.uint8)
+        worker.reader = asyncio.StreamReader()
+        worker.reader.feed_data(channels.tobytes() + tile.tobytes())
+        await c._receive_output(worker, channels.size, output[0:2], 0, 2)
+        await c._receive_output(worker, tile.size, output[2:4, :, 3:6], 0, 2)
+
+        np.testing.assert_array_equal(output[0:2], channels)
+        np.testing.assert_array_equal(output[2:4, :, 3:6], tile)
+        self.assertEqual(len(c.recv_buffers[worker.worker_id]), tile.size)
+
+        # pooled sums start over on every use
+        sums = c._layer_buffer((4,), np.uint32)
+        sums += 7
+        self.assertFalse(c._layer_buffer((4,), np.uint32).any())
+
+    async def test_padded_outputs_are_received_from_the_socket_in_place(self):
+        c = self.coordinator
+        worker = c.worker_manager.workers[0]
+        # a CHW output inside its consumer's border, its rows are the contiguous runs
+        padded = np.full((2, 6, 42), 7, dtype=np.uint8)
+        output = padded[:, 1:5, 1:41]
+        patch = np.arange(2 * 2 * 40, dtype=np.uint8).reshape(2, 2, 40)
+
+        ours, theirs = socket.socketpair()
+        _, connection = await asyncio.get_running_loop().create_connection(WorkerConnection, sock=ours)
+        worker.reader = worker.writer = connection
+        try:
+            data = patch.tobytes() + b'next'
+            # part of it arrives with the previous message and waits in the connection, the rest straight from the socket
+            theirs.sendall(b'head' + data[:50])
+            self.assertEqual(await worker.reader.readexactly(4), b'head')
+            receive = asyncio.create_task(c._receive_output(worker, patch.size, output, 1, 3))
+            await asyncio.sleep(0.01)
+            theirs.sendall(data[50:])
+            await receive
+
+            np.testing.assert_array_equal(output[:, 1:3, :], patch)
+            self.assertTrue((output[:, [0, 3], :] == 7).all())
+            self.assertTrue((padded[:, :, [0, 41]] == 7).all())
+            self.assertNotIn(worker.worker_id, c.recv_buffers)
+            # the bytes after the output are left for the next message
+            self.assertEqual(await worker.reader.readexactly(4), b'next')
+        finally:
+            worker.writer.close()
+            theirs.close()
+
+    async def test_worker_connection_pauses_reading_when_nobody_reads(self):
+        ours, theirs = socket.socketpair()
+        _, connection = await asyncio.get_running_loop().create_connection(lambda: WorkerConnection(limit=16), sock=ours)
+        try:
+            data = bytes(range(100))
+            theirs.sendall(data)
+            await asyncio.sleep(0.01)
+            self.assertTrue(connection._paused)
+            self.assertEqual(await asyncio.wait_for(connection.readexactly(100), timeout=1), data)
+            theirs.close()
+            await asyncio.wait_for(connection.wait_closed(), timeout=1)
+            self.assertTrue(connection.at_eof())
+        finally:
+            connection.close()
+            theirs.close()
+
+    async def test_outputs_carry_their_consumers_padding(self):
+        c = self.coordinator
+        qp = _make_qp(z_in=7)
+        c.layer_config_list = [
+            LayerConfig(name="pw", type=LayerType.CONV, layer_idx=0, in_channels=4, out_channels=2),
+            LayerConfig(name="conv", type=LayerType.CONV, layer_idx=1, in_channels=2, out_channels=2, kernel_size=3, padding=1),
+        ]
+        c.quant_params_list = [qp, qp]
+        c.current_layer_idx = 0
+        output = c._layer_buffer((2, 4, 5), np.uint8, c._consumer_border(1))
+        output[...] = np.arange(output.size, dtype=np.uint8).reshape(output.shape)
+
+        # the next layer pads without copying, its border is the zero point
+        padded = c._pad(output, 1, 7)
+        self.assertTrue(np.shares_memory(padded, output))
+        np.testing.assert_array_equal(padded, np.pad(output, ((0, 0), (1, 1), (1, 1)), constant_values=7))
+        self.assertFalse(np.shares_memory(c._pad(output, 1, 9), output))
+
+        # and its row bands go out as one view per channel plane
+        band = padded[:, 1:4, :]
+        buffers = c._wire_buffers(band)
+        self.assertEqual(len(buffers), 2)
+        self.assertTrue(all(np.shares_memory(np.asarray(b), padded) for b in buffers))
+        self.assertEqual(b''.join(buffers), band.tobytes())
+
+    async def test_send_message_writes_buffers_without_joining(self):
+        worker = self.coordinator.worker_manager.workers[0]
+        patch = np.arange(12, dtype=np.uint8)
+        await self.coordinator.worker_manager.send_message(worker, MessageType.TASK, [b'msg', memoryview(patch)], task_id=5)
+
+        (buffers,), _ = worker.writer.writelines.call_args
+        header = MessageHeader.unpack(buffers[0])
+        self.assertEqual((header.payload_len, header.task_id), (3 + 12, 5))
+        self.assertIs(buffers[2].obj, patch)
+
+    async def test_channels_last_sends_hwc_patches(self):
+        c = self.coordinator
+        c.channels_last = True
+        c.partition_strategy = PartitionStrategy.ROWS
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(3, 4, 4), dtype=np.uint8)
+
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=3, padding=1,
+        )
+        qp = _make_qp(z_in=7)
+
+        sent = []
+        async def fake_send(worker, msg_type, payload, task_id):
+            sent.append(b''.join(payload))
+            return True
+        c.worker_manager.send_message = fake_send
+
+        async def fake_receive(worker, start, end, output, task_id):
+            output[:, start:end, :] = 1
+
+        c._receive_worker_result = fake_receive
+        padded = np.pad(c.feature_map, ((0, 0), (1, 1), (1, 1)), constant_values=7)
+        await c._distribute_conv(layer, qp)
+
+        self.assertEqual(len(sent), 2)
+        for payload in sent:
+            fields = struct.unpack_from(TaskMessage.FORMAT, payload)
+            out_h, out_row_start, flags = fields[6], fields[16], fields[19]
+            self.assertTrue(flags & TASK_FLAG_HWC)
+            rows = padded[:, out_row_start:out_row_start + out_h + 2, :]
+            self.assertEqual(payload[TaskMessage.SIZE:], rows.transpose(1, 2, 0).tobytes())
+        self.assertTrue((c.feature_map == 1).all())
+        self.assertTrue(c.feature_map.transpose(1, 2, 0).flags['C_CONTIGUOUS'], "output is channel-last in memory")
+
+    async def test_kernel_policy_sets_task_kernel_variant(self):
+        c = self.coordinator
+        c.partition_strategy = PartitionStrategy.ROWS
+        layer = LayerConfig(
+            name="conv", type=LayerType.CONV, layer_idx=0,
+            in_channels=3, out_channels=8, kernel_size=3, padding=1,
+        )
+        qp = _make_qp(z_in=7)
+        # only worker 0 timed its kernels at boot, im2col won on this layer
+        c.worker_manager.workers[0].kernel_benches = {0: {KernelVariant.NATIVE: 100_000, KernelVariant.IM2COL: 300_000}}
+
+        sent = {}
+        async def fake_send(worker, msg_type, payload, task_id):
+            sent[worker.worker_id] = struct.unpack_from(TaskMessage.FORMAT, payload[0])[20]
+            return True
+        c.worker_manager.send_message = fake_send
+
+        async def fake_receive(worker, start, end, output, task_id):
+            pass
+        c._receive_worker_result = fake_receive
+
+        expected = {
+            KernelPolicy.FIXED: {0: KernelVariant.NATIVE, 1: KernelVariant.NATIVE},
+            KernelPolicy.PROFILE: {0: KERNEL_VARIANT_AUTO, 1: KERNEL_VARIANT_AUTO},
+            KernelPolicy.DIRECTED: {0: KernelVariant.IM2COL, 1: KERNEL_VARIANT_AUTO},
+        }
+        for policy, variants in expected.items():
+            c.kernel_policy = policy
+            c.current_layer_stats = {"workers": {}}
+            c.feature_map = np.zeros((3, 4, 4), dtype=np.uint8)
+            sent.clear()
+            await c._distribute_conv(layer, qp)
+            self.assertEqual(sent, variants, policy.name)
+
+        # im2col can't run channel-last tiles, so the coordinator doesn't direct it there
+        c.channels_last = True
+        self.assertEqual(c._kernel_variant(c.worker_manager.workers[0], layer), KernelVariant.NATIVE)
+
+    async def test_receive_worker_result_reads_hwc_slice(self):
+        c = self.coordinator
+        c.channels_last = True
+        worker = self.coordinator.worker_manager.workers[0]
+
+        output = np.zeros((4, 3, 2), dtype=np.uint8).transpose(2, 0, 1)  # C=2,H=4,W=3 backed by HWC
+        patch = np.arange(2 * 2 * 3, dtype=np.uint8).reshape(2, 2, 3)  # CHW rows 1..2
+
+        payload = struct.pack(ResultMessage.FORMAT, 1234, patch.size, KERNEL_VARIANT_AUTO, 0)
+        header = MessageHeader(type=MessageType.RESULT, worker_id=worker.worker_id, payload_len=len(payload))
+
+        c.worker_manager.receive_message = AsyncMock(return_value=(header, payload))
+        worker.reader = asyncio.StreamReader()
+        worker.reader.feed_data(patch.transpose(1, 2, 0).tobytes())
+        c.worker_manager.mark_worker_idle = MagicMock()
+
+        await c._receive_worker_result(worker=worker, start_idx=1, end_idx=3, output=output)
+
+        np.testing.assert_array_equal(output[:, 1:3, :], patch)
 
     def test_parse_layer_configs_from_json(self):
         c = self.coordinator
@@ -181,5 +1281,51 @@ class TestCoordinatorCore(unittest.IsolatedAsyncioTestCase):
         self.assertEqual(c.quant_params_list[0].z_in, 128)
 
 
+    async def test_block_tasks_carry_activation_clamps(self):
+        c = self.coordinator
+        c.current_layer_stats = {"workers": {}}
+        c.feature_map = np.random.randint(0, 255, size=(4, 4, 4), dtype=np.uint8)
+        layer = {
+            "name": "blk1_exp", "type": "CONV", "in_channels": 4, "out_channels": 8, "kernel_size": 1,
+            "stride": 1, "padding": 0, "groups": 1, "activation": "RELU6",
+        }
+        quant = {"s_in": 0.05, "z_in": 60, "s_w": [0.1] * 8, "z_w": [0] * 8, "s_out": 0.04, "z_out": 0, "m": [0.1] * 8}
+        fake_cfg = {"layers": [
+            {"layer_config": layer, "quant_params": quant},
+            # exported clamp wins over the one derived from s_out
+            {"layer_config": dict(layer, name="blk1_dw", type="DEPTHWISE", kernel_size=3, padding=1, groups=8, in_channels=8),
+             "quant_params": dict(quant, act_min=0, act_max=100)},
+            {"layer_config": dict(layer, name="blk1_proj", in_channels=8, activation="NONE"),
+             "quant_params": dict(quant, z_out=64)},
+        ]}
+        with tempfile.TemporaryDirectory() as td:
+            p = Path(td) / "model_config.json"
+            p.write_text(json.dumps(fake_cfg), encoding="utf-8")
+            c._parse_layer_configs(str(p))
+        for worker in c.worker_manager.workers.values():
+            worker.model_hash = c.model_hash # flashed with this model
+
+        self.assertEqual([cfg.activation for cfg in c.layer_config_list], [Activation.RELU6, Activation.RELU6, Activation.NONE])
+        # ReLU6 is [0, 6 / 0.04] in the quantized domain
+        self.assertEqual([(qp.act_min, qp.act_max) for qp in c.quant_params_list], [(0, 150), (0, 100), (0, 255)])
+
+        sent = []
+        c._send_task_to_worker = AsyncMock(side_effect=lambda w, msg, patch, task_id: sent.append(msg))
+
+        async def fake_receive(worker, start, end, output, task_id):
+            pass
+
+        c._receive_worker_result = fake_receive
+        await c._run_block(0, 3)
+
+        for msg in sent:
+            self.assertEqual(msg.flags, TASK_FLAG_ACTIVATION)
+            self.assertEqual(msg.activations, [(0, 150), (0, 100), (0, 255)])
+            self.assertEqual(msg.pack()[TaskMessage.SIZE:], bytes([0, 150, 0, 100, 0, 255]))
+
+        # a layer without activation sends no clamp at all
+        self.assertEqual(c._activations(c.quant_params_list[2:]), (0, None))
+
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -0,0 +1,113 @@
+import unittest
+from types import SimpleNamespace
+
+from src.partitioner import MACS_PER_MS_PER_MHZ, RowCost, RowPartitioner
+from src.planner import PartitionPlanner, PartitionStrategy
+from src.protocol import KernelVariant, LayerType
+from src.work_manager import WorkerInfo
+
+
+def _worker(worker_id: int, clock_mhz: int):
+    return SimpleNamespace(worker_id=worker_id, clock_mhz=clock_mhz, bench_score=0)
+
+
+class TestRowPartitioner(unittest.TestCase):
+    def setUp(self):
+        # compute bound layer so that the clock ratio dominates the split
+        self.cost = RowCost(macs=1_000_000, bytes=100)
+
+    def _rows(self, assignments):
+        return {w.worker_id: end - start for w, start, end in assignments}
+
+    def test_split_covers_all_rows_contiguously(self):
+        p = RowPartitioner()
+        workers = [_worker(i, 600) for i in range(4)]
+        assignments = p.split(workers, 7, LayerType.DEPTHWISE, self.cost)
+
+        self.assertEqual(assignments[0][1], 0)
+        self.assertEqual(assignments[-1][2], 7)
+        for (_, _, end), (_, start, _) in zip(assignments, assignments[1:]):
+            self.assertEqual(end, start)
+        self.assertEqual(sorted(self._rows(assignments).values()), [1, 2, 2, 2])
+
+    def test_faster_clock_gets_more_rows(self):
+        p = RowPartitioner()
+        workers = [_worker(0, 600), _worker(1, 816)]
+        rows = self._rows(p.split(workers, 112, LayerType.CONV, self.cost))
+
+        self.assertEqual(rows[0] + rows[1], 112)
+        self.assertAlmostEqual(rows[1] / rows[0], 816 / 600, delta=0.05)
+
+    def test_observed_speed_shifts_rows_unless_deterministic(self):
+        workers = [_worker(0, 600), _worker(1, 600)]
+        adaptive = RowPartitioner(alpha=1.0)
+        fixed = RowPartitioner(alpha=1.0, adaptive=False)
+        for p in (adaptive, fixed):
+            # worker 1 is throttled: same rows took twice as long
+            p.observe(workers[0], LayerType.CONV, 10, self.cost, 100.0)
+            p.observe(workers[1], LayerType.CONV, 10, self.cost, 200.0)
+
+        rows = self._rows(adaptive.split(workers, 30, LayerType.CONV, self.cost))
+        self.assertEqual(rows, {0: 20, 1: 10})
+        # a different layer kind has no measurements yet and falls back to the clocks
+        rows = self._rows(adaptive.split(workers, 30, LayerType.DEPTHWISE, self.cost))
+        self.assertEqual(rows, {0: 15, 1: 15})
+        rows = self._rows(fixed.split(workers, 30, LayerType.CONV, self.cost))
+        self.assertEqual(rows, {0: 15, 1: 15})
+
+    def test_boot_benchmark_seeds_the_layer_split(self):
+        # same clock, but worker 1's kernels ran layer 5 three times as fast at boot
+        workers = [WorkerInfo(0, 600, None, None, kernel_benches={5: {KernelVariant.NATIVE: 100_000}}),
+                   WorkerInfo(1, 600, None, None, kernel_benches={5: {KernelVariant.NATIVE: 100_000, KernelVariant.IM2COL: 300_000}})]
+        p = RowPartitioner(alpha=1.0)
+
+        self.assertEqual(self._rows(p.split(workers, 40, LayerType.CONV, self.cost, layer_idx=5)), {0: 10, 1: 30})
+        # layers that weren't timed fall back to the clocks
+        self.assertEqual(self._rows(p.split(workers, 40, LayerType.CONV, self.cost, layer_idx=6)), {0: 20, 1: 20})
+        # and a measurement of the kind takes over from the boot numbers
+        p.observe(workers[0], LayerType.CONV, 10, self.cost, 100.0)
+        p.observe(workers[1], LayerType.CONV, 10, self.cost, 100.0)
+        self.assertEqual(self._rows(p.split(workers, 40, LayerType.CONV, self.cost, layer_idx=5)), {0: 20, 1: 20})
+
+
+    def test_version_moves_only_when_a_rate_drifts(self):
+        worker = _worker(0, 600)
+        p = RowPartitioner(alpha=0.5, replan_tolerance=0.1)
+        p.observe(worker, LayerType.CONV, 10, self.cost, 100.0)
+        self.assertEqual(p.version, 1)
+        # within 10% of the rate the splits were made with: compiled plans stay
+        p.observe(worker, LayerType.CONV, 10, self.cost, 110.0)
+        p.observe(worker, LayerType.CONV, 10, self.cost, 90.0)
+        self.assertEqual(p.version, 1)
+        p.observe(worker, LayerType.CONV, 10, self.cost, 200.0)
+        self.assertEqual(p.version, 2)
+        fixed = RowPartitioner(adaptive=False)
+        fixed.observe(worker, LayerType.CONV, 10, self.cost, 100.0)
+        self.assertEqual(fixed.version, 0)
+
+if __name__ == "__main__":
+    unittest.main()
+
+
+class TestPartitionPlanner(unittest.TestCase):
+    def setUp(self):
+        # a compute bound 3x3 conv, 16x16 output
+        self.layer = SimpleNamespace(name="conv", type=LayerType.CONV, in_channels=64, out_channels=64, groups=1,
+                                     kernel_size=3, stride=1)
+
+    def test_compute_runs_at_the_registered_clocks(self):
+        p = PartitionPlanner(link_mbps=1e9, task_overhead_ms=0)
+        macs = 16 * 16 * 64 * 64 * 9
+
+        self.assertAlmostEqual(p.cost(self.layer, 18, 16, 16, 4, 1), macs / (4 * 600 * MACS_PER_MS_PER_MHZ), places=3)
+        self.assertAlmostEqual(p.cost(self.layer, 18, 16, 16, 4, 1, clocks_mhz=[816, 816, 600, 600]),
+                               macs / (2832 * MACS_PER_MS_PER_MHZ), places=3)
+        # equal hybrid cells wait for the slowest worker
+        self.assertAlmostEqual(p.cost(self.layer, 18, 16, 16, 2, 2, clocks_mhz=[816, 816, 600, 150]),
+                               macs / 4 / (150 * MACS_PER_MS_PER_MHZ), places=3)
+
+    def test_slow_worker_steers_away_from_equal_cells(self):
+        p = PartitionPlanner(link_mbps=1e9, task_overhead_ms=0)
+        plan = p.choose(self.layer, 18, 16, 16, 4, clocks_mhz=[600, 600, 600, 150])
+        self.assertIn(plan.strategy, (PartitionStrategy.ROWS, PartitionStrategy.OUT_CHANNELS))
+        self.assertLess(plan.cost_ms, p.choose(self.layer, 18, 16, 16, 4, clocks_mhz=[150] * 4).cost_ms)
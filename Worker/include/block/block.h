@@ -0,0 +1,50 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "kernel_args.h"
+
+struct LayerConfig; // TODO Need to rethink where should we put the struct
+struct QuantParams; // TODO Need to rethink where should we put the struct
+struct ResidualParams;
+
+namespace block {
+
+    // one layer of a fused block
+    struct BlockLayer {
+        const int8_t *weights;
+        const int32_t *bias;
+        const LayerConfig *cfg;
+        const QuantParams *qp;
+        uint8_t act_min, act_max; // fused activation, see KernelArgs
+    };
+
+    // a band of output rows of the block; unlike KernelArgs the input is NOT padded,
+    // it holds the block input rows the band needs, clipped to the feature map
+    struct BlockArgs {
+        uint16_t in_h, in_w; // input rows sent, full (unpadded) width
+        uint16_t out_h; // output rows to produce
+        uint32_t out_row_start; // first output row, tells which input rows are top padding
+        bool hwc; // input and output are channel-last, see KernelArgs
+    };
+
+    // scratch bytes needed by inverted_residual for this band
+    size_t scratch_size(const BlockLayer *layers, uint8_t num_layers, const BlockArgs *args);
+
+    // fused MobileNetV2 inverted residual: [expand 1x1] -> depthwise -> project 1x1.
+    // layers holds 3 layers (exp, dw, proj) or 2 (dw, proj). The expanded tensor never leaves the
+    // worker: only kernel_size expanded rows are kept in a rolling window in scratch.
+    // With `residual` the block input rows (still in `input`) are added to the output in integer
+    // arithmetic, which needs stride 1 and as many output as input channels.
+    // Returns false if scratch is too small.
+    bool inverted_residual(const uint8_t *input, uint8_t *output, uint8_t *scratch, size_t scratch_len,
+                           const BlockLayer *layers, uint8_t num_layers, const BlockArgs *args,
+                           const ResidualParams *residual = nullptr);
+
+    // in place quantized add of `res` to `out`, see ResidualParams
+    void residual_add(uint8_t *out, const uint8_t *res, size_t count, const ResidualParams *params);
+
+} // namespace block
+
+#endif
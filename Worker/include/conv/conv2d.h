@@ -2,6 +2,7 @@
 #define CONV2D_H
 
 #include <Arduino.h>
+#include "kernel_args.h"
 
 struct LayerConfig; // TODO Need to rethink where should we put the struct
 struct QuantParams; // TODO Need to rethink where should we put the struct
@@ -10,17 +11,25 @@ namespace conv2d {
 
     // normal conv
     void native_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const uint8_t in_h, const uint8_t in_w);
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
 
+    // channel-first only, its col and weight buffers come from the heap, see im2col_buffer_size
     void im2col_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const uint8_t in_h, const uint8_t in_w);
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
+
+    // bytes im2col_conv2d allocates for a task
+    size_t im2col_buffer_size(const LayerConfig *cfg, const KernelArgs *args);
 
     // depthwise conv
     void depthwise_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const uint8_t in_h, const uint8_t in_w);
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
+
+    // the kernel specialized on this kernel size and stride if there is one, the generic one otherwise;
+    // with K and S constant the tap loops unroll
+    KernelFn specialized_conv2d(bool depthwise, int kernel_size, int stride);
 
     // void depthwise_conv2d_dsp(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-    //                     uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const uint8_t in_h, const uint8_t in_w);
+    //                     uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
 
 } // namespace conv2d
 
@@ -0,0 +1,32 @@
+#ifndef KERNEL_ARGS_H
+#define KERNEL_ARGS_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Per-task arguments shared by all kernels, filled from the TaskMessage.
+// Weights, bias and per-channel scales are indexed by the absolute output
+// channel (oc_start + i), the output buffer holds only the oc_count channels of the slice.
+struct KernelArgs {
+    uint16_t in_h, in_w; // input patch size, padding already applied by the coordinator
+    uint32_t oc_start; // first output channel of the slice
+    uint32_t oc_count; // number of output channels to produce
+    uint8_t act_min, act_max; // fused activation as a clamp of the quantized output, {0, 255} for none
+    bool hwc; // input and output are channel-last [H][W][C] (TASK_FLAG_HWC), [C][H][W] otherwise
+    uint8_t batch; // fc: input vectors sharing each weight row, see TaskMessage::batch; 0 and 1 both mean one
+};
+
+struct LayerConfig;
+struct QuantParams;
+
+// signature shared by the conv, depthwise and linear kernels
+typedef void (*KernelFn)(const uint8_t *input, const int8_t *weights, const int32_t *bias, uint8_t *output,
+                         const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
+
+// requantization epilogue shared by the kernels, the clamp applies the fused activation
+static inline uint8_t requantize(int32_t acc, float multiplier, int32_t output_zero_point, const KernelArgs *args) {
+    int32_t val = (int32_t) roundf(acc * multiplier + output_zero_point);
+    return (uint8_t) (val < args->act_min ? args->act_min : (val > args->act_max ? args->act_max : val));
+}
+
+#endif // KERNEL_ARGS_H
@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include <stdint.h>
+#include "kernel_args.h"
 
 struct LayerConfig; // TODO Need to rethink where should we put the struct
 struct QuantParams; // TODO Need to rethink where should we put the struct
@@ -10,11 +11,11 @@ struct QuantParams; // TODO Need to rethink where should we put the struct
 namespace linear {
     
     void native_linear(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp);
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
 
     // Slower than native one
     void dsp_linear(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp);
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args);
 }
 
 
@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+namespace pool {
+
+    // global average pooling of a CHW (or, with hwc, HWC) tensor, reduced on the worker so only one
+    // value per channel is returned
+
+    // per-channel sums, exact; the coordinator adds the sums of all tiles and divides once
+    void channel_sums(const uint8_t *input, uint32_t *sums, uint32_t channels, uint32_t pixels, bool hwc = false);
+
+    // per-channel means rounded half to even (same as np.round), only valid when the tile is the whole map.
+    // may run in place (means == input)
+    void channel_means(const uint8_t *input, uint8_t *means, uint32_t channels, uint32_t pixels, bool hwc = false);
+
+} // namespace pool
+
+#endif
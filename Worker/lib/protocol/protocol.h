@@ -5,11 +5,24 @@
 #include <stdint.h>
 
 #define PROTOCOL_MAGIC 0xDEADBEEF
+#define PROTOCOL_VERSION 7 // bumped whenever a message layout changes, sent at registration
+
+// bits of TaskMessage::flags
+#define TASK_FLAG_RESIDUAL 0x01 // a ResidualParams follows the TaskMessage, add the block input to the block output
+#define TASK_FLAG_GAP 0x02 // global average pool the output: return one uint32 sum per channel instead of the map
+#define TASK_FLAG_GAP_MEAN 0x04 // with TASK_FLAG_GAP, the task covers the whole map: return one uint8 mean per channel
+#define TASK_FLAG_ACTIVATION 0x08 // num_layers ActivationRange follow (after the ResidualParams), one per layer
+#define TASK_FLAG_HWC 0x10 // input patch and output tile are channel-last [H][W][C] instead of [C][H][W]
+
+// bits of ResultMessage::flags
+#define RESULT_FLAG_STREAMED 0x01 // the output was sent block by block as computed, a uint32 compute_time_us follows it
+#define RESULT_FLAG_CANCELLED 0x02 // a CANCEL for the task came before its output went out, none follows
 
 enum class ErrorCode : uint8_t {
     ERR_NONE = 0x00,
     ERR_OUT_OF_MEMORY = 0x01,
     ERR_INVALID_TASK = 0x02,
+    ERR_UNSUPPORTED_PROTOCOL = 0x03, // RegisterAckMessage::status when the server speaks another PROTOCOL_VERSION
 };
 
 enum class MessageType : uint8_t {
@@ -20,6 +33,7 @@ enum class MessageType : uint8_t {
     ERROR = 0x05, // worker -> server
     HEARTBEAT = 0x06, // worker -> server option TODO
     SHUTDOWN = 0x07, // server -> worker
+    CANCEL = 0x08, // server -> worker, no payload: drop the output of header.task_id, another worker delivered it
 };
 
 // TODO need further check
@@ -28,20 +42,55 @@ enum class LayerType : uint8_t {
     DEPTHWISE = 0x02,
     POINTWISE = 0x03,
     FC = 0x04,
+    BLOCK = 0x05, // fused [expand] -> depthwise -> project, see TaskMessage::num_layers
 };
 
+// implementations of a layer, see conv2d.h and linear.h
+enum class KernelVariant : uint8_t {
+    NATIVE = 0x00, // direct loops, specialized on kernel size and stride where there is one
+    IM2COL = 0x01, // im2col + GEMM, conv only
+    DSP = 0x02, // CMSIS-DSP dot products, fc only
+};
+#define KERNEL_VARIANT_AUTO 0xFF // TaskMessage::kernel_variant leaving the choice to the worker, reported by block tasks
+
 struct MessageHeader {
     uint32_t magic; // fixed value 0xDEADBEEF
     MessageType type;
     uint8_t worker_id;
     uint32_t payload_len;
-    uint8_t reserved[6]; // for future use
+    uint32_t task_id; // set by the server on TASK, echoed back on RESULT/ERROR
+    uint8_t reserved[2]; // for future use
 } __attribute__((packed)); // TODO need further check the attribute; 16 bytes for header
 
 // TODO Need to rename it to RegisterPayload
+// what this worker can do, the server only sends tasks that fit
 struct RegisterMessage {
     uint32_t clock_mhz;
-} __attribute__((packed)); // TODO need further check the attribute; 24 bytes for payload
+    uint16_t protocol_version; // PROTOCOL_VERSION
+    uint32_t input_buffer_size, output_buffer_size; // largest task input/output, in bytes
+    uint32_t scratch_size; // arena of the fused block tasks, in bytes
+    uint8_t task_types; // bit (1 << LayerType) for every task type this worker runs
+    uint8_t task_flags; // TASK_FLAG_* this worker understands
+    uint32_t model_hash; // FNV-1a of the model geometry and zero points, see model_hash() in worker.cpp
+    uint32_t bench_score; // MACs per ms measured at boot, 0 if not measured
+    uint16_t num_weight_shards; // WeightShard entries following the message
+    uint16_t num_kernel_benches; // KernelBench entries following the WeightShard ones
+} __attribute__((packed)); // TODO need further check the attribute; 32 bytes for payload
+
+// output channels [oc_start, oc_start + oc_count) of a layer, the only ones this worker holds weights for;
+// layers not advertised at registration are held whole
+struct WeightShard {
+    uint16_t layer_idx;
+    uint32_t oc_start;
+    uint32_t oc_count;
+} __attribute__((packed)); // 10 bytes
+
+// speed of one kernel variant on one layer, timed on a synthetic tile at boot
+struct KernelBench {
+    uint16_t layer_idx;
+    KernelVariant variant;
+    uint32_t macs_per_ms;
+} __attribute__((packed)); // 7 bytes
 
 // TODO Need to rename it to RegisterAckPayload
 struct RegisterAckMessage {
@@ -66,24 +115,57 @@ struct TaskMessage {
 
     // data size
     uint32_t input_size; // in bytes    
-} __attribute__((packed)); // TODO need further check the attribute; 29 bytes for payload
+
+    // slice of the layer, out_channels channels starting at out_ch_start
+    uint32_t out_ch_start;
+    // origin of the out_h x out_w tile in the layer output
+    uint32_t out_row_start;
+    uint32_t out_col_start;
+    // BLOCK tasks run num_layers layers starting at layer_idx, 1 otherwise
+    uint8_t num_layers;
+    uint8_t flags; // TASK_FLAG_*
+    uint8_t kernel_variant; // KernelVariant of single layer tasks, KERNEL_VARIANT_AUTO lets the worker pick
+    // FC tasks of a micro-batch: batch input vectors one after another, each weight row is applied to all of them;
+    // the output is class-major, output[oc * batch + b]. 1 for every other task
+    uint8_t batch;
+} __attribute__((packed)); // TODO need further check the attribute; 62 bytes for payload
+
+// integer residual add, sent after the TaskMessage when TASK_FLAG_RESIDUAL is set:
+// out = zp_sum + round(((out - zp_out) * mult_out + (res - zp_res) * mult_res) / 2^shift)
+struct ResidualParams {
+    int32_t mult_out; // s_out / s_sum in Q(shift)
+    int32_t mult_res; // s_res / s_sum in Q(shift)
+    int32_t zp_out;
+    int32_t zp_res;
+    int32_t zp_sum;
+    uint8_t shift;
+} __attribute__((packed)); // 21 bytes
+
+// fused activation of one layer as a clamp of its quantized output, {0, 255} when the layer has none
+struct ActivationRange {
+    uint8_t act_min;
+    uint8_t act_max;
+} __attribute__((packed));
 
 struct ResultMessage {
-    uint32_t compute_time_us;
+    uint32_t compute_time_us; // 0 with RESULT_FLAG_STREAMED, sent after the output instead
     uint32_t output_size; // in bytes
+    uint8_t kernel_variant; // KernelVariant that ran, KERNEL_VARIANT_AUTO for block tasks
+    uint8_t flags; // RESULT_FLAG_*
     // maybe performance records here
-} __attribute__((packed)); // TODO need further check the attribute; 8 bytes for payload
+} __attribute__((packed)); // TODO need further check the attribute; 10 bytes for payload
 
 struct ErrorMessage {
     uint8_t error_code;
     char description[63];
 } __attribute__((packed)); // TODO need further check the attribute; 64 bytes for payload
 
-inline uint32_t init_header(MessageHeader &header, MessageType type, uint8_t worker_id, uint32_t payload_len) {
+inline uint32_t init_header(MessageHeader &header, MessageType type, uint8_t worker_id, uint32_t payload_len, uint32_t task_id = 0) {
     header.magic = PROTOCOL_MAGIC;
     header.type = type;
     header.worker_id = worker_id;
     header.payload_len = payload_len;
+    header.task_id = task_id;
     memset(header.reserved, 0, sizeof(header.reserved));
     return sizeof(MessageHeader);
 }
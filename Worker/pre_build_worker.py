@@ -21,6 +21,8 @@ HEADERS_SRC = os.path.abspath(
 )
 HEADERS_DST = os.path.join(env.get("PROJECT_DIR", "."), "include")
 HEADER_FILES = ["weights.h", "quant_params.h", "layer_config.h"]
+# only exported for workers that hold part of a layer's output channels, see WeightShard in protocol.h
+OPTIONAL_HEADER_FILES = ["weight_shards.h"]
 
 print(f"=== Prebuild worker {worker_id} ===")
 print(f"Copying headers from {HEADERS_SRC} to {HEADERS_DST}...")
@@ -33,4 +35,13 @@ for hf in HEADER_FILES:
     else:
         print(f"Warning: {src} does not exist and will be skipped.")
 
+for hf in OPTIONAL_HEADER_FILES:
+    src = os.path.join(HEADERS_SRC, hf)
+    dst = os.path.join(HEADERS_DST, hf)
+    if os.path.exists(src):
+        shutil.copy2(src, dst)
+    elif os.path.exists(dst):
+        # left over from the previous worker's build, this worker holds those layers whole
+        os.remove(dst)
+
 print("Prebuild step completed.")
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "block/block.h"
+
+#include <string.h>
+#include "conv/conv2d.h"
+#include "protocol.h"
+#include "layer_config.h"
+#include "quant_params.h"
+
+namespace block {
+
+struct BlockShape {
+    uint32_t in_ch, mid_ch, out_ch;
+    int k, stride, pad;
+    int in_w, win_w, out_w; // win_w is the padded width of the rolling window
+};
+
+static BlockShape get_shape(const BlockLayer *layers, uint8_t num_layers, const BlockArgs *args) {
+    const LayerConfig *dw = layers[num_layers - 2].cfg;
+    BlockShape s;
+    s.in_ch = layers[0].cfg->input_channels;
+    s.mid_ch = dw->input_channels;
+    s.out_ch = layers[num_layers - 1].cfg->output_channels;
+    s.k = dw->kernel_size;
+    s.stride = dw->stride;
+    s.pad = dw->padding;
+    s.in_w = args->in_w;
+    s.win_w = args->in_w + 2 * dw->padding;
+    s.out_w = (s.win_w - s.k) / s.stride + 1;
+    return s;
+}
+
+size_t scratch_size(const BlockLayer *layers, uint8_t num_layers, const BlockArgs *args) {
+    BlockShape s = get_shape(layers, num_layers, args);
+    size_t size = (size_t)s.mid_ch * s.k * s.win_w; // rolling window
+    // channel-last rows are contiguous: no gathered input row and the projection writes the output directly
+    if (num_layers == 3) {
+        size += (args->hwc ? 0 : (size_t)s.in_ch * s.in_w) + (size_t)s.mid_ch * s.in_w; // gathered input row + expanded row
+    }
+    size += (size_t)s.mid_ch * s.out_w + (args->hwc ? 0 : (size_t)s.out_ch * s.out_w); // depthwise row + projected row
+    return size;
+}
+
+void residual_add(uint8_t *out, const uint8_t *res, size_t count, const ResidualParams *params) {
+    const int64_t round = params->shift > 0 ? (int64_t)1 << (params->shift - 1) : 0;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t acc = (int64_t)((int32_t)out[i] - params->zp_out) * params->mult_out +
+                      (int64_t)((int32_t)res[i] - params->zp_res) * params->mult_res;
+        int32_t val = params->zp_sum + (int32_t)((acc + round) >> params->shift);
+        out[i] = (uint8_t) max(0, min(255, val));
+    }
+}
+
+// channel-last version of the loop below: input rows and output rows are contiguous [W][C] runs,
+// so no gathering is needed and the window slides with a single memmove
+static void _inverted_residual_hwc(const uint8_t *input, uint8_t *output, uint8_t *scratch, const BlockShape &s,
+                                   const BlockLayer *exp, const BlockLayer &dw, const BlockLayer &proj,
+                                   KernelFn exp_kernel, KernelFn dw_kernel, KernelFn proj_kernel,
+                                   const BlockArgs *args, const ResidualParams *residual) {
+    const uint8_t pad_value = (uint8_t)dw.qp->input_zero_point;
+    const size_t slot_size = (size_t)s.win_w * s.mid_ch;
+    uint8_t *window = scratch; // [k][win_w][mid_ch]
+    uint8_t *exp_row = window + s.k * slot_size; // [in_w][mid_ch]
+    uint8_t *dw_row = exp_row + (exp ? (size_t)s.in_w * s.mid_ch : 0); // [out_w][mid_ch]
+    const size_t in_row_size = (size_t)s.in_w * s.in_ch;
+    const int in_row_start = max(0, (int)(args->out_row_start * s.stride) - s.pad);
+
+    auto fill_slot = [&](int slot, int y) {
+        uint8_t *dst = window + slot * slot_size;
+        const int local = y - in_row_start;
+        if (y < 0 || local < 0 || local >= args->in_h) {
+            memset(dst, pad_value, slot_size);
+            return;
+        }
+        const uint8_t *src = input + local * in_row_size;
+        if (exp) {
+            KernelArgs exp_args = {1, (uint16_t)s.in_w, 0, s.mid_ch, exp->act_min, exp->act_max, true, 1};
+            exp_kernel(src, exp->weights, exp->bias, exp_row, exp->cfg, exp->qp, &exp_args);
+            src = exp_row;
+        }
+        memset(dst, pad_value, (size_t)s.pad * s.mid_ch);
+        memcpy(dst + (size_t)s.pad * s.mid_ch, src, (size_t)s.in_w * s.mid_ch);
+        memset(dst + (size_t)(s.pad + s.in_w) * s.mid_ch, pad_value, (size_t)s.pad * s.mid_ch);
+    };
+
+    KernelArgs dw_args = {(uint16_t)s.k, (uint16_t)s.win_w, 0, s.mid_ch, dw.act_min, dw.act_max, true, 1};
+    KernelArgs proj_args = {1, (uint16_t)s.out_w, 0, s.out_ch, proj.act_min, proj.act_max, true, 1};
+    for (int r = 0; r < args->out_h; ++r) {
+        const int y = (int)(args->out_row_start + r) * s.stride - s.pad;
+        if (r == 0 || s.stride >= s.k) {
+            for (int j = 0; j < s.k; ++j) {
+                fill_slot(j, y + j);
+            }
+        } else {
+            const int keep = s.k - s.stride;
+            memmove(window, window + s.stride * slot_size, keep * slot_size);
+            for (int j = keep; j < s.k; ++j) {
+                fill_slot(j, y + j);
+            }
+        }
+
+        dw_kernel(window, dw.weights, dw.bias, dw_row, dw.cfg, dw.qp, &dw_args);
+        // the projected row is already in output order
+        uint8_t *out_row = output + (size_t)r * s.out_w * s.out_ch;
+        proj_kernel(dw_row, proj.weights, proj.bias, out_row, proj.cfg, proj.qp, &proj_args);
+        if (residual) {
+            const int local = (int)(args->out_row_start + r) - in_row_start;
+            residual_add(out_row, input + local * in_row_size, (size_t)s.out_w * s.out_ch, residual);
+        }
+    }
+}
+
+bool inverted_residual(const uint8_t *input, uint8_t *output, uint8_t *scratch, size_t scratch_len,
+                       const BlockLayer *layers, uint8_t num_layers, const BlockArgs *args,
+                       const ResidualParams *residual) {
+    if (num_layers != 2 && num_layers != 3) {
+        return false;
+    }
+    if (scratch_size(layers, num_layers, args) > scratch_len) {
+        return false;
+    }
+    const BlockShape s = get_shape(layers, num_layers, args);
+    const BlockLayer *exp = num_layers == 3 ? &layers[0] : nullptr;
+    const BlockLayer &dw = layers[num_layers - 2];
+    const BlockLayer &proj = layers[num_layers - 1];
+    // padding of the depthwise input, same value the coordinator pads with when the layers run one by one
+    const uint8_t pad_value = (uint8_t)dw.qp->input_zero_point;
+
+    // scratch layout
+    uint8_t *window = scratch; // [mid_ch][k][win_w]
+    uint8_t *next = window + (size_t)s.mid_ch * s.k * s.win_w;
+    uint8_t *in_row = nullptr, *exp_row = nullptr;
+    if (exp) {
+        in_row = next; // [in_ch][in_w]
+        exp_row = in_row + (size_t)s.in_ch * s.in_w; // [mid_ch][in_w]
+        next = exp_row + (size_t)s.mid_ch * s.in_w;
+    }
+    uint8_t *dw_row = next; // [mid_ch][out_w]
+    uint8_t *proj_row = dw_row + (size_t)s.mid_ch * s.out_w; // [out_ch][out_w]
+
+    // kernels specialized on the layers' kernel size and stride, looked up once per band
+    const KernelFn exp_kernel = exp ? conv2d::specialized_conv2d(false, exp->cfg->kernel_size, exp->cfg->stride) : nullptr;
+    const KernelFn dw_kernel = conv2d::specialized_conv2d(true, s.k, s.stride);
+    const KernelFn proj_kernel = conv2d::specialized_conv2d(false, proj.cfg->kernel_size, proj.cfg->stride);
+
+    if (args->hwc) {
+        _inverted_residual_hwc(input, output, scratch, s, exp, dw, proj, exp_kernel, dw_kernel, proj_kernel, args, residual);
+        return true;
+    }
+
+    // first block input row we were sent
+    const int in_row_start = max(0, (int)(args->out_row_start * s.stride) - s.pad);
+    const size_t plane = (size_t)s.k * s.win_w;
+
+    // fill window row `slot` with block input row `y` (absolute), expanded if the block has an exp layer
+    auto fill_slot = [&](int slot, int y) {
+        const int local = y - in_row_start;
+        if (y < 0 || local < 0 || local >= args->in_h) {
+            for (uint32_t c = 0; c < s.mid_ch; ++c) {
+                memset(window + c * plane + slot * s.win_w, pad_value, s.win_w);
+            }
+            return;
+        }
+        const uint8_t *src = input + (size_t)local * s.in_w;
+        size_t src_stride = (size_t)args->in_h * s.in_w;
+        if (exp) {
+            for (uint32_t c = 0; c < s.in_ch; ++c) {
+                memcpy(in_row + c * s.in_w, input + c * src_stride + (size_t)local * s.in_w, s.in_w);
+            }
+            KernelArgs exp_args = {1, (uint16_t)s.in_w, 0, s.mid_ch, exp->act_min, exp->act_max, false, 1};
+            exp_kernel(in_row, exp->weights, exp->bias, exp_row, exp->cfg, exp->qp, &exp_args);
+            src = exp_row;
+            src_stride = s.in_w;
+        }
+        for (uint32_t c = 0; c < s.mid_ch; ++c) {
+            uint8_t *dst = window + c * plane + slot * s.win_w;
+            memset(dst, pad_value, s.pad);
+            memcpy(dst + s.pad, src + c * src_stride, s.in_w);
+            memset(dst + s.pad + s.in_w, pad_value, s.pad);
+        }
+    };
+
+    KernelArgs dw_args = {(uint16_t)s.k, (uint16_t)s.win_w, 0, s.mid_ch, dw.act_min, dw.act_max, false, 1};
+    KernelArgs proj_args = {1, (uint16_t)s.out_w, 0, s.out_ch, proj.act_min, proj.act_max, false, 1};
+    for (int r = 0; r < args->out_h; ++r) {
+        const int y = (int)(args->out_row_start + r) * s.stride - s.pad; // top input row of this output row
+        if (r == 0 || s.stride >= s.k) {
+            for (int j = 0; j < s.k; ++j) {
+                fill_slot(j, y + j);
+            }
+        } else {
+            // slide the window down by stride rows, only the new rows are expanded
+            const int keep = s.k - s.stride;
+            for (uint32_t c = 0; c < s.mid_ch; ++c) {
+                memmove(window + c * plane, window + c * plane + s.stride * s.win_w, keep * s.win_w);
+            }
+            for (int j = keep; j < s.k; ++j) {
+                fill_slot(j, y + j);
+            }
+        }
+
+        dw_kernel(window, dw.weights, dw.bias, dw_row, dw.cfg, dw.qp, &dw_args);
+        proj_kernel(dw_row, proj.weights, proj.bias, proj_row, proj.cfg, proj.qp, &proj_args);
+        for (uint32_t c = 0; c < s.out_ch; ++c) {
+            uint8_t *dst = output + ((size_t)c * args->out_h + r) * s.out_w;
+            memcpy(dst, proj_row + c * s.out_w, s.out_w);
+            if (residual) {
+                // stride 1: output row r lines up with block input row out_row_start + r
+                const int local = (int)(args->out_row_start + r) - in_row_start;
+                residual_add(dst, input + ((size_t)c * args->in_h + local) * s.in_w, s.out_w, residual);
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace block
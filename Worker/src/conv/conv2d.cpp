@@ -2,68 +2,229 @@
 
 #include <arm_math.h>
 #include <memory>
+#include <vector>
 #include <assert.h>
+#include <string.h>
 
 #include "weights.h"
 #include "layer_config.h"
 #include "quant_params.h"
 
 namespace conv2d {
+
+// [lo, hi] of `count` input values with the zero point subtracted
+static void _input_range(const uint8_t *input, size_t count, int32_t zero_point, int32_t *lo, int32_t *hi) {
+    uint8_t min_val = 255, max_val = 0;
+    for (size_t i = 0; i < count; ++i) {
+        min_val = min(min_val, input[i]);
+        max_val = max(max_val, input[i]);
+    }
+    *lo = (int32_t) min_val - zero_point;
+    *hi = (int32_t) max_val - zero_point;
+}
+
+// If the requant clamp provably saturates every output of a channel, i.e. the accumulator bounds
+// over inputs in [lo, hi] requantize to act_min (or act_max) at best, returns that value, -1 otherwise.
+// Channels a ReLU kills on the whole tile then cost a pass over their weights instead of the MACs.
+template <typename T>
+static int _saturated_output(const T *weights, size_t count, int32_t weight_zero_point, int32_t bias,
+                             float multiplier, int32_t lo, int32_t hi, int32_t output_zero_point, const KernelArgs *args) {
+    if (!(multiplier > 0.0f)) {
+        return -1;
+    }
+    int64_t pos = 0, neg = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t w = (int32_t) weights[i] - weight_zero_point;
+        if (w > 0) pos += w; else neg += w;
+    }
+    const int64_t acc_max = bias + pos * hi + neg * lo;
+    const int64_t acc_min = bias + pos * lo + neg * hi;
+    if (acc_max > INT32_MAX || acc_min < INT32_MIN) {
+        return -1;
+    }
+    // requantize is monotonic in acc
+    if (requantize((int32_t) acc_max, multiplier, output_zero_point, args) == args->act_min) {
+        return args->act_min;
+    }
+    if (requantize((int32_t) acc_min, multiplier, output_zero_point, args) == args->act_max) {
+        return args->act_max;
+    }
+    return -1;
+}
     
-void native_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
+// Channel-last variants: input [in_h][in_w][C], output [out_h][out_w][oc_count]. A pointwise output
+// is one contiguous dot product over the pixel's channels, depthwise runs along contiguous channel
+// vectors. Same arithmetic as the [C][H][W] kernels, so both layouts give bit-identical values.
+template <int K, int S>
+static void _native_conv2d_hwc(const uint8_t *input, const int8_t *weights, const int32_t *bias,
+                               uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
+                               const KernelArgs *args) {
+    const int k = K ? K : cfg->kernel_size;
+    const int stride = S ? S : cfg->stride;
+    const int in_h = args->in_h, in_w = args->in_w;
+    const int out_h = (in_h - k) / stride + 1;
+    const int out_w = (in_w - k) / stride + 1;
+    const int input_channels = cfg->input_channels;
+    const size_t filter_size = input_channels * k * k;
+    const size_t oc_count = args->oc_count;
+    const int32_t input_zero_point = qp->input_zero_point;
+    int32_t in_lo, in_hi;
+    _input_range(input, input_channels * in_h * in_w, input_zero_point, &in_lo, &in_hi);
+
+    for (size_t oc = 0; oc < oc_count; ++oc) {
+        const size_t g_oc = args->oc_start + oc;
+        int32_t bias_val = bias[g_oc];
+        int weight_zero_point = qp->weight_zps[g_oc]; // must be 0
+        float multiplier = (qp->input_scale * qp->weight_scales[g_oc]) / qp->output_scale;
+        const int8_t *filter = weights + g_oc * filter_size; // [Cin][k][k]
+        const int saturated = _saturated_output(filter, filter_size, weight_zero_point, bias_val,
+                                                multiplier, in_lo, in_hi, qp->output_zero_point, args);
+        if (saturated >= 0) {
+            for (int p = 0; p < out_h * out_w; ++p) {
+                output[p * oc_count + oc] = saturated;
+            }
+            continue;
+        }
+
+        for (int oh = 0; oh < out_h; ++oh) {
+            for (int ow = 0; ow < out_w; ++ow) {
+                int32_t acc = bias_val;
+                const uint8_t *window = input + (oh * stride * in_w + ow * stride) * input_channels;
+                for (int kh = 0; kh < k; ++kh) {
+                    for (int kw = 0; kw < k; ++kw) {
+                        const uint8_t *pixel = window + (kh * in_w + kw) * input_channels;
+                        const int8_t *w = filter + kh * k + kw;
+                        for (int ic = 0; ic < input_channels; ++ic) {
+                            acc += ((int32_t) pixel[ic] - input_zero_point) * ((int32_t) w[ic * k * k] - weight_zero_point);
+                        }
+                    }
+                }
+                output[(oh * out_w + ow) * oc_count + oc] = requantize(acc, multiplier, qp->output_zero_point, args);
+            }
+        }
+    }
+}
+
+// channels of a HWC depthwise tile accumulated together, wider tiles go through them in groups of this many
+static const size_t DW_CHANNEL_GROUP = 256;
+static int32_t dw_acc[DW_CHANNEL_GROUP];
+static float dw_multiplier[DW_CHANNEL_GROUP];
+
+template <int K, int S>
+static void _depthwise_conv2d_hwc(const uint8_t *input, const int8_t *weights, const int32_t *bias,
+                                  uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
+                                  const KernelArgs *args) {
+    const int k = K ? K : cfg->kernel_size;
+    const int stride = S ? S : cfg->stride;
+    const int in_h = args->in_h, in_w = args->in_w;
+    const int out_h = (in_h - k) / stride + 1;
+    const int out_w = (in_w - k) / stride + 1;
+    const size_t channels = args->oc_count; // the input holds only the task's channels
+    const int32_t input_zero_point = qp->input_zero_point;
+
+    // per-channel accumulators and multipliers; the filters of a group ([256][k][k], a few KB) stay in cache
+    for (size_t group = 0; group < channels; group += DW_CHANNEL_GROUP) {
+        const size_t count = min(channels - group, DW_CHANNEL_GROUP);
+        const int8_t *filters = weights + (args->oc_start + group) * k * k;
+        const int32_t *weight_zps = qp->weight_zps + args->oc_start + group;
+        const int32_t *group_bias = bias + args->oc_start + group;
+        for (size_t c = 0; c < count; ++c) {
+            dw_multiplier[c] = (qp->input_scale * qp->weight_scales[args->oc_start + group + c]) / qp->output_scale;
+        }
+
+        for (int oh = 0; oh < out_h; ++oh) {
+            for (int ow = 0; ow < out_w; ++ow) {
+                for (size_t c = 0; c < count; ++c) {
+                    dw_acc[c] = group_bias[c];
+                }
+                const uint8_t *window = input + (oh * stride * in_w + ow * stride) * channels + group;
+                for (int kh = 0; kh < k; ++kh) {
+                    for (int kw = 0; kw < k; ++kw) {
+                        const uint8_t *pixel = window + (kh * in_w + kw) * channels;
+                        const int8_t *w = filters + kh * k + kw;
+                        for (size_t c = 0; c < count; ++c) {
+                            dw_acc[c] += ((int32_t) pixel[c] - input_zero_point) * ((int32_t) w[c * k * k] - weight_zps[c]);
+                        }
+                    }
+                }
+                uint8_t *out = output + (oh * out_w + ow) * channels + group;
+                for (size_t c = 0; c < count; ++c) {
+                    out[c] = requantize(dw_acc[c], dw_multiplier[c], qp->output_zero_point, args);
+                }
+            }
+        }
+    }
+}
+
+// K and S are the kernel size and stride, 0 reads them from cfg. With constants the tap loops
+// fully unroll, see specialized_conv2d below for the shapes that get them
+template <int K, int S>
+void native_conv2d_k(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
                     uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
-                    const uint8_t in_h, const uint8_t in_w) {
+                    const KernelArgs *args) {
+    if (args->hwc) {
+        _native_conv2d_hwc<K, S>(input, weights, bias, output, cfg, qp, args);
+        return;
+    }
     // native convolution implementation for testing
     // const int in_h = 4, in_w = 4;
     // const int out_h = (in_h + 2 * cfg->padding - cfg->kernel_size) / cfg->stride + 1;
     // const int out_w = (in_w + 2 * cfg->padding - cfg->kernel_size) / cfg->stride + 1;
-    const int out_h = (in_h - cfg->kernel_size) / cfg->stride + 1;
-    const int out_w = (in_w - cfg->kernel_size) / cfg->stride + 1;
-
-    for (size_t oc = 0; oc < cfg->output_channels; ++oc) {
-        int32_t bias_val = bias[oc];
-        float weight_scale = qp->weight_scales[oc];
-        int weight_zero_point = qp->weight_zps[oc]; // must be 0
+    const int k = K ? K : cfg->kernel_size;
+    const int stride = S ? S : cfg->stride;
+    const int in_h = args->in_h, in_w = args->in_w;
+    const int out_h = (in_h - k) / stride + 1;
+    const int out_w = (in_w - k) / stride + 1;
+    const int input_channels = cfg->input_channels;
+    const size_t filter_size = input_channels * k * k;
+    const size_t plane = in_h * in_w;
+    const int32_t input_zero_point = qp->input_zero_point;
+    int32_t in_lo, in_hi;
+    _input_range(input, input_channels * plane, input_zero_point, &in_lo, &in_hi);
+
+    for (size_t oc = 0; oc < args->oc_count; ++oc) {
+        const size_t g_oc = args->oc_start + oc; // index into the layer's weights/bias/scales
+        int32_t bias_val = bias[g_oc];
+        float weight_scale = qp->weight_scales[g_oc];
+        int weight_zero_point = qp->weight_zps[g_oc]; // must be 0
         float multiplier = (qp->input_scale * weight_scale) / qp->output_scale;
+        const int8_t *filter = weights + g_oc * filter_size;
+        const int saturated = _saturated_output(filter, filter_size, weight_zero_point, bias_val,
+                                                multiplier, in_lo, in_hi, qp->output_zero_point, args);
+        if (saturated >= 0) {
+            memset(output + oc * out_h * out_w, saturated, out_h * out_w);
+            continue;
+        }
 
-        for (size_t oh = 0; oh < out_h; ++oh) {
-            for (size_t ow = 0; ow < out_w; ++ow) {
+        for (int oh = 0; oh < out_h; ++oh) {
+            for (int ow = 0; ow < out_w; ++ow) {
                 int32_t acc = bias_val;
 
-                // int start_y = oh * cfg->stride - cfg->padding; // input y coordinate corresponding to output (oh, ow)
-                // int start_x = ow * cfg->stride - cfg->padding; // input x coordinate corresponding to output (oh, ow)
-                int start_y = oh * cfg->stride; // input y coordinate corresponding to output (oh, ow)
-                int start_x = ow * cfg->stride; // input x coordinate corresponding to output (oh, ow)
-
-                for (size_t ic = 0; ic < cfg->input_channels; ++ic) {
-                    for (size_t kh = 0; kh < cfg->kernel_size; ++kh) {
-                        for (size_t kw = 0; kw < cfg->kernel_size; ++kw) {
-                            int in_y = start_y + kh;
-                            int in_x = start_x + kw;
-
-                            // Check for valid input coordinates (handle padding)
-                            if (in_y >= 0 && in_y < in_h && in_x >= 0 && in_x < in_w) {
-                                int32_t input_val = (int32_t) input[ic * in_h * in_w + in_y * in_w + in_x] - qp->input_zero_point;
-                                int32_t weight_val = (int32_t) weights[oc * cfg->input_channels * cfg->kernel_size * cfg->kernel_size +
-                                                            ic * cfg->kernel_size * cfg->kernel_size +
-                                                            kh * cfg->kernel_size + kw] - weight_zero_point;
-                                acc += input_val * weight_val;
-                            }
+                // the coordinator pads the tile, so the window never leaves the input:
+                // (out_h - 1) * stride + k <= in_h
+                const uint8_t *window = input + oh * stride * in_w + ow * stride;
+                for (int ic = 0; ic < input_channels; ++ic) {
+                    const uint8_t *in_c = window + ic * plane;
+                    const int8_t *w_c = filter + ic * k * k;
+                    for (int kh = 0; kh < k; ++kh) {
+                        for (int kw = 0; kw < k; ++kw) {
+                            int32_t input_val = (int32_t) in_c[kh * in_w + kw] - input_zero_point;
+                            int32_t weight_val = (int32_t) w_c[kh * k + kw] - weight_zero_point;
+                            acc += input_val * weight_val;
                         }
                     }
                 }
 
-                // requantize
-                float acc_float = acc * multiplier + qp->output_zero_point;
-
 #ifdef DEBUG
+                float acc_float = acc * multiplier + qp->output_zero_point;
                 if (oc == 1 && oh == 0 && ow == 0) {
                     Serial.printf("acc: %d, multiplier: %f, output_zero_point: %d, acc_float: %f\n", acc, multiplier, qp->output_zero_point, acc_float);
                     Serial.flush();
                 }
 #endif
+                // requantize
                 int o_idx = oc * out_h * out_w + oh * out_w + ow;
-                output[o_idx] = (uint8_t) max( 0, min(255, (int32_t) roundf(acc_float) ) );      
+                output[o_idx] = requantize(acc, multiplier, qp->output_zero_point, args);
             }
         }
 #ifdef DEBUG
@@ -85,7 +246,7 @@ void native_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *b
                 Serial.printf("Weight for input channel %d: \n", ic);
                 for (size_t kh = 0; kh < cfg->kernel_size; ++kh) {
                     for (size_t kw = 0; kw < cfg->kernel_size; ++kw) {
-                        Serial.printf("%d ", weights[oc * cfg->input_channels * cfg->kernel_size * cfg->kernel_size +
+                        Serial.printf("%d ", weights[g_oc * cfg->input_channels * cfg->kernel_size * cfg->kernel_size +
                                                         ic * cfg->kernel_size * cfg->kernel_size +
                                                         kh * cfg->kernel_size + kw]);
                     }
@@ -103,14 +264,21 @@ void native_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *b
     }
 }
 
+void native_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
+                    uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
+                    const KernelArgs *args) {
+    native_conv2d_k<0, 0>(input, weights, bias, output, cfg, qp, args);
+}
+
 // Im2Col + GeMM implementations
 // 1. input -> im2col buffer : [in_c, in_h, in_w] -> [in_c * kernel_h * kernel_w, out_h * out_w]
 // 2. weight -> weight buffer : [out_c, in_c, kernel_h, kernel_w] -> [out_c, in_c * kernel_h * kernel_w]
 // 3. GeMM : weight_buffer @ im2col_buffer + bias -> output_buffer 
 // 4. requantize and transform output
 void _im2col_conv2d(const uint8_t *input, std::vector<q15_t> &col_buffer, const LayerConfig *cfg, const QuantParams *qp,
-                    const uint8_t in_h, const uint8_t in_w) {
+                    const KernelArgs *args) {
     // const int in_h = 4, in_w = 4;
+    const int in_h = args->in_h, in_w = args->in_w;
     const int out_h = (in_h - cfg->kernel_size) / cfg->stride + 1;
     const int out_w = (in_w - cfg->kernel_size) / cfg->stride + 1;
 
@@ -141,24 +309,27 @@ void _im2col_conv2d(const uint8_t *input, std::vector<q15_t> &col_buffer, const
     }
 }
 
-void _prepare_weights(const int8_t *weights, std::vector<q15_t> &weight_buffer, const LayerConfig *cfg, const QuantParams *qp) {
-    // weights [out_c, in_c, kh, kw] -> [out_c, in_c * kh * kw]
+void _prepare_weights(const int8_t *weights, std::vector<q15_t> &weight_buffer, const LayerConfig *cfg, const QuantParams *qp,
+                    const KernelArgs *args) {
+    // weights [out_c, in_c, kh, kw] -> [out_c, in_c * kh * kw], only the channels of the slice
     // TODO maybe we can use mem replacement for better mem usage
     const int col_rows = cfg->input_channels * cfg->kernel_size * cfg->kernel_size;
     int weight_idx = 0;
 
-    for (size_t oc = 0; oc < cfg->output_channels; ++oc) {
-        int32_t weight_zero_point = qp->weight_zps[oc];
+    for (size_t oc = 0; oc < args->oc_count; ++oc) {
+        const size_t g_oc = args->oc_start + oc;
+        int32_t weight_zero_point = qp->weight_zps[g_oc];
         for (size_t i = 0; i < col_rows; ++i) {
-            weight_buffer[weight_idx++] = (q15_t) (weights[oc * col_rows + i] - weight_zero_point);
+            weight_buffer[weight_idx++] = (q15_t) (weights[g_oc * col_rows + i] - weight_zero_point);
         }
     }
 }
 
 void _gemm(q15_t *col_buffer, q15_t *weight_buffer,
             const int32_t *bias, uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
-            const uint8_t in_h, const uint8_t in_w) {
+            const KernelArgs *args) {
     // const int in_h = 4, in_w = 4;
+    const int in_h = args->in_h, in_w = args->in_w;
     const int out_h = (in_h - cfg->kernel_size) / cfg->stride + 1;
     const int out_w = (in_w - cfg->kernel_size) / cfg->stride + 1;
 
@@ -166,18 +337,31 @@ void _gemm(q15_t *col_buffer, q15_t *weight_buffer,
     const int col_cols = out_h * out_w;
 
     int out_idx = 0;
+    // the col buffer already has the input zero point subtracted
+    int32_t in_lo = 0, in_hi = 0;
+    for (size_t i = 0; i < (size_t) col_cols * col_rows; ++i) {
+        in_lo = min(in_lo, (int32_t) col_buffer[i]);
+        in_hi = max(in_hi, (int32_t) col_buffer[i]);
+    }
 
-    for (size_t oc = 0; oc < cfg->output_channels; ++oc) {
+    for (size_t oc = 0; oc < args->oc_count; ++oc) {
+        const size_t g_oc = args->oc_start + oc;
         int64_t acc_q63 = 0;
-        float multiplier = (qp->input_scale * qp->weight_scales[oc]) / qp->output_scale;
+        float multiplier = (qp->input_scale * qp->weight_scales[g_oc]) / qp->output_scale;
+        const int saturated = _saturated_output(weight_buffer + oc * col_rows, col_rows, 0, bias[g_oc],
+                                                multiplier, in_lo, in_hi, qp->output_zero_point, args);
+        if (saturated >= 0) {
+            memset(output + out_idx, saturated, col_cols);
+            out_idx += col_cols;
+            continue;
+        }
 
         for (size_t p = 0; p < col_cols; ++p) {
             arm_dot_prod_q15(weight_buffer + oc * col_rows, col_buffer + p * col_rows, col_rows, &acc_q63);
 
-            int32_t acc = (int32_t) acc_q63 + bias[oc];
+            int32_t acc = (int32_t) acc_q63 + bias[g_oc];
             
-            float acc_float = acc * multiplier + qp->output_zero_point;
-            output[out_idx++] = (uint8_t) max( 0, min(255, (int32_t) roundf(acc_float) ) );
+            output[out_idx++] = requantize(acc, multiplier, qp->output_zero_point, args);
         }
     }
 
@@ -185,8 +369,9 @@ void _gemm(q15_t *col_buffer, q15_t *weight_buffer,
 
 void im2col_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
                     uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
-                    const uint8_t in_h, const uint8_t in_w) {
+                    const KernelArgs *args) {
     // const int in_h = 4, in_w = 4;
+    const int in_h = args->in_h, in_w = args->in_w;
     const int out_h = (in_h - cfg->kernel_size) / cfg->stride + 1;
     const int out_w = (in_w - cfg->kernel_size) / cfg->stride + 1;
 
@@ -195,73 +380,105 @@ void im2col_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *b
     
     // allocate buffers TODO maybe static allocation
     std::vector<q15_t> col_buffer(col_cols * col_rows); // it's a transpose of ideal im2col output
-    std::vector<q15_t> weight_buffer(cfg->output_channels * col_rows); // TODO We can use a conv_work_space struct to reuse the buffer
+    std::vector<q15_t> weight_buffer(args->oc_count * col_rows); // TODO We can use a conv_work_space struct to reuse the buffer
 
     // 1. im2col
-    _im2col_conv2d(input, col_buffer, cfg, qp, in_h, in_w);
+    _im2col_conv2d(input, col_buffer, cfg, qp, args);
     // 2. transform weights
-    _prepare_weights(weights, weight_buffer, cfg, qp);
+    _prepare_weights(weights, weight_buffer, cfg, qp, args);
     // 3. GeMM with DSP
-    _gemm(col_buffer.data(), weight_buffer.data(), bias, output, cfg, qp, in_h, in_w);
+    _gemm(col_buffer.data(), weight_buffer.data(), bias, output, cfg, qp, args);
+}
+
+size_t im2col_buffer_size(const LayerConfig *cfg, const KernelArgs *args) {
+    const size_t out_h = (args->in_h - cfg->kernel_size) / cfg->stride + 1;
+    const size_t out_w = (args->in_w - cfg->kernel_size) / cfg->stride + 1;
+    const size_t col_rows = cfg->input_channels * cfg->kernel_size * cfg->kernel_size;
+    return (out_h * out_w + args->oc_count) * col_rows * sizeof(q15_t);
 }
 
 
 // depthwise conv
-void depthwise_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
+// the input only holds the channels of this task (args->oc_count planes), weights, bias and
+// scales are indexed from args->oc_start so a channel slice needs no halo from other channels
+template <int K, int S>
+void depthwise_conv2d_k(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
                     uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, 
-                    const uint8_t in_h, const uint8_t in_w) {
+                    const KernelArgs *args) {
     assert(cfg->input_channels == cfg->output_channels);
+    if (args->hwc) {
+        _depthwise_conv2d_hwc<K, S>(input, weights, bias, output, cfg, qp, args);
+        return;
+    }
+    const int k = K ? K : cfg->kernel_size;
+    const int stride = S ? S : cfg->stride;
+    const int in_h = args->in_h, in_w = args->in_w;
 
     // const int out_h = (in_h + 2 * cfg->padding - cfg->kernel_size) / cfg->stride + 1;
     // const int out_w = (in_w + 2 * cfg->padding - cfg->kernel_size) / cfg->stride + 1;
 
-    const int out_h = (in_h - cfg->kernel_size) / cfg->stride + 1;
-    const int out_w = (in_w - cfg->kernel_size) / cfg->stride + 1;
-
+    const int out_h = (in_h - k) / stride + 1;
+    const int out_w = (in_w - k) / stride + 1;
+    const size_t plane = in_h * in_w;
+    const int32_t input_zero_point = qp->input_zero_point;
 
-    for (size_t oc = 0; oc < cfg->output_channels; ++oc) {
-        int32_t bias_val = bias[oc];
-        float weight_scale = qp->weight_scales[oc];
-        int weight_zero_point = qp->weight_zps[oc]; // must be 0
+    for (size_t oc = 0; oc < args->oc_count; ++oc) {
+        const size_t g_oc = args->oc_start + oc;
+        int32_t bias_val = bias[g_oc];
+        float weight_scale = qp->weight_scales[g_oc];
+        int weight_zero_point = qp->weight_zps[g_oc]; // must be 0
         float multiplier = (qp->input_scale * weight_scale) / qp->output_scale;
+        const uint8_t *in_c = input + oc * plane;
+        const int8_t *filter = weights + g_oc * k * k;
+        int32_t in_lo, in_hi;
+        _input_range(in_c, plane, input_zero_point, &in_lo, &in_hi);
+        const int saturated = _saturated_output(filter, k * k, weight_zero_point, bias_val,
+                                                multiplier, in_lo, in_hi, qp->output_zero_point, args);
+        if (saturated >= 0) {
+            memset(output + oc * out_h * out_w, saturated, out_h * out_w);
+            continue;
+        }
 
-        for (size_t oh = 0; oh < out_h; ++oh) {
-            for (size_t ow = 0; ow < out_w; ++ow) {
+        for (int oh = 0; oh < out_h; ++oh) {
+            for (int ow = 0; ow < out_w; ++ow) {
                 int32_t acc = bias_val;
 
-                // int start_y = oh * cfg->stride - cfg->padding; // input y coordinate corresponding to output (oh, ow)
-                // int start_x = ow * cfg->stride - cfg->padding; // input x coordinate corresponding to output (oh, ow)
-
-                int start_y = oh * cfg->stride; // input y coordinate corresponding to output (oh, ow)
-                int start_x = ow * cfg->stride; // input x coordinate corresponding to output (oh, ow)
-
-                for (size_t kh = 0; kh < cfg->kernel_size; ++kh) {
-                    for (size_t kw = 0; kw < cfg->kernel_size; ++kw) {
-                        int in_y = start_y + kh;
-                        int in_x = start_x + kw;
-                        
-                        // Check for valid input coordinates (handle padding)
-                        if (in_y >= 0 && in_y < in_h && in_x >= 0 && in_x < in_w) {
-                            int32_t input_val = (int32_t) input[oc * in_h * in_w + in_y * in_w + in_x] - qp->input_zero_point;
-                            int32_t weight_val = (int32_t) weights[oc * cfg->kernel_size * cfg->kernel_size +
-                                                        kh * cfg->kernel_size + kw] - weight_zero_point;
-                            acc += input_val * weight_val;
-                        }
+                // padded by the coordinator (or the fused block), the window never leaves the input
+                const uint8_t *window = in_c + oh * stride * in_w + ow * stride;
+                for (int kh = 0; kh < k; ++kh) {
+                    for (int kw = 0; kw < k; ++kw) {
+                        int32_t input_val = (int32_t) window[kh * in_w + kw] - input_zero_point;
+                        int32_t weight_val = (int32_t) filter[kh * k + kw] - weight_zero_point;
+                        acc += input_val * weight_val;
                     }
                 }
 
                 // requantize
-                float acc_float = acc * multiplier + qp->output_zero_point;
                 int o_idx = oc * out_h * out_w + oh * out_w + ow;
-                output[o_idx] = (uint8_t) max( 0, min(255, (int32_t) roundf(acc_float) ) );      
+                output[o_idx] = requantize(acc, multiplier, qp->output_zero_point, args);
             }
         }
 
     }
 }
 
+void depthwise_conv2d(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
+                    uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, 
+                    const KernelArgs *args) {
+    depthwise_conv2d_k<0, 0>(input, weights, bias, output, cfg, qp, args);
+}
 
-
-
+// the shapes MobileNetV2 uses, the only place they are listed: returning them instantiates the templates
+KernelFn specialized_conv2d(bool depthwise, int kernel_size, int stride) {
+    if (depthwise) {
+        if (kernel_size == 3 && stride == 1) return depthwise_conv2d_k<3, 1>;
+        if (kernel_size == 3 && stride == 2) return depthwise_conv2d_k<3, 2>;
+        return depthwise_conv2d;
+    }
+    if (kernel_size == 1 && stride == 1) return native_conv2d_k<1, 1>;
+    if (kernel_size == 3 && stride == 1) return native_conv2d_k<3, 1>;
+    if (kernel_size == 3 && stride == 2) return native_conv2d_k<3, 2>;
+    return native_conv2d;
+}
     
 } // namespace conv2d
\ No newline at end of file
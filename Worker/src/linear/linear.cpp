@@ -7,27 +7,42 @@
 
 namespace linear {
 
+#define LINEAR_BATCH_BLOCK 8 // input vectors accumulated together, each weight row is swept once per block
+
 void native_linear(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp) {
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args) {
     const uint32_t input_channels = cfg->input_channels;
-    const uint32_t output_channels = qp->num_channels; // use this num because it's distributed
+    const uint32_t output_channels = args->oc_count; // at most qp->num_channels because the weights are distributed
+    const uint32_t batch = args->batch > 1 ? args->batch : 1;
     
     for (size_t oc = 0; oc < output_channels; ++oc) {
-        int32_t acc = bias[oc];
-        float weight_scale = qp->weight_scales[oc];
-        int32_t weight_zp = qp->weight_zps[oc];
+        const size_t g_oc = args->oc_start + oc;
+        const int8_t *row = &weights[g_oc * input_channels];
+        float weight_scale = qp->weight_scales[g_oc];
+        int32_t weight_zp = qp->weight_zps[g_oc];
         float multiplier = (qp->input_scale * weight_scale) / qp->output_scale;
 
-        // weights @ input
-        for (size_t ic = 0; ic < input_channels; ++ic) {
-            int32_t input_val = (int32_t)input[ic] - qp->input_zero_point;
-            int32_t weight_val = (int32_t)weights[oc * input_channels + ic] - weight_zp;
-            acc += input_val * weight_val;
+        for (uint32_t first = 0; first < batch; first += LINEAR_BATCH_BLOCK) {
+            const uint32_t count = batch - first < LINEAR_BATCH_BLOCK ? batch - first : LINEAR_BATCH_BLOCK;
+            const uint8_t *vectors = &input[first * input_channels];
+            int32_t acc[LINEAR_BATCH_BLOCK];
+            for (uint32_t b = 0; b < count; ++b) {
+                acc[b] = bias[g_oc];
+            }
+
+            // weights @ inputs, one weight load per block of vectors
+            for (size_t ic = 0; ic < input_channels; ++ic) {
+                int32_t weight_val = (int32_t)row[ic] - weight_zp;
+                for (uint32_t b = 0; b < count; ++b) {
+                    acc[b] += ((int32_t)vectors[b * input_channels + ic] - qp->input_zero_point) * weight_val;
+                }
+            }
+
+            // requantize, class-major like TaskMessage::batch
+            for (uint32_t b = 0; b < count; ++b) {
+                output[oc * batch + first + b] = requantize(acc[b], multiplier, qp->output_zero_point, args);
+            }
         }
-
-        // requantize
-        float acc_float = acc * multiplier + qp->output_zero_point;
-        output[oc] = (uint8_t) max( 0, min( 255, (int32_t)roundf(acc_float)) );
     }
 }
 
@@ -36,38 +51,41 @@ void native_linear(const uint8_t *input, const int8_t *weights, const int32_t *b
 // because of the overhead of copying weights for each output channel. 
 // We need to find a better way to do this, maybe we can copy weights for multiple output channels at once and compute them together to amortize the overhead.
 void _dsp_linear(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp,
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args,
                         int16_t *input_buffer, int16_t *weight_buffer) {
     const uint32_t input_channels = cfg->input_channels;
-    const uint32_t output_channels = qp->num_channels; // use this num because it's distributed
+    const uint32_t output_channels = args->oc_count; // at most qp->num_channels because the weights are distributed
+    const uint32_t batch = args->batch > 1 ? args->batch : 1;
 
-    for (size_t i = 0; i < input_channels; ++i) {
+    for (size_t i = 0; i < input_channels * batch; ++i) {
         input_buffer[i] = (int16_t)input[i] - qp->input_zero_point;
     }
 
     for (size_t oc = 0; oc < output_channels; ++oc) {
+        const size_t g_oc = args->oc_start + oc;
         for (size_t ic = 0; ic < input_channels; ++ic) {
-            weight_buffer[ic] = (int16_t)weights[oc * input_channels + ic] - qp->weight_zps[oc];
+            weight_buffer[ic] = (int16_t)weights[g_oc * input_channels + ic] - qp->weight_zps[g_oc];
         }
 
-        int64_t acc_q63 = 0;
-        float multiplier = (qp->input_scale * qp->weight_scales[oc]) / qp->output_scale;
-        arm_dot_prod_q15(weight_buffer, input_buffer, input_channels, &acc_q63);
-        int32_t acc = (int32_t)acc_q63 + bias[oc];
-        float acc_float = acc * multiplier + qp->output_zero_point;
-        output[oc] = (uint8_t) max( 0, min(255, (int32_t) roundf(acc_float) ) );
+        // the converted weight row serves every vector of the batch
+        float multiplier = (qp->input_scale * qp->weight_scales[g_oc]) / qp->output_scale;
+        for (uint32_t b = 0; b < batch; ++b) {
+            int64_t acc_q63 = 0;
+            arm_dot_prod_q15(weight_buffer, input_buffer + b * input_channels, input_channels, &acc_q63);
+            int32_t acc = (int32_t)acc_q63 + bias[g_oc];
+            output[oc * batch + b] = requantize(acc, multiplier, qp->output_zero_point, args);
+        }
     }
 }
 
 void dsp_linear(const uint8_t *input, const int8_t *weights, const int32_t *bias, 
-                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp) {                            
+                        uint8_t *output, const LayerConfig *cfg, const QuantParams *qp, const KernelArgs *args) {                            
     const uint32_t input_channels = cfg->input_channels;
-    const uint32_t output_channels = qp->num_channels; // use this num because it's distributed
 
     std::vector<int16_t> weight_buffer(input_channels);
-    std::vector<int16_t> input_buffer(input_channels);
+    std::vector<int16_t> input_buffer(input_channels * (args->batch > 1 ? args->batch : 1));
 
-    _dsp_linear(input, weights, bias, output, cfg, qp, input_buffer.data(), weight_buffer.data());
+    _dsp_linear(input, weights, bias, output, cfg, qp, args, input_buffer.data(), weight_buffer.data());
 }
 
 
@@ -0,0 +1,46 @@
+#include "pool/pool.h"
+
+namespace pool {
+
+// sum of `pixels` values `step` bytes apart: a CHW plane (step 1) or an HWC channel (step = channels)
+static uint32_t sum_channel(const uint8_t *first, uint32_t pixels, uint32_t step) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < pixels; ++i) {
+        sum += first[(size_t)i * step];
+    }
+    return sum;
+}
+
+void channel_sums(const uint8_t *input, uint32_t *sums, uint32_t channels, uint32_t pixels, bool hwc) {
+    if (hwc) {
+        // one pass over the pixels, each adds a contiguous channel vector
+        for (uint32_t c = 0; c < channels; ++c) {
+            sums[c] = 0;
+        }
+        for (uint32_t i = 0; i < pixels; ++i) {
+            const uint8_t *pixel = input + (size_t)i * channels;
+            for (uint32_t c = 0; c < channels; ++c) {
+                sums[c] += pixel[c];
+            }
+        }
+        return;
+    }
+    for (uint32_t c = 0; c < channels; ++c) {
+        sums[c] = sum_channel(input + (size_t)c * pixels, pixels, 1);
+    }
+}
+
+void channel_means(const uint8_t *input, uint8_t *means, uint32_t channels, uint32_t pixels, bool hwc) {
+    for (uint32_t c = 0; c < channels; ++c) {
+        // channel c is read completely before means[c] (at or before its first byte) is written
+        const uint32_t sum = hwc ? sum_channel(input + c, pixels, channels)
+                                 : sum_channel(input + (size_t)c * pixels, pixels, 1);
+        uint32_t q = sum / pixels, r = sum % pixels;
+        if (2 * r > pixels || (2 * r == pixels && (q & 1))) {
+            ++q;
+        }
+        means[c] = (uint8_t)q;
+    }
+}
+
+} // namespace pool
@@ -5,12 +5,27 @@
 #include "quant_params.h"
 #include "conv/conv2d.h"
 #include "linear/linear.h"
+#include "block/block.h"
+#include "pool/pool.h"
+#include "kernel_args.h"
+#ifdef __has_include
+#if __has_include("weight_shards.h")
+#include "weight_shards.h" // exported next to weights.h when this worker holds only some channels of a layer
+#define HAS_WEIGHT_SHARDS
+#endif
+#endif
+#ifdef BOOT_BENCH
+#include <EEPROM.h>
+#endif
 
 uint8_t Worker::input_buffer_[350 * 1024];  // RAM1: 350KB
 DMAMEM uint8_t Worker::output_buffer_[350 * 1024];  // RAM2: 350KB
+DMAMEM uint8_t Worker::scratch_buffer_[64 * 1024];  // RAM2: 64KB, rolling window of fused blocks
 
 Worker::Worker(uint8_t worker_id, IPAddress svr_ip, uint16_t svr_port)
-    : worker_id_(worker_id), svr_ip_(svr_ip), svr_port_(svr_port), is_connected_(false) {
+    : worker_id_(worker_id), svr_ip_(svr_ip), svr_port_(svr_port), current_task_id_(0), has_pending_header_(false), cancelled_(false),
+      has_queued_task_(false), queued_input_ready_(false), queued_cancelled_(false), is_connected_(false),
+      num_benches_(0), bench_score_(0) {
     state_ = WorkerState::DISCONNECTED;
 }
 
@@ -36,6 +51,9 @@ void Worker::Begin() {
     Serial.printf("Worker %d started with IP: %d.%d.%d.%d\n", 
         worker_id_, local_ip[0], local_ip[1], local_ip[2], local_ip[3]);
 
+#ifdef BOOT_BENCH
+    RunBootBench();
+#endif
     // ConnectToServer();
 }
 
@@ -67,6 +85,12 @@ void Worker::Loop() {
     }
 }
 
+bool Worker::IsIdle() {
+    // the coordinator may keep several tasks in flight; they queue up on the socket
+    // and are served back to back, so don't sleep while one is waiting
+    return state_ == WorkerState::IDLE && client_.available() < (int)sizeof(MessageHeader);
+}
+
 void Worker::HandleDisconnected() {
     state_ = WorkerState::CONNECTING;
 }
@@ -79,6 +103,8 @@ void Worker::HandleConnecting() {
         Serial.printf("Worker %d connected to server %d.%d.%d.%d:%d\n", 
             worker_id_, svr_ip_[0], svr_ip_[1], svr_ip_[2], svr_ip_[3], svr_port_);
         is_connected_ = true;
+        has_pending_header_ = false; // nothing read ahead from an earlier connection counts
+        has_queued_task_ = false;
         state_ = WorkerState::REGISTERING;
         return; 
     }
@@ -109,6 +135,9 @@ void Worker::HandleRegistering() {
             
             if (ack_msg.status != 0) {
                 Serial.printf("Registration failed with error code %d\n", ack_msg.status);
+                if (ack_msg.status == (uint8_t)ErrorCode::ERR_UNSUPPORTED_PROTOCOL) {
+                    Serial.printf("Server doesn't speak protocol version %d, reflash the worker\n", PROTOCOL_VERSION);
+                }
                 
                 client_.stop(); // TODO how to gracefully abstract the codes here?
                 is_connected_ = false;
@@ -126,16 +155,83 @@ void Worker::HandleRegistering() {
     state_ = WorkerState::DISCONNECTED;
 }
 
+// output channels of the layer this worker holds weights for, in layer channels. weight_shards.h lists them
+// when the exporter sharded the layer; without it a layer whose quant params cover fewer channels than the
+// layer has is taken to be cut in equal parts by worker id, which is how fc_final has always been exported
+static WeightShard layer_shard(int layer_idx, uint8_t worker_id) {
+#ifdef HAS_WEIGHT_SHARDS
+    for (size_t i = 0; i < sizeof(model_weight_shards) / sizeof(model_weight_shards[0]); ++i) {
+        if (model_weight_shards[i].layer_idx == layer_idx) {
+            return model_weight_shards[i];
+        }
+    }
+#endif
+    const uint32_t held = model_quant_params[layer_idx].num_channels;
+    const uint32_t start = held < model_layer_config[layer_idx].output_channels ? worker_id * held : 0;
+    return {(uint16_t)layer_idx, start, held};
+}
+
+static bool is_whole(const WeightShard &shard) {
+    return shard.oc_start == 0 && shard.oc_count == model_layer_config[shard.layer_idx].output_channels;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t b = 0; b < len; ++b) {
+        hash = (hash ^ bytes[b]) * 0x01000193;
+    }
+    return hash;
+}
+
+// FNV-1a over the int32 fields (in/out channels, kernel size, stride, padding, input/output zero point)
+// of every layer, the coordinator hashes the same fields of model_config.json
+static uint32_t model_hash() {
+    uint32_t hash = 0x811C9DC5;
+    const int num_model_layers = sizeof(model_layer_config) / sizeof(model_layer_config[0]);
+    for (int i = 0; i < num_model_layers; ++i) {
+        const LayerConfig &cfg = model_layer_config[i];
+        const QuantParams &qp = model_quant_params[i];
+        const int32_t fields[] = {(int32_t)cfg.input_channels, (int32_t)cfg.output_channels, (int32_t)cfg.kernel_size,
+                                  (int32_t)cfg.stride, (int32_t)cfg.padding, qp.input_zero_point, qp.output_zero_point};
+        hash = fnv1a(hash, fields, sizeof(fields)); // little-endian, same as the wire
+    }
+    return hash;
+}
+
 void Worker::SendRegistration() {
     MessageHeader header;
     RegisterMessage reg_msg;
     memset(&reg_msg, 0, sizeof(reg_msg));
+    reg_msg.protocol_version = PROTOCOL_VERSION;
+    reg_msg.input_buffer_size = sizeof(input_buffer_);
+    reg_msg.output_buffer_size = sizeof(output_buffer_);
+    reg_msg.scratch_size = sizeof(scratch_buffer_);
+    reg_msg.task_types = (1 << (uint8_t)LayerType::CONV) | (1 << (uint8_t)LayerType::DEPTHWISE) |
+                         (1 << (uint8_t)LayerType::FC) | (1 << (uint8_t)LayerType::BLOCK);
+    reg_msg.task_flags = TASK_FLAG_RESIDUAL | TASK_FLAG_GAP | TASK_FLAG_GAP_MEAN | TASK_FLAG_ACTIVATION | TASK_FLAG_HWC;
+    reg_msg.model_hash = model_hash();
+    reg_msg.bench_score = bench_score_;
+    // the coordinator has to send each sharded layer's channels to the workers holding them
+    const int num_model_layers = sizeof(model_layer_config) / sizeof(model_layer_config[0]);
+    for (int i = 0; i < num_model_layers; ++i) {
+        reg_msg.num_weight_shards += !is_whole(layer_shard(i, worker_id_));
+    }
+    reg_msg.num_kernel_benches = num_benches_;
     // maybe needs refactor to avoid the memcpy
-    init_header(header, MessageType::REGISTER, worker_id_, sizeof(RegisterMessage));
+    init_header(header, MessageType::REGISTER, worker_id_, sizeof(RegisterMessage) + reg_msg.num_weight_shards * sizeof(WeightShard) +
+                                                           reg_msg.num_kernel_benches * sizeof(KernelBench));
     reg_msg.clock_mhz = F_CPU / 1000000;
     Send((const uint8_t *)&header, sizeof(header));
     Send((const uint8_t *)&reg_msg, sizeof(reg_msg)); // TODO error handling needs!
-    Serial.printf("Worker %d sent registration message\n", worker_id_);
+    for (int i = 0; i < num_model_layers; ++i) {
+        const WeightShard shard = layer_shard(i, worker_id_);
+        if (!is_whole(shard)) {
+            Send((const uint8_t *)&shard, sizeof(shard));
+        }
+    }
+    Send((const uint8_t *)benches_, num_benches_ * sizeof(KernelBench));
+    Serial.printf("Worker %d sent registration message, model hash 0x%08x, %d sharded layers, %d kernel benches\n",
+                  worker_id_, reg_msg.model_hash, reg_msg.num_weight_shards, reg_msg.num_kernel_benches);
 }
 
 void Worker::HandleIdle() {
@@ -143,14 +239,43 @@ void Worker::HandleIdle() {
 #ifdef DEBUG
     Serial.printf("Worker %d idle, waiting for tasks...\n", worker_id_);
 #endif
-    if (client_.available() >= sizeof(MessageHeader)) {
-        MessageHeader header;
-        Read((uint8_t *)&header, sizeof(header)); // TODO notice we need nonblocking way here; also error handling maybe
+    if (has_queued_task_) {
+        // it came in behind the last task, see QueueTask
+        has_queued_task_ = false;
+        cancelled_ = queued_cancelled_;
+        current_task_id_ = queued_task_id_;
+        current_task_ = queued_task_;
+        current_residual_ = queued_residual_;
+        memcpy(current_activations_, queued_activations_, sizeof(current_activations_));
+        if (queued_input_ready_) {
+            memmove(input_buffer_, input_buffer_ + queued_input_offset_, current_task_.input_size);
+            state_ = WorkerState::COMPUTING;
+        } else {
+            ReceiveInput();
+        }
+        if (cancelled_ && state_ == WorkerState::COMPUTING) {
+            // cancelled before it started, only the empty result goes back
+            current_result_.compute_time_us = 0;
+            current_result_.kernel_variant = KERNEL_VARIANT_AUTO;
+            current_result_.flags = 0;
+            state_ = WorkerState::SENDING_RESULT;
+        }
+        return;
+    }
+    if (has_pending_header_ || client_.available() >= sizeof(MessageHeader)) {
+        MessageHeader header = pending_header_;
+        if (has_pending_header_) {
+            has_pending_header_ = false;
+        } else {
+            Read((uint8_t *)&header, sizeof(header)); // TODO notice we need nonblocking way here; also error handling maybe
+        }
         if (!validate_header(header)) {
             Serial.println("Invalid message header received, ignoring...");
             return;
         }
         if (header.type == MessageType::TASK) {
+            current_task_id_ = header.task_id;
+            cancelled_ = false;
             state_ = WorkerState::RECEIVING_TASK;
             return;
         }
@@ -160,6 +285,7 @@ void Worker::HandleIdle() {
             state_ = WorkerState::DISCONNECTED;
             return;
         }
+        // a CANCEL here came after its task's result went out, there is nothing left to drop
     }
 }
 
@@ -167,10 +293,32 @@ void Worker::HandleReceivingTask() {
 #ifdef DEBUG
     Serial.printf("Worker %d receiving task...\n", worker_id_);
 #endif
-    Read((uint8_t *)&current_task_, sizeof(current_task_)); // TODO error handling
+    ReadTaskBody(current_task_, current_residual_, current_activations_);
+    ReceiveInput();
+}
+
+// the task message after a TASK header, then its residual params and activation ranges if its flags say so
+void Worker::ReadTaskBody(TaskMessage &task, ResidualParams &residual, ActivationRange *activations) {
+    Read((uint8_t *)&task, sizeof(task)); // TODO error handling
+    if (task.flags & TASK_FLAG_RESIDUAL) {
+        Read((uint8_t *)&residual, sizeof(residual));
+    }
+    const int num_activations = min(3, max(1, (int)task.num_layers));
+    for (int i = 0; i < num_activations; ++i) {
+        activations[i] = {0, 255};
+    }
+    if (task.flags & TASK_FLAG_ACTIVATION) {
+        Read((uint8_t *)activations, num_activations * sizeof(ActivationRange));
+    }
+}
+
+// the current task's input, into input_buffer_
+void Worker::ReceiveInput() {
     uint32_t total_data_size = current_task_.input_size;
     if (total_data_size > sizeof(input_buffer_)) {
         Serial.println("Input data size exceeds buffer size");
+        // read past the input so the next header is read from a message boundary
+        Discard(total_data_size);
         SendError(ErrorCode::ERR_OUT_OF_MEMORY, "Input data size exceeds buffer size");
         state_ = WorkerState::IDLE;
         return;
@@ -179,6 +327,190 @@ void Worker::HandleReceivingTask() {
     state_ = WorkerState::COMPUTING;
 }
 
+// kernel of a single layer task, specialized on the layer's kernel size and stride where conv2d has one
+static KernelFn layer_kernel(int layer_idx, LayerType type) {
+    const LayerConfig &cfg = model_layer_config[layer_idx];
+    if (type == LayerType::FC) {
+        return linear::native_linear;
+    }
+    return conv2d::specialized_conv2d(type == LayerType::DEPTHWISE, cfg.kernel_size, cfg.stride);
+}
+
+// kernel registry: the kernel implementing `variant` of a single layer task, nullptr if the layer type has none
+static KernelFn variant_kernel(int layer_idx, LayerType type, KernelVariant variant) {
+    switch (variant) {
+        case KernelVariant::NATIVE:
+            return layer_kernel(layer_idx, type);
+        case KernelVariant::IM2COL:
+            return type == LayerType::CONV ? conv2d::im2col_conv2d : nullptr;
+        case KernelVariant::DSP:
+            return type == LayerType::FC ? linear::dsp_linear : nullptr;
+    }
+    return nullptr;
+}
+
+#define IM2COL_HEAP_BUDGET (64 * 1024) // the heap shares RAM2 with the DMAMEM buffers
+
+// whether `variant` exists for the layer type and can run this task: im2col is channel-first only and
+// allocates its buffers per task
+static bool variant_runs(int layer_idx, LayerType type, KernelVariant variant, const KernelArgs &args) {
+    if (variant_kernel(layer_idx, type, variant) == nullptr) {
+        return false;
+    }
+    if (variant == KernelVariant::IM2COL) {
+        return !args.hwc && conv2d::im2col_buffer_size(&model_layer_config[layer_idx], &args) <= IM2COL_HEAP_BUDGET;
+    }
+    return true;
+}
+
+// kernel selection policy of a single layer task: the variant the coordinator asked for if it can run the task,
+// otherwise the fastest one at boot that can (BOOT_BENCH), otherwise the native one
+KernelVariant Worker::SelectKernel(int layer_idx, LayerType type, const KernelArgs &args) const {
+    const KernelVariant requested = (KernelVariant)current_task_.kernel_variant;
+    if (current_task_.kernel_variant != KERNEL_VARIANT_AUTO && variant_runs(layer_idx, type, requested, args)) {
+        return requested;
+    }
+    KernelVariant best = KernelVariant::NATIVE;
+    uint32_t best_rate = 0;
+    for (int i = 0; i < num_benches_; ++i) {
+        const KernelBench &bench = benches_[i];
+        if (bench.layer_idx == layer_idx && bench.macs_per_ms > best_rate && variant_runs(layer_idx, type, bench.variant, args)) {
+            best = bench.variant;
+            best_rate = bench.macs_per_ms;
+        }
+    }
+    return best;
+}
+
+#ifdef BOOT_BENCH
+// type of a single layer as the coordinator schedules it: the depthwise layers are the k > 1 ones keeping
+// their channel count and the classifier is the last layer
+static LayerType model_layer_type(int layer_idx) {
+    const int num_model_layers = sizeof(model_layer_config) / sizeof(model_layer_config[0]);
+    const LayerConfig &cfg = model_layer_config[layer_idx];
+    if (layer_idx == num_model_layers - 1) {
+        return LayerType::FC;
+    }
+    return cfg.kernel_size > 1 && cfg.input_channels == cfg.output_channels ? LayerType::DEPTHWISE : LayerType::CONV;
+}
+
+#define BENCH_TILE 8 // output pixels per side of the synthetic conv tile
+#define BENCH_CACHE_MAGIC 0x48434E42 // "BNCH"
+
+// EEPROM layout of the cached benchmark: this header, then num_benches KernelBench
+struct BenchCache {
+    uint32_t magic;
+    uint32_t firmware_hash;
+    uint16_t num_benches;
+    uint32_t bench_score;
+} __attribute__((packed));
+
+// changes with every build and with the model the weights were exported for, so reflashing reruns the
+// benchmark; the kernel addresses catch a relink that didn't recompile this file
+static uint32_t firmware_hash() {
+    static const char build[] = __DATE__ " " __TIME__;
+    const KernelFn kernels[] = {conv2d::native_conv2d, conv2d::im2col_conv2d, conv2d::depthwise_conv2d,
+                                linear::native_linear, linear::dsp_linear};
+    return fnv1a(fnv1a(model_hash(), build, sizeof(build)), kernels, sizeof(kernels));
+}
+
+// MACs per ms of `variant` on a synthetic BENCH_TILE x BENCH_TILE output tile of the layer (one pixel for fc),
+// 0 if the variant can't run the tile. The input is noise, a constant one would let the kernels skip
+// channels whose output saturates
+static uint32_t bench_variant(KernelVariant variant, int layer_idx, LayerType type, uint32_t oc_count,
+                              uint8_t *input, size_t input_len, uint8_t *output, size_t output_len, uint64_t &macs) {
+    const LayerConfig &cfg = model_layer_config[layer_idx];
+    const bool fc = type == LayerType::FC;
+    const uint32_t tile = fc ? 1 : BENCH_TILE;
+    const uint32_t k = fc ? 1 : cfg.kernel_size, s = fc ? 1 : cfg.stride;
+    const uint32_t in_side = (tile - 1) * s + k;
+    const uint32_t in_ch = type == LayerType::DEPTHWISE ? oc_count : cfg.input_channels;
+    if (in_ch * in_side * in_side > input_len || oc_count * tile * tile > output_len) {
+        return 0;
+    }
+    uint32_t seed = 0x2545F491;
+    for (uint32_t i = 0; i < in_ch * in_side * in_side; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        input[i] = seed >> 24;
+    }
+
+    KernelArgs args = {(uint16_t)in_side, (uint16_t)in_side, 0, oc_count, 0, 255, false, 1};
+    if (!variant_runs(layer_idx, type, variant, args)) {
+        return 0;
+    }
+    const KernelFn kernel = variant_kernel(layer_idx, type, variant);
+    const int8_t *weights = model_weights[layer_idx].weights;
+    const int32_t *bias = model_weights[layer_idx].bias;
+    kernel(input, weights, bias, output, &cfg, &model_quant_params[layer_idx], &args); // warm up the caches
+    const uint32_t start = micros();
+    kernel(input, weights, bias, output, &cfg, &model_quant_params[layer_idx], &args);
+    const uint32_t elapsed_us = max(micros() - start, (uint32_t)1);
+
+    macs = (uint64_t)oc_count * tile * tile * (type == LayerType::DEPTHWISE ? k * k : in_ch * k * k);
+    return (uint32_t)(macs * 1000 / elapsed_us);
+}
+
+// times every kernel variant of every layer this worker holds weights for, once per firmware: the results
+// are kept in EEPROM and reloaded on the next boot of the same build
+void Worker::RunBootBench() {
+    const uint32_t hash = firmware_hash();
+    const int max_cached = (EEPROM.length() - (int)sizeof(BenchCache)) / (int)sizeof(KernelBench);
+    BenchCache cache;
+    EEPROM.get(0, cache);
+    if (cache.magic == BENCH_CACHE_MAGIC && cache.firmware_hash == hash &&
+        cache.num_benches <= MAX_KERNEL_BENCHES && cache.num_benches <= max_cached) {
+        for (int i = 0; i < cache.num_benches; ++i) {
+            EEPROM.get(sizeof(BenchCache) + i * sizeof(KernelBench), benches_[i]);
+        }
+        num_benches_ = cache.num_benches;
+        bench_score_ = cache.bench_score;
+        Serial.printf("Worker %d loaded %d kernel benches from EEPROM, %u MACs/ms\n", worker_id_, num_benches_, bench_score_);
+        return;
+    }
+
+    const uint32_t start = millis();
+    const KernelVariant variants[] = {KernelVariant::NATIVE, KernelVariant::IM2COL, KernelVariant::DSP};
+    const int num_model_layers = sizeof(model_layer_config) / sizeof(model_layer_config[0]);
+    uint64_t total_macs = 0;
+    float total_ms = 0;
+    num_benches_ = 0;
+    for (int i = 0; i < num_model_layers; ++i) {
+        const LayerType type = model_layer_type(i);
+        const uint32_t oc_count = layer_shard(i, worker_id_).oc_count;
+        uint32_t best = 0;
+        uint64_t macs = 0;
+        for (KernelVariant variant : variants) {
+            if (num_benches_ == MAX_KERNEL_BENCHES) {
+                break;
+            }
+            const uint32_t macs_per_ms = bench_variant(variant, i, type, oc_count, input_buffer_, sizeof(input_buffer_),
+                                                       output_buffer_, sizeof(output_buffer_), macs);
+            if (macs_per_ms == 0) {
+                continue;
+            }
+            benches_[num_benches_++] = {(uint16_t)i, variant, macs_per_ms};
+            best = max(best, macs_per_ms);
+        }
+        if (best > 0) {
+            total_macs += macs;
+            total_ms += (float)macs / best;
+        }
+    }
+    bench_score_ = total_ms > 0 ? (uint32_t)(total_macs / total_ms) : 0;
+    Serial.printf("Worker %d timed %d kernel benches in %u ms, %u MACs/ms\n",
+                  worker_id_, num_benches_, millis() - start, bench_score_);
+
+    if (num_benches_ > max_cached) {
+        return; // doesn't fit, benchmark again on the next boot
+    }
+    cache = {BENCH_CACHE_MAGIC, hash, num_benches_, bench_score_};
+    EEPROM.put(0, cache);
+    for (int i = 0; i < num_benches_; ++i) {
+        EEPROM.put(sizeof(BenchCache) + i * sizeof(KernelBench), benches_[i]);
+    }
+}
+#endif
+
 // TODO need further developments
 void Worker::HandleComputing() {
 #ifdef DEBUG
@@ -190,64 +522,269 @@ void Worker::HandleComputing() {
     const int8_t *weights = model_weights[layer_idx].weights;
     const int32_t *bias = model_weights[layer_idx].bias;
     uint8_t *output = output_buffer_;
+
+    // a block task runs num_layers layers starting at layer_idx, its output is the last layer's
+    const int num_model_layers = sizeof(model_layer_config) / sizeof(model_layer_config[0]);
+    const int num_layers = current_task_.layer_type == LayerType::BLOCK ? current_task_.num_layers : 1;
+    const int last_idx = layer_idx + num_layers - 1;
+    if (num_layers < 1 || num_layers > 3 || last_idx >= num_model_layers ||
+        (current_task_.layer_type == LayerType::BLOCK && num_layers < 2)) {
+        Serial.println("Layer index out of range");
+        SendError(ErrorCode::ERR_INVALID_TASK, "Layer index out of range");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+
+    // the channel slice must lie inside the (possibly sharded) weights this worker holds,
+    // out_ch_start counts layer channels and the shard's weights start at its first one
+    const WeightShard shard = layer_shard(last_idx, worker_id_);
+    if (current_task_.out_ch_start < shard.oc_start ||
+        current_task_.out_ch_start + current_task_.out_channels > shard.oc_start + shard.oc_count) {
+        Serial.println("Output channel slice out of range");
+        SendError(ErrorCode::ERR_INVALID_TASK, "Output channel slice out of range");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+    // a fused block needs every channel of its inner layers
+    for (int idx = layer_idx; idx < last_idx; ++idx) {
+        if (!is_whole(layer_shard(idx, worker_id_))) {
+            Serial.println("Block layer weights are sharded");
+            SendError(ErrorCode::ERR_INVALID_TASK, "Block layer weights are sharded");
+            state_ = WorkerState::IDLE;
+            return;
+        }
+    }
+
+    if (current_task_.in_h > UINT16_MAX || current_task_.in_w > UINT16_MAX) {
+        Serial.println("Tile is too large for the kernels");
+        SendError(ErrorCode::ERR_INVALID_TASK, "Tile is too large for the kernels");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+    KernelArgs args;
+    args.in_h = current_task_.in_h;
+    args.in_w = current_task_.in_w;
+    args.oc_start = current_task_.out_ch_start - shard.oc_start;
+    args.oc_count = current_task_.out_channels;
+    args.act_min = current_activations_[0].act_min;
+    args.act_max = current_activations_[0].act_max;
+    args.hwc = current_task_.flags & TASK_FLAG_HWC;
+    args.batch = current_task_.batch;
+    // only the classifier takes a batch of inputs, conv layers get batched images stacked along the tile rows
+    if (current_task_.batch == 0 || (current_task_.batch > 1 && current_task_.layer_type != LayerType::FC) ||
+        (current_task_.layer_type == LayerType::FC &&
+         current_task_.input_size != current_task_.batch * model_layer_config[layer_idx].input_channels)) {
+        Serial.println("Invalid batch");
+        SendError(ErrorCode::ERR_INVALID_TASK, "Invalid batch");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+    // depthwise tasks carry only the input planes of their own channels
+    if (current_task_.layer_type == LayerType::DEPTHWISE && current_task_.in_channels != current_task_.out_channels) {
+        Serial.println("Depthwise input channels don't match the channel slice");
+        SendError(ErrorCode::ERR_INVALID_TASK, "Depthwise input channels don't match the channel slice");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+    // conv tasks are padded 2D tiles (halo included), the kernels derive the tile's output size from in_h/in_w
+    if (current_task_.layer_type == LayerType::CONV || current_task_.layer_type == LayerType::DEPTHWISE) {
+        const int k = model_layer_config[layer_idx].kernel_size, s = model_layer_config[layer_idx].stride;
+        if ((int)current_task_.in_h < k || (int)current_task_.in_w < k ||
+            ((int)current_task_.in_h - k) / s + 1 != (int)current_task_.out_h ||
+            ((int)current_task_.in_w - k) / s + 1 != (int)current_task_.out_w) {
+            Serial.println("Tile size doesn't match the layer's kernel");
+            SendError(ErrorCode::ERR_INVALID_TASK, "Tile size doesn't match the layer's kernel");
+            state_ = WorkerState::IDLE;
+            return;
+        }
+    }
+    // conv tiles larger than output_buffer_ are computed block by block, see RunInBlocks
+    const bool conv_task = current_task_.layer_type == LayerType::CONV || current_task_.layer_type == LayerType::DEPTHWISE;
+    const uint32_t out_bytes = current_task_.out_channels * current_task_.out_h * current_task_.out_w * current_task_.batch;
+    if (!conv_task && out_bytes > sizeof(output_buffer_)) {
+        Serial.println("Output data size exceeds buffer size");
+        SendError(ErrorCode::ERR_OUT_OF_MEMORY, "Output data size exceeds buffer size");
+        state_ = WorkerState::IDLE;
+        return;
+    }
+#ifdef DEBUG
+    Serial.printf("Tile origin (%d, %d), %dx%d, channels %d+%d\n", current_task_.out_row_start, current_task_.out_col_start,
+                  current_task_.out_h, current_task_.out_w, current_task_.out_ch_start, current_task_.out_channels);
+#endif
+
+    current_result_.kernel_variant = KERNEL_VARIANT_AUTO;
+    current_result_.flags = 0;
     uint32_t task_start_time = micros();
     switch (current_task_.layer_type) {
         case LayerType::CONV:
-            conv2d::native_conv2d(input, weights, bias, output, 
-                                    &model_layer_config[layer_idx], &model_quant_params[layer_idx],
-                                    current_task_.in_h, current_task_.in_w);
-            success = true;
-            break;
         case LayerType::DEPTHWISE:
-            conv2d::depthwise_conv2d(input, weights, bias, output, 
-                                    &model_layer_config[layer_idx], &model_quant_params[layer_idx],
-                                    current_task_.in_h, current_task_.in_w);
+        case LayerType::FC: {
+            const KernelVariant variant = SelectKernel(layer_idx, current_task_.layer_type, args);
+            const KernelFn kernel = variant_kernel(layer_idx, current_task_.layer_type, variant);
+            current_result_.kernel_variant = (uint8_t)variant;
+            if (out_bytes > sizeof(output_buffer_)) {
+                if (!RunInBlocks(kernel, args)) {
+                    Serial.println("Output blocks don't fit the output buffer");
+                    SendError(ErrorCode::ERR_OUT_OF_MEMORY, "Output blocks don't fit the output buffer");
+                    state_ = WorkerState::IDLE;
+                }
+                return;
+            }
+            kernel(input, weights, bias, output, &model_layer_config[layer_idx], &model_quant_params[layer_idx], &args);
             success = true;
             break;
-        case LayerType::FC:
-            linear::native_linear(input, weights, bias, output,
-                                    &model_layer_config[layer_idx], &model_quant_params[layer_idx]);
-            success = true;
+        }
+        case LayerType::BLOCK: {
+            block::BlockLayer layers[3];
+            for (int i = 0; i < num_layers; ++i) {
+                const int idx = layer_idx + i;
+                layers[i] = {model_weights[idx].weights, model_weights[idx].bias, &model_layer_config[idx], &model_quant_params[idx],
+                             current_activations_[i].act_min, current_activations_[i].act_max};
+            }
+            block::BlockArgs block_args = {(uint16_t)current_task_.in_h, (uint16_t)current_task_.in_w,
+                                           (uint16_t)current_task_.out_h, current_task_.out_row_start, args.hwc};
+            const bool add_residual = current_task_.flags & TASK_FLAG_RESIDUAL;
+            if (add_residual && (current_task_.stride != 1 || current_task_.in_channels != current_task_.out_channels ||
+                                 current_task_.in_w != current_task_.out_w)) {
+                Serial.println("Residual add needs a stride 1 block with matching shapes");
+                SendError(ErrorCode::ERR_INVALID_TASK, "Residual add needs a stride 1 block with matching shapes");
+                state_ = WorkerState::IDLE;
+                return;
+            }
+            success = block::inverted_residual(input, output, scratch_buffer_, sizeof(scratch_buffer_),
+                                               layers, num_layers, &block_args, add_residual ? &current_residual_ : nullptr);
+            if (!success) {
+                Serial.println("Block doesn't fit the scratch buffer");
+                SendError(ErrorCode::ERR_OUT_OF_MEMORY, "Block doesn't fit the scratch buffer");
+                state_ = WorkerState::IDLE;
+                return;
+            }
             break;
+        }
         default:
             break;
     }
-    // TODO check if we need ReLU6 here; QuantWorker doesn't have it
-    uint32_t task_elapsed_time = micros() - task_start_time;
     if (!success) {
         Serial.println("Invalid layer type in task");
         SendError(ErrorCode::ERR_INVALID_TASK, "Invalid layer type in task");
         state_ = WorkerState::IDLE;
         return;
     }
+    current_result_.output_size = out_bytes; // TODO need to check the actual output size
+    if ((current_task_.flags & TASK_FLAG_GAP) && current_task_.layer_type != LayerType::FC) {
+        // pool before sending, one value per channel goes back instead of the whole tile
+        const uint32_t pixels = current_task_.out_h * current_task_.out_w;
+        if (current_task_.flags & TASK_FLAG_GAP_MEAN) {
+            pool::channel_means(output, output, current_task_.out_channels, pixels, args.hwc);
+            current_result_.output_size = current_task_.out_channels;
+        } else {
+            pool::channel_sums(output, (uint32_t *)scratch_buffer_, current_task_.out_channels, pixels, args.hwc);
+            current_result_.output_size = current_task_.out_channels * sizeof(uint32_t);
+            memcpy(output, scratch_buffer_, current_result_.output_size);
+        }
+    }
+    uint32_t task_elapsed_time = micros() - task_start_time;
     // uint32_t compute_time = micros() - start_time;
     current_result_.compute_time_us = task_elapsed_time;
-    current_result_.output_size = current_task_.out_channels * current_task_.out_h * current_task_.out_w; // TODO need to check the actual output size
     state_ = WorkerState::SENDING_RESULT;
 }
 
+// runs a conv task whose output tile doesn't fit output_buffer_ one block at a time, each block a contiguous run
+// of the tile: channel blocks of a channel-first tile, row blocks of a channel-last one. Plain tiles are streamed
+// out block by block behind a RESULT_FLAG_STREAMED result, pooled ones are pooled block by block into
+// scratch_buffer_ and sent as usual. false if a single row or channel doesn't fit, or if the tile is a pooled
+// channel-last depthwise one (its channels interleave in the input, so there is no channel block of it)
+bool Worker::RunInBlocks(KernelFn kernel, const KernelArgs &args) {
+    const int layer_idx = current_task_.layer_idx;
+    const LayerConfig *cfg = &model_layer_config[layer_idx];
+    const bool depthwise = current_task_.layer_type == LayerType::DEPTHWISE;
+    const bool pooled = current_task_.flags & TASK_FLAG_GAP;
+    const bool means = current_task_.flags & TASK_FLAG_GAP_MEAN;
+    const uint32_t out_w = current_task_.out_w, pixels = current_task_.out_h * current_task_.out_w;
+    const bool by_rows = args.hwc && !pooled;
+    const uint32_t per_block = by_rows ? sizeof(output_buffer_) / (out_w * args.oc_count) : sizeof(output_buffer_) / pixels;
+    if (per_block == 0 || (pooled && (args.hwc && depthwise)) ||
+        (pooled && args.oc_count * sizeof(uint32_t) > sizeof(scratch_buffer_))) {
+        return false;
+    }
+
+    if (!pooled) {
+        // the size is known up front, the compute time follows the output
+        current_result_.compute_time_us = 0;
+        current_result_.output_size = args.oc_count * pixels;
+        current_result_.flags = RESULT_FLAG_STREAMED;
+        MessageHeader header;
+        init_header(header, MessageType::RESULT, worker_id_, sizeof(ResultMessage), current_task_id_);
+        Send((const uint8_t *)&header, sizeof(header));
+        Send((const uint8_t *)&current_result_, sizeof(current_result_));
+    }
+    uint32_t compute_time_us = 0;
+    const uint32_t total = by_rows ? current_task_.out_h : args.oc_count;
+    for (uint32_t first = 0; first < total; first += per_block) {
+        const uint32_t count = min(per_block, total - first);
+        KernelArgs block = args;
+        const uint8_t *input = input_buffer_;
+        if (by_rows) {
+            block.in_h = (count - 1) * cfg->stride + cfg->kernel_size;
+            input += first * cfg->stride * args.in_w * current_task_.in_channels;
+        } else {
+            block.oc_start += first;
+            block.oc_count = count;
+            input += depthwise ? first * args.in_h * args.in_w : 0; // the planes of the block's own channels
+        }
+
+        if (CancelRequested()) {
+            // the server discards this output now: pooled tiles stop here, streamed ones still owe the
+            // bytes their result announced and send whatever the output buffer holds
+            if (pooled) {
+                break;
+            }
+            SendOutput(output_buffer_, by_rows ? count * out_w * args.oc_count : count * pixels);
+            continue;
+        }
+        const uint32_t start = micros();
+        kernel(input, model_weights[layer_idx].weights, model_weights[layer_idx].bias, output_buffer_, cfg,
+               &model_quant_params[layer_idx], &block);
+        if (pooled && means) {
+            pool::channel_means(output_buffer_, scratch_buffer_ + first, count, pixels, args.hwc);
+        } else if (pooled) {
+            pool::channel_sums(output_buffer_, (uint32_t *)scratch_buffer_ + first, count, pixels, args.hwc);
+        }
+        compute_time_us += micros() - start;
+        if (!pooled) {
+            SendOutput(output_buffer_, by_rows ? count * out_w * args.oc_count : count * pixels);
+        }
+    }
+
+    if (pooled) {
+        current_result_.output_size = args.oc_count * (means ? 1 : sizeof(uint32_t));
+        current_result_.compute_time_us = compute_time_us;
+        memcpy(output_buffer_, scratch_buffer_, current_result_.output_size);
+        state_ = WorkerState::SENDING_RESULT;
+        return true;
+    }
+    Send((const uint8_t *)&compute_time_us, sizeof(compute_time_us));
+    client_.flush();
+    state_ = WorkerState::IDLE;
+    return true;
+}
+
 void Worker::HandleSendingResult() {
 #ifdef DEBUG
     Serial.printf("Worker %d sending result...\n", worker_id_);
 #endif
+    if (CancelRequested()) {
+        // another worker delivered the slice first, only the empty result goes back
+        current_result_.output_size = 0;
+        current_result_.flags |= RESULT_FLAG_CANCELLED;
+    }
     MessageHeader header;
-    init_header(header, MessageType::RESULT, worker_id_, sizeof(ResultMessage));
+    init_header(header, MessageType::RESULT, worker_id_, sizeof(ResultMessage), current_task_id_);
 
     Send((const uint8_t *)&header, sizeof(header));
     Send((const uint8_t *)&current_result_, sizeof(current_result_));
 
-    // send big data in chunks
-    const size_t CHUNK_SIZE = 1024;  // 1KB per chunk, can be tuned based on performance testing
-    size_t total = current_result_.output_size;
-    size_t offset = 0;
-    
-    while (offset < total) {
-        size_t chunk = min(CHUNK_SIZE, total - offset);
-        Send((const uint8_t *)&output_buffer_[offset], chunk);
-        offset += chunk;
-    }
-
-    // Send(output_buffer_, current_result_.output_size);
+    SendOutput(output_buffer_, current_result_.output_size);
     client_.flush();
 #ifdef DEBUG
     Serial.printf("Worker %d finish sending...\n", worker_id_);
@@ -255,13 +792,76 @@ void Worker::HandleSendingResult() {
     state_ = WorkerState::IDLE;
 }
 
+// whether the server cancelled the current task. The messages behind it are read ahead: the next task (see
+// QueueTask) and cancels, until a message that has to wait for HandleIdle. A cancel of the queued task is kept
+// for when it starts, one of a task already answered is dropped. The scan stops at a second queued task or at a
+// queued task whose input didn't fit next to the current one, a cancel behind them isn't seen and the task's
+// output goes out in full for the server to discard.
+bool Worker::CancelRequested() {
+    while (!cancelled_) {
+        if (!has_pending_header_) {
+            if (client_.available() < (int)sizeof(MessageHeader)) {
+                break;
+            }
+            Read((uint8_t *)&pending_header_, sizeof(pending_header_));
+            has_pending_header_ = true;
+        }
+        if (!validate_header(pending_header_)) {
+            break; // HandleIdle drops it
+        }
+        if (pending_header_.type == MessageType::CANCEL) {
+            has_pending_header_ = false;
+            if (pending_header_.task_id == current_task_id_) {
+                cancelled_ = true;
+            } else if (has_queued_task_ && pending_header_.task_id == queued_task_id_) {
+                queued_cancelled_ = true;
+            }
+            continue;
+        }
+        if (pending_header_.type != MessageType::TASK || has_queued_task_) {
+            break;
+        }
+        has_pending_header_ = false;
+        QueueTask(pending_header_.task_id);
+        if (!queued_input_ready_) {
+            break; // its input is next on the socket
+        }
+    }
+    return cancelled_;
+}
+
+// reads the task behind the current one, its input goes after the current input in input_buffer_ if it fits
+void Worker::QueueTask(uint32_t task_id) {
+    ReadTaskBody(queued_task_, queued_residual_, queued_activations_);
+    has_queued_task_ = true;
+    queued_cancelled_ = false;
+    queued_task_id_ = task_id;
+    queued_input_offset_ = (current_task_.input_size + 3) & ~3u;
+    queued_input_ready_ = queued_input_offset_ + queued_task_.input_size <= sizeof(input_buffer_);
+    if (queued_input_ready_) {
+        Read(input_buffer_ + queued_input_offset_, queued_task_.input_size);
+    }
+}
+
+// send big data in chunks
+void Worker::SendOutput(const uint8_t *buffer, size_t size) {
+    const size_t CHUNK_SIZE = 1024;  // 1KB per chunk, can be tuned based on performance testing
+    size_t offset = 0;
+    
+    while (offset < size) {
+        size_t chunk = min(CHUNK_SIZE, size - offset);
+        Send(buffer + offset, chunk);
+        offset += chunk;
+    }
+}
+
 void Worker::SendError(ErrorCode code, const char *description) {
     MessageHeader header;
     ErrorMessage err_msg;
     memset(&err_msg, 0, sizeof(err_msg));
     strncpy(err_msg.description, description, sizeof(err_msg.description) - 1);
     err_msg.description[sizeof(err_msg.description) - 1] = '\0'; // ensure null-termination
-    init_header(header, MessageType::ERROR, worker_id_, sizeof(ErrorMessage));
+    init_header(header, MessageType::ERROR, worker_id_, sizeof(ErrorMessage), current_task_id_);
     err_msg.error_code = static_cast<uint8_t>(code);
     Send((const uint8_t *)&header, sizeof(header));
     Send((const uint8_t *)&err_msg, sizeof(err_msg));
@@ -308,6 +908,15 @@ void Worker::Read(uint8_t *buffer, size_t size) {
     }
 }
 
+// read and drop `size` bytes, through the input buffer
+void Worker::Discard(size_t size) {
+    while (size > 0) {
+        const size_t chunk = min(size, sizeof(input_buffer_));
+        Read(input_buffer_, chunk);
+        size -= chunk;
+    }
+}
+
 // void Worker::Send(const uint8_t *buffer, size_t size) {
 //     size_t bytes_sent = 0;
 //     while (bytes_sent < size) {
@@ -6,6 +6,8 @@
 
 #include "protocol.h"
 
+#include "kernel_args.h"
+
 class Worker final {
 public:
     Worker(uint8_t worker_id, IPAddress svr_ip, uint16_t svr_port);
@@ -13,6 +15,7 @@ public:
 
     void Begin(); // simiar to setup()
     void Loop();
+    bool IsIdle(); // true when there is nothing queued on the socket, so the caller may sleep
 
 private:
     enum class WorkerState : uint8_t {
@@ -33,12 +36,21 @@ private:
     void HandleReceivingTask();
     void HandleComputing();
     void HandleSendingResult();
+    bool RunInBlocks(KernelFn kernel, const KernelArgs &args);
+    bool CancelRequested();
+    void ReadTaskBody(TaskMessage &task, ResidualParams &residual, ActivationRange *activations);
+    void ReceiveInput();
+    void QueueTask(uint32_t task_id);
 
 private:
+    KernelVariant SelectKernel(int layer_idx, LayerType type, const KernelArgs &args) const;
+    void RunBootBench();
     void SendRegistration();
     void SendError(ErrorCode code, const char *description);
+    void SendOutput(const uint8_t *buffer, size_t size);
     void Send(const uint8_t *buffer, size_t size);
     void Read(uint8_t *buffer, size_t size);
+    void Discard(size_t size);
 
 private:
     WorkerState state_;
@@ -48,12 +60,35 @@ private:
     uint16_t svr_port_;
 
     TaskMessage current_task_;
+    uint32_t current_task_id_;
+    MessageHeader pending_header_; // read ahead by CancelRequested, handled by HandleIdle next
+    bool has_pending_header_;
+    bool cancelled_; // the server cancelled the current task, see CancelRequested
+
+    // the next task, read ahead by CancelRequested while the current one runs so a cancel behind it is seen;
+    // its input follows the current one's in input_buffer_ when it fits there, otherwise it is still on the socket
+    bool has_queued_task_;
+    bool queued_input_ready_;
+    bool queued_cancelled_;
+    uint32_t queued_task_id_;
+    uint32_t queued_input_offset_;
+    TaskMessage queued_task_;
+    ResidualParams queued_residual_;
+    ActivationRange queued_activations_[3];
     ResultMessage current_result_;
     
     bool is_connected_;
 
     static uint8_t input_buffer_[350 * 1024];
     static uint8_t output_buffer_[350 * 1024];
+    static uint8_t scratch_buffer_[64 * 1024];
+    ResidualParams current_residual_; // valid when current_task_.flags has TASK_FLAG_RESIDUAL
+    ActivationRange current_activations_[3]; // per layer of the task, {0, 255} unless TASK_FLAG_ACTIVATION says otherwise
+
+    static const int MAX_KERNEL_BENCHES = 128;
+    KernelBench benches_[MAX_KERNEL_BENCHES]; // timed at boot when built with BOOT_BENCH, sent at registration
+    uint16_t num_benches_;
+    uint32_t bench_score_; // MACs per ms of the model with every layer on its fastest variant, 0 if not measured
 };
 
 #endif // WORKER_H
\ No newline at end of file
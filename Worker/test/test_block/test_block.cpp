@@ -0,0 +1,87 @@
+#include <Arduino.h>
+#include <arm_math.h>
+#include <memory>
+
+#include "conv2d.h"
+#include "block/block.h"
+#include "weights.h"
+#include "layer_config.h"
+#include "quant_params.h"
+
+// blk1: exp 16->96, dw 3x3 stride 2, proj 96->24 on an 8x8 input
+#define IN_C 16
+#define MID_C 96
+#define OUT_C 24
+#define H 8
+#define W 8
+#define OUT_H 4
+#define OUT_W 4
+
+static uint8_t input[IN_C][H][W];
+static uint8_t expanded[MID_C][H][W];
+static uint8_t padded[MID_C][H + 2][W + 2];
+static uint8_t dw_out[MID_C][OUT_H][OUT_W];
+static uint8_t ref_out[OUT_C][OUT_H][OUT_W];
+static uint8_t fused_out[OUT_C][OUT_H][OUT_W];
+static uint8_t scratch[16 * 1024];
+
+static block::BlockLayer layer_ref(int idx) {
+    return {model_weights[idx].weights, model_weights[idx].bias, &model_layer_config[idx], &model_quant_params[idx], 0, 255};
+}
+
+void test_fused_block() {
+    Serial.println("\n========== Fused Block Test ==========");
+    for (size_t i = 0; i < sizeof(input); ++i) {
+        (&input[0][0][0])[i] = random(256);
+    }
+
+    // layer by layer, padding the depthwise input the way the coordinator does
+    uint32_t start = micros();
+    KernelArgs exp_args = {H, W, 0, MID_C, 0, 255};
+    conv2d::native_conv2d(&input[0][0][0], model_weights[3].weights, model_weights[3].bias, &expanded[0][0][0],
+                          &model_layer_config[3], &model_quant_params[3], &exp_args);
+    memset(padded, model_quant_params[4].input_zero_point, sizeof(padded));
+    for (int c = 0; c < MID_C; ++c) {
+        for (int y = 0; y < H; ++y) {
+            memcpy(&padded[c][y + 1][1], &expanded[c][y][0], W);
+        }
+    }
+    KernelArgs dw_args = {H + 2, W + 2, 0, MID_C, 0, 255};
+    conv2d::depthwise_conv2d(&padded[0][0][0], model_weights[4].weights, model_weights[4].bias, &dw_out[0][0][0],
+                             &model_layer_config[4], &model_quant_params[4], &dw_args);
+    KernelArgs proj_args = {OUT_H, OUT_W, 0, OUT_C, 0, 255};
+    conv2d::native_conv2d(&dw_out[0][0][0], model_weights[5].weights, model_weights[5].bias, &ref_out[0][0][0],
+                          &model_layer_config[5], &model_quant_params[5], &proj_args);
+    uint32_t elapsed = micros() - start;
+
+    block::BlockLayer layers[3] = {layer_ref(3), layer_ref(4), layer_ref(5)};
+    block::BlockArgs args = {H, W, OUT_H, 0};
+    uint32_t start_fused = micros();
+    bool ok = block::inverted_residual(&input[0][0][0], &fused_out[0][0][0], scratch, sizeof(scratch), layers, 3, &args);
+    uint32_t elapsed_fused = micros() - start_fused;
+
+    Serial.printf("Input: 16x8x8\n");
+    Serial.printf("BLOCK: layer by layer: %u us, fused: %u us\n", elapsed, elapsed_fused);
+    Serial.printf("BLOCK: scratch %u bytes, output %s\n", (unsigned)block::scratch_size(layers, 3, &args),
+                  ok && memcmp(ref_out, fused_out, sizeof(ref_out)) == 0 ? "matches" : "MISMATCH");
+    Serial.println("============================================");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+    delay(1000);
+    Serial.println("Block Test");
+    Serial.flush();
+    test_fused_block();
+}
+
+void loop() {
+    delay(1000);
+    static uint32_t last_heartbeat = 0;
+    if (millis() - last_heartbeat > 5000) {
+        Serial.print(".");
+        Serial.flush();
+        last_heartbeat = millis();
+    }
+}
@@ -21,12 +21,14 @@ void test_single_conv_layer() {
 
     uint8_t output_im2col[32][2][2];
 
+    KernelArgs args = {4, 4, 0, cfg->output_channels, 0, 255};
+
     uint32_t start = micros();
-    conv2d::native_conv2d(&test_input[0][0][0], weights, bias, &output[0][0][0], cfg, qp, 4, 4);
+    conv2d::native_conv2d(&test_input[0][0][0], weights, bias, &output[0][0][0], cfg, qp, &args);
     uint32_t elapsed = micros() - start;
 
     uint32_t start_im2col = micros();
-    conv2d::im2col_conv2d(&test_input[0][0][0], weights, bias, &output_im2col[0][0][0], cfg, qp, 4, 4);
+    conv2d::im2col_conv2d(&test_input[0][0][0], weights, bias, &output_im2col[0][0][0], cfg, qp, &args);
     uint32_t elapsed_im2col = micros() - start_im2col;
 
     Serial.printf("Input: 3x4x4\n");
@@ -63,8 +65,9 @@ void test_depthwise_conv_layer() {
 
     // output buffer
     uint8_t output[32][4][4];
+    KernelArgs args = {4, 4, 0, cfg->output_channels, 0, 255};
     uint32_t start = micros();
-    conv2d::depthwise_conv2d(&test_input_dw[0][0][0], weights, bias, &output[0][0][0], cfg, qp, 4, 4);
+    conv2d::depthwise_conv2d(&test_input_dw[0][0][0], weights, bias, &output[0][0][0], cfg, qp, &args);
     uint32_t elapsed = micros() - start;
     Serial.printf("Input: 32x4x4\n");
     Serial.printf("CONV: Inference time: %lu us\n", elapsed);
@@ -0,0 +1,128 @@
+#include <Arduino.h>
+#include <arm_math.h>
+#include <memory>
+
+#include "conv2d.h"
+#include "block/block.h"
+#include "weights.h"
+#include "layer_config.h"
+#include "quant_params.h"
+
+// CHW vs HWC on blk1 (exp 16->96, dw 3x3 stride 2, proj 96->24) with a 16x16 input
+#define IN_C 16
+#define MID_C 96
+#define OUT_C 24
+#define H 16
+#define W 16
+#define OUT_H 8
+#define OUT_W 8
+
+static uint8_t input_chw[IN_C * H * W];
+static uint8_t input_hwc[H * W * IN_C];
+static uint8_t padded_chw[MID_C * (H + 2) * (W + 2)];
+static uint8_t padded_hwc[(H + 2) * (W + 2) * MID_C];
+static uint8_t out_chw[MID_C * H * W];
+static uint8_t out_hwc[H * W * MID_C];
+static uint8_t scratch[16 * 1024];
+
+// CHW -> HWC, to compare the two layouts
+static void to_hwc(const uint8_t *chw, uint8_t *hwc, int c, int h, int w) {
+    for (int ch = 0; ch < c; ++ch) {
+        for (int i = 0; i < h * w; ++i) {
+            hwc[i * c + ch] = chw[ch * h * w + i];
+        }
+    }
+}
+
+static bool same(const uint8_t *chw, const uint8_t *hwc, int c, int h, int w) {
+    for (int ch = 0; ch < c; ++ch) {
+        for (int i = 0; i < h * w; ++i) {
+            if (hwc[i * c + ch] != chw[ch * h * w + i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void report(const char *name, uint32_t chw_us, uint32_t hwc_us, bool ok) {
+    Serial.printf("%s: CHW %u us, HWC %u us, %s\n", name, chw_us, hwc_us, ok ? "matches" : "MISMATCH");
+}
+
+static block::BlockLayer layer_ref(int idx) {
+    return {model_weights[idx].weights, model_weights[idx].bias, &model_layer_config[idx], &model_quant_params[idx], 0, 255};
+}
+
+void test_layout() {
+    Serial.println("\n========== Layout Test ==========");
+    for (size_t i = 0; i < sizeof(input_chw); ++i) {
+        input_chw[i] = random(256);
+    }
+    to_hwc(input_chw, input_hwc, IN_C, H, W);
+
+    // pointwise: blk1_exp
+    KernelArgs chw_args = {H, W, 0, MID_C, 0, 255, false, 1};
+    KernelArgs hwc_args = {H, W, 0, MID_C, 0, 255, true, 1};
+    uint32_t start = micros();
+    conv2d::native_conv2d_k<1, 1>(input_chw, model_weights[3].weights, model_weights[3].bias, out_chw,
+                                  &model_layer_config[3], &model_quant_params[3], &chw_args);
+    uint32_t chw_us = micros() - start;
+    start = micros();
+    conv2d::native_conv2d_k<1, 1>(input_hwc, model_weights[3].weights, model_weights[3].bias, out_hwc,
+                                  &model_layer_config[3], &model_quant_params[3], &hwc_args);
+    uint32_t hwc_us = micros() - start;
+    report("POINTWISE blk1_exp", chw_us, hwc_us, same(out_chw, out_hwc, MID_C, H, W));
+
+    // depthwise: blk1_dw on the expanded map, padded with the input zero point
+    const uint8_t zp = model_quant_params[4].input_zero_point;
+    memset(padded_chw, zp, sizeof(padded_chw));
+    for (int c = 0; c < MID_C; ++c) {
+        for (int y = 0; y < H; ++y) {
+            memcpy(&padded_chw[(c * (H + 2) + y + 1) * (W + 2) + 1], &out_chw[(c * H + y) * W], W);
+        }
+    }
+    to_hwc(padded_chw, padded_hwc, MID_C, H + 2, W + 2);
+    KernelArgs dw_chw = {H + 2, W + 2, 0, MID_C, 0, 255, false, 1};
+    KernelArgs dw_hwc = {H + 2, W + 2, 0, MID_C, 0, 255, true, 1};
+    start = micros();
+    conv2d::depthwise_conv2d_k<3, 2>(padded_chw, model_weights[4].weights, model_weights[4].bias, out_chw,
+                                     &model_layer_config[4], &model_quant_params[4], &dw_chw);
+    chw_us = micros() - start;
+    start = micros();
+    conv2d::depthwise_conv2d_k<3, 2>(padded_hwc, model_weights[4].weights, model_weights[4].bias, out_hwc,
+                                     &model_layer_config[4], &model_quant_params[4], &dw_hwc);
+    hwc_us = micros() - start;
+    report("DEPTHWISE blk1_dw", chw_us, hwc_us, same(out_chw, out_hwc, MID_C, OUT_H, OUT_W));
+
+    // the fused block
+    block::BlockLayer layers[3] = {layer_ref(3), layer_ref(4), layer_ref(5)};
+    block::BlockArgs blk_chw = {H, W, OUT_H, 0, false};
+    block::BlockArgs blk_hwc = {H, W, OUT_H, 0, true};
+    start = micros();
+    bool ok = block::inverted_residual(input_chw, out_chw, scratch, sizeof(scratch), layers, 3, &blk_chw);
+    chw_us = micros() - start;
+    start = micros();
+    ok &= block::inverted_residual(input_hwc, out_hwc, scratch, sizeof(scratch), layers, 3, &blk_hwc);
+    hwc_us = micros() - start;
+    report("BLOCK blk1", chw_us, hwc_us, ok && same(out_chw, out_hwc, OUT_C, OUT_H, OUT_W));
+    Serial.println("============================================");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+    delay(1000);
+    Serial.println("Layout Test");
+    Serial.flush();
+    test_layout();
+}
+
+void loop() {
+    delay(1000);
+    static uint32_t last_heartbeat = 0;
+    if (millis() - last_heartbeat > 5000) {
+        Serial.print(".");
+        Serial.flush();
+        last_heartbeat = millis();
+    }
+}
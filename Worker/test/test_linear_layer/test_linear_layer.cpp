@@ -19,8 +19,10 @@ void test_single_linear_layer() {
     // output buffer
     uint8_t output[qp->num_channels];
 
+    KernelArgs args = {1, 1, 0, qp->num_channels, 0, 255};
+
     uint32_t start = micros();
-    linear::native_linear(&test_input[0], weights, bias, &output[0], cfg, qp);
+    linear::native_linear(&test_input[0], weights, bias, &output[0], cfg, qp, &args);
     uint32_t elapsed = micros() - start;
     
     Serial.printf("Input: 1280, Output: 250\n");
@@ -32,12 +34,52 @@ void test_single_linear_layer() {
     // Serial.println("\n============================================");
 }
 
+// a batch of inputs through one call must match the inputs one by one, in class-major order
+#define BATCH 8
+static uint8_t batch_input[BATCH * 1280];
+static uint8_t batch_output[BATCH * 1000];
+
+void test_batched_linear_layer() {
+    Serial.println("\n========== Batched Linear Layer Test ==========");
+
+    const int8_t *weights = model_weights[52].weights;
+    const int32_t *bias = model_weights[52].bias;
+    const LayerConfig *cfg = &model_layer_config[52];
+    const QuantParams *qp = &model_quant_params[52];
+    const uint32_t in = cfg->input_channels, classes = qp->num_channels;
+    for (uint32_t i = 0; i < BATCH * in; ++i) {
+        batch_input[i] = test_input[i % in] + i / in; // every vector a little different
+    }
+
+    KernelArgs args = {1, 1, 0, classes, 0, 255, false, BATCH};
+    uint32_t start = micros();
+    linear::native_linear(batch_input, weights, bias, batch_output, cfg, qp, &args);
+    const uint32_t batched_us = micros() - start;
+
+    uint8_t output[classes];
+    KernelArgs single_args = {1, 1, 0, classes, 0, 255, false, 1};
+    uint32_t single_us = 0;
+    bool ok = true;
+    for (int b = 0; b < BATCH; ++b) {
+        start = micros();
+        linear::native_linear(&batch_input[b * in], weights, bias, output, cfg, qp, &single_args);
+        single_us += micros() - start;
+        for (uint32_t oc = 0; oc < classes; ++oc) {
+            ok &= output[oc] == batch_output[oc * BATCH + b];
+        }
+    }
+    Serial.printf("LINEAR x%d: batched %u us, one by one %u us, %s\n", BATCH, batched_us, single_us,
+                  ok ? "outputs match" : "MISMATCH");
+    Serial.println("============================================");
+}
+
 void setup() {
     Serial.begin(115200);
     while (!Serial);
     delay(1000);
     Serial.println("Linear Layer Test");
     test_single_linear_layer();
+    test_batched_linear_layer();
     Serial.flush();
 }
 
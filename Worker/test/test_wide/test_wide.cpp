@@ -0,0 +1,75 @@
+#include <Arduino.h>
+#include <arm_math.h>
+#include <memory>
+
+#include "conv2d.h"
+#include "weights.h"
+#include "layer_config.h"
+#include "quant_params.h"
+
+// init_conv (3->32, 3x3 stride 2) on one output row of a 512 wide image: the padded tile is 514 columns,
+// wider than the old uint8 dims could hold. It must match the same row computed as narrow column tiles
+#define IN_C 3
+#define OUT_C 32
+#define K 3
+#define S 2
+#define IN_W 514
+#define OUT_W ((IN_W - K) / S + 1)
+#define TILE_W 64 // output columns per narrow tile
+
+static uint8_t input[IN_C * K * IN_W];
+static uint8_t tile[IN_C * K * ((TILE_W - 1) * S + K)];
+static uint8_t out_wide[OUT_C * OUT_W];
+static uint8_t out_tile[OUT_C * TILE_W];
+
+void test_wide() {
+    Serial.println("\n========== Wide Input Test ==========");
+    for (size_t i = 0; i < sizeof(input); ++i) {
+        input[i] = random(256);
+    }
+
+    KernelArgs wide_args = {K, IN_W, 0, OUT_C, 0, 255, false, 1};
+    uint32_t start = micros();
+    conv2d::native_conv2d_k<K, S>(input, model_weights[0].weights, model_weights[0].bias, out_wide,
+                                  &model_layer_config[0], &model_quant_params[0], &wide_args);
+    const uint32_t wide_us = micros() - start;
+
+    bool ok = true;
+    for (int col = 0; col < OUT_W; col += TILE_W) {
+        const int cols = min(TILE_W, OUT_W - col);
+        const int tile_w = (cols - 1) * S + K;
+        // the columns under the tile's windows, halo included
+        for (int c = 0; c < IN_C; ++c) {
+            for (int y = 0; y < K; ++y) {
+                memcpy(&tile[(c * K + y) * tile_w], &input[(c * K + y) * IN_W + col * S], tile_w);
+            }
+        }
+        KernelArgs tile_args = {K, (uint16_t)tile_w, 0, OUT_C, 0, 255, false, 1};
+        conv2d::native_conv2d_k<K, S>(tile, model_weights[0].weights, model_weights[0].bias, out_tile,
+                                      &model_layer_config[0], &model_quant_params[0], &tile_args);
+        for (int oc = 0; oc < OUT_C; ++oc) {
+            ok &= memcmp(&out_tile[oc * cols], &out_wide[oc * OUT_W + col], cols) == 0;
+        }
+    }
+    Serial.printf("CONV init_conv %d wide: %u us, %s\n", OUT_W, wide_us, ok ? "matches the narrow tiles" : "MISMATCH");
+    Serial.println("============================================");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+    delay(1000);
+    Serial.println("Wide Input Test");
+    Serial.flush();
+    test_wide();
+}
+
+void loop() {
+    delay(1000);
+    static uint32_t last_heartbeat = 0;
+    if (millis() - last_heartbeat > 5000) {
+        Serial.print(".");
+        Serial.flush();
+        last_heartbeat = millis();
+    }
+}